@@ -0,0 +1,223 @@
+/*
+ * benchcpp.cpp:
+ *	Does geniePi.hpp cost anything over writing the C by hand? First
+ *	building frames - Widget::frame, constFrame, and a C function that
+ *	does what genieWriteObj does - with nothing sent, then writes and
+ *	batches to a pretend display on a pty, both ways. The frames are
+ *	checked to be the same as they go.
+ *
+ *	Copyright (c) 2020 4D Systems PTY Ltd, Sydney, Australia
+ ***********************************************************************
+ * This file is part of geniePi:
+ *    geniePi is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as
+ *    published by the Free Software Foundation, either version 3 of the
+ *    License, or (at your option) any later version.
+ *
+ *    geniePi is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with geniePi.
+ *    If not, see <http://www.gnu.org/licenses/>.
+ ***********************************************************************
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <vector>
+
+#include "geniePi.hpp"
+#include "benchpty.h"
+
+#define	BATCH	16
+
+static volatile unsigned int sink ;
+
+// What the C library does to make a WRITE_OBJ frame
+
+static void cFrame (unsigned char *f, int object, int index, unsigned int value)
+{
+  f [0] = GENIE_WRITE_OBJ ;
+  f [1] = object ;
+  f [2] = index ;
+  f [3] = (value >> 8) & 0xFF ;
+  f [4] = (value >> 0) & 0xFF ;
+  f [5] = f [0] ^ f [1] ^ f [2] ^ f [3] ^ f [4] ;
+}
+
+
+/*
+ * report:
+ *	One line: what, how many a second, and the 50th and 99th
+ *	percentile times if there are any
+ *********************************************************************************
+ */
+static void report (const char *what, int count, unsigned long long took, std::vector<unsigned long long> *lat)
+{
+  std::printf ("%-28s %12.0f/s", what, count * 1e9 / took) ;
+  if (lat != nullptr)
+    std::printf ("  p50 %6.1fuS  p99 %6.1fuS",
+	benchPercentile (lat->data (), count, 50) / 1e3, benchPercentile (lat->data (), count, 99) / 1e3) ;
+  std::putchar ('\n') ;
+}
+
+
+/*
+ * frames:
+ *	Building them, nothing sent
+ *********************************************************************************
+ */
+static int frames (int count)
+{
+  genie::Gauge<3> gauge ;
+  unsigned char f [6] ;
+  unsigned long long start ;
+  int i, bad = 0 ;
+
+  for (i = 0 ; i < 65536 ; ++i)
+  {
+    cFrame (f, GENIE_OBJ_GAUGE, 3, i) ;
+    if (std::memcmp (f, gauge.frame (i).data (), 6) != 0)
+      ++bad ;
+  }
+  cFrame (f, GENIE_OBJ_GAUGE, 3, 1234) ;
+  if (std::memcmp (f, gauge.constFrame<1234>.data (), 6) != 0)
+    ++bad ;
+
+  start = benchNanos () ;
+  for (i = 0 ; i < count ; ++i)
+  {
+    cFrame (f, GENIE_OBJ_GAUGE, 3, i) ;
+    sink += f [3] + f [5] ;
+  }
+  report ("frame, C", count, benchNanos () - start, nullptr) ;
+
+  start = benchNanos () ;
+  for (i = 0 ; i < count ; ++i)
+  {
+    const genie::Frame g = gauge.frame (i) ;
+    sink += g [3] + g [5] ;
+  }
+  report ("frame, Widget::frame", count, benchNanos () - start, nullptr) ;
+
+  start = benchNanos () ;
+  for (i = 0 ; i < count ; ++i)
+  {
+    const genie::Frame &g = gauge.constFrame<1234> ;
+    sink += g [3] + g [5] ;
+  }
+  report ("frame, constFrame", count, benchNanos () - start, nullptr) ;
+
+  return bad ;
+}
+
+
+/*
+ * writes:
+ *	To the pretend display, one at a time and in batches
+ *********************************************************************************
+ */
+static void writes (int count)
+{
+  std::vector<unsigned long long> lat (count) ;
+  unsigned char f [BATCH * 6] ;
+  genie::Gauge<3> gauge ;
+  genie::Batch batch ;
+  unsigned long long start, t ;
+  int i, j, batches = count / BATCH ;
+
+  start = benchNanos () ;
+  for (i = 0 ; i < count ; ++i)
+  {
+    t = benchNanos () ;
+    genieWriteObj (GENIE_OBJ_GAUGE, 3, i) ;
+    lat [i] = benchNanos () - t ;
+  }
+  report ("write, genieWriteObj", count, benchNanos () - start, &lat) ;
+
+  start = benchNanos () ;
+  for (i = 0 ; i < count ; ++i)
+  {
+    t = benchNanos () ;
+    cFrame (f, GENIE_OBJ_GAUGE, 3, i) ;
+    genieWriteObjFrame (f) ;
+    lat [i] = benchNanos () - t ;
+  }
+  report ("write, C genieWriteObjFrame", count, benchNanos () - start, &lat) ;
+
+  start = benchNanos () ;
+  for (i = 0 ; i < count ; ++i)
+  {
+    t = benchNanos () ;
+    gauge.write (i) ;
+    lat [i] = benchNanos () - t ;
+  }
+  report ("write, Widget::write", count, benchNanos () - start, &lat) ;
+
+  start = benchNanos () ;
+  for (i = 0 ; i < count ; ++i)
+  {
+    t = benchNanos () ;
+    gauge.write<1234> () ;
+    lat [i] = benchNanos () - t ;
+  }
+  report ("write, Widget::write<V>", count, benchNanos () - start, &lat) ;
+
+  start = benchNanos () ;
+  for (i = 0 ; i < batches ; ++i)
+  {
+    t = benchNanos () ;
+    for (j = 0 ; j < BATCH ; ++j)
+      cFrame (f + j * 6, GENIE_OBJ_GAUGE, j, i) ;
+    genieWriteObjBatch (f, BATCH) ;
+    lat [i] = benchNanos () - t ;
+  }
+  report ("batch of 16, C", batches, benchNanos () - start, &lat) ;
+
+  start = benchNanos () ;
+  for (i = 0 ; i < batches ; ++i)
+  {
+    t = benchNanos () ;
+    for (j = 0 ; j < BATCH ; ++j)
+      batch.add (GENIE_OBJ_GAUGE, j, i) ;
+    batch.commit () ;
+    lat [i] = benchNanos () - t ;
+  }
+  report ("batch of 16, genie::Batch", batches, benchNanos () - start, &lat) ;
+}
+
+
+int main (int argc, char *argv [])
+{
+  char *device ;
+  int count = 20000, i ;
+
+  if (argc > 1)
+    count = std::atoi (argv [1]) ;
+  if (count < BATCH)
+  {
+    std::fprintf (stderr, "Usage: %s [count]\n", argv [0]) ;
+    return EXIT_FAILURE ;
+  }
+
+  if (frames (count * 1000) != 0)
+    std::printf ("The C and C++ frames differ!\n") ;
+
+  if (((device = benchDisplayStart (0)) == nullptr) || (genieSetup (device, 115200) != 0))
+  {
+    std::fprintf (stderr, "%s: Unable to start the display: %s\n", argv [0], std::strerror (errno)) ;
+    return EXIT_FAILURE ;
+  }
+
+  for (i = 0 ; i < 100 ; ++i)			// Settle the link model
+    genieWriteObj (GENIE_OBJ_GAUGE, 0, i) ;
+
+  writes (count) ;
+
+  return EXIT_SUCCESS ;
+}
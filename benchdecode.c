@@ -0,0 +1,262 @@
+/*
+ * benchdecode.c:
+ *	How fast genieDecodeFrame picks apart what the display sends. The
+ *	stream is what was received in a capture file, if given one, or
+ *	else a made up one with the mix a busy display sends: mostly
+ *	events and ACKs, some object reports, magic and double byte
+ *	reports, the odd NAK and bad checksum. Either is repeated to make
+ *	it up to the size asked for, then decoded whole, as the listener
+ *	would, a number of times; the best run is reported.
+ *
+ *	Copyright (c) 2020 4D Systems PTY Ltd, Sydney, Australia
+ ***********************************************************************
+ * This file is part of geniePi:
+ *    geniePi is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as
+ *    published by the Free Software Foundation, either version 3 of the
+ *    License, or (at your option) any later version.
+ *
+ *    geniePi is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with geniePi.
+ *    If not, see <http://www.gnu.org/licenses/>.
+ ***********************************************************************
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "geniePi.h"
+#include "benchpty.h"
+
+#ifndef	TRUE
+#  define	TRUE (1==1)
+#  define	FALSE (1==0)
+#endif
+
+#define	RUNS	10
+
+static unsigned char *stream ;
+static size_t streamLen, streamMax ;
+
+
+static int add (const unsigned char *buf, size_t len)
+{
+  if (streamLen + len > streamMax)
+    return FALSE ;
+  memcpy (stream + streamLen, buf, len) ;
+  streamLen += len ;
+
+  return TRUE ;
+}
+
+static int addFrame (unsigned char *frame, int len, int good)
+{
+  unsigned int checksum = 0 ;
+  int i ;
+
+  for (i = 0 ; i < len ; ++i)
+    checksum ^= frame [i] ;
+  frame [len] = good ? checksum : checksum ^ 0x5A ;
+
+  return add (frame, len + 1) ;
+}
+
+
+/*
+ * makeStream:
+ *	The made up one
+ *********************************************************************************
+ */
+static void makeStream (void)
+{
+  unsigned char frame [GENIE_MAX_FRAME] ;
+  int i, n, pick ;
+
+  srand (1) ;
+
+  for (;;)
+  {
+    pick = rand () % 100 ;
+
+    if (pick < 25)				// ACK, or now and then NAK
+    {
+      frame [0] = (pick == 0) ? GENIE_NAK : GENIE_ACK ;
+      if (!add (frame, 1))
+	return ;
+      continue ;
+    }
+
+    if (pick < 90)				// Events and object reports
+    {
+      frame [0] = (pick < 75) ? GENIE_REPORT_EVENT : GENIE_REPORT_OBJ ;
+      frame [1] = rand () % 40 ;
+      frame [2] = rand () % 16 ;
+      frame [3] = rand () ;
+      frame [4] = rand () ;
+      n = 5 ;
+    }
+    else if (pick < 96)				// Magic bytes
+    {
+      frame [0] = GENIE_REPORT_MAGIC_BYTES ;
+      frame [1] = rand () % 8 ;
+      frame [2] = rand () % 64 ;
+      for (i = 0 ; i < frame [2] ; ++i)
+	frame [3 + i] = rand () ;
+      n = 3 + frame [2] ;
+    }
+    else					// Double bytes
+    {
+      frame [0] = GENIE_REPORT_DOUBLE_BYTES ;
+      frame [1] = rand () % 8 ;
+      frame [2] = rand () % 32 ;
+      for (i = 0 ; i < 2 * frame [2] ; ++i)
+	frame [3 + i] = rand () ;
+      n = 3 + 2 * frame [2] ;
+    }
+
+    if (!addFrame (frame, n, (rand () % 1000) != 0))
+      return ;
+  }
+}
+
+
+/*
+ * loadCapture:
+ *	What the display sent in a capture, over and over
+ *********************************************************************************
+ */
+static int loadCapture (const char *path)
+{
+  struct genieCaptureHeader *cap ;
+  struct genieCaptureRecord rec ;
+  const unsigned char *ring ;
+  unsigned char data [65536] ;
+  unsigned long long pos ;
+  size_t off, once ;
+  struct stat st ;
+  int fd ;
+
+  if ((fd = open (path, O_RDONLY)) == -1)
+    return -1 ;
+  if ((fstat (fd, &st) == -1) || (st.st_size < (off_t)sizeof (*cap)) ||
+      ((cap = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED))
+    { close (fd) ; errno = EINVAL ; return -1 ; }
+  close (fd) ;
+
+  if ((cap->magic != GENIE_CAPTURE_MAGIC) || (cap->version != GENIE_CAPTURE_VERSION) ||
+      (cap->size + sizeof (*cap) > (unsigned long long)st.st_size))
+    { munmap (cap, st.st_size) ; errno = EINVAL ; return -1 ; }
+
+  ring = (const unsigned char *)(cap + 1) ;
+
+  for (pos = cap->tail ; pos < cap->head ; pos += sizeof (rec) + rec.len)
+  {
+    for (off = 0 ; off < sizeof (rec) ; ++off)			// Either may wrap
+      ((unsigned char *)&rec) [off] = ring [(pos + off) % cap->size] ;
+    for (off = 0 ; off < rec.len ; ++off)
+      data [off] = ring [(pos + sizeof (rec) + off) % cap->size] ;
+
+    if ((rec.dir == GENIE_CAPTURE_RX) && !add (data, rec.len))
+      break ;
+  }
+
+  munmap (cap, st.st_size) ;
+
+  if ((once = streamLen) == 0)
+    { errno = ENODATA ; return -1 ; }
+
+  while (add (stream, once))
+    ;
+
+  return 0 ;
+}
+
+
+/*
+ * decode:
+ *	The whole stream, as the listener does it. Frames decoded.
+ *********************************************************************************
+ */
+static unsigned long decode (unsigned long *bad)
+{
+  struct genieFrame frame ;
+  unsigned long frames = 0 ;
+  size_t pos = 0 ;
+  int len ;
+
+  *bad = 0 ;
+
+  while ((len = genieDecodeFrame (stream + pos, streamLen - pos, &frame)) != 0)
+  {
+    if (len < 0)
+    {
+      ++*bad ;
+      len = -len ;
+    }
+    pos += len ;
+    ++frames ;
+  }
+
+  return frames ;
+}
+
+
+int main (int argc, char *argv [])
+{
+  unsigned long long start, took, best = 0 ;
+  unsigned long frames = 0, bad = 0 ;
+  const char *capture = NULL ;
+  int megabytes = 64 ;
+  int opt, i ;
+
+  while ((opt = getopt (argc, argv, "c:m:")) != -1)
+    switch (opt)
+    {
+      case 'c':	capture   = optarg ;		break ;
+      case 'm':	megabytes = atoi (optarg) ;	break ;
+      default:	megabytes = 0 ;			break ;
+    }
+
+  streamMax = (size_t)megabytes << 20 ;
+  if ((megabytes < 1) || ((stream = malloc (streamMax)) == NULL))
+  {
+    fprintf (stderr, "Usage: %s [-c capture] [-m megabytes]\n", argv [0]) ;
+    return EXIT_FAILURE ;
+  }
+
+  if (capture == NULL)
+    makeStream () ;
+  else if (loadCapture (capture) != 0)
+  {
+    fprintf (stderr, "%s: %s: %s\n", argv [0], capture, strerror (errno)) ;
+    return EXIT_FAILURE ;
+  }
+
+  for (i = 0 ; i < RUNS ; ++i)
+  {
+    start  = benchNanos () ;
+    frames = decode (&bad) ;
+    took   = benchNanos () - start ;
+    if ((best == 0) || (took < best))
+      best = took ;
+  }
+
+  printf ("%s: %.1f MB, %lu frames (%lu bad checksums)\n", (capture == NULL) ? "made up" : capture,
+	streamLen / 1048576.0, frames, bad) ;
+  printf ("%.0f MB/s, %.1f nS a frame\n", streamLen / 1048576.0 / (best / 1e9), (double)best / frames) ;
+
+  return EXIT_SUCCESS ;
+}
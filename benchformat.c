@@ -0,0 +1,171 @@
+/*
+ * benchformat.c:
+ *	Time the library's number formatter (genieFormat, with templates
+ *	compiled once by genieFormatCompile) against snprintf with the same
+ *	template, and gcvt for %g as genieWriteStrFloat used to use, over a
+ *	spread of values. Results are checked to match as they go.
+ *
+ *	Copyright (c) 2020 4D Systems PTY Ltd, Sydney, Australia
+ ***********************************************************************
+ * This file is part of geniePi:
+ *    geniePi is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as
+ *    published by the Free Software Foundation, either version 3 of the
+ *    License, or (at your option) any later version.
+ *
+ *    geniePi is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with geniePi.
+ *    If not, see <http://www.gnu.org/licenses/>.
+ ***********************************************************************
+ */
+
+#define	_GNU_SOURCE
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "geniePi.h"
+#include "benchpty.h"
+
+#define	VALUES	4096
+
+static const char *templates [] =
+{
+  "%d",
+  "%6d",
+  "0x%04X",
+  "%.2f",
+  "Temp: %6.1f C",
+  "%010.4f",
+} ;
+
+static double values [VALUES] ;
+static volatile int sink ;
+
+
+/*
+ * timeFormat, timeSnprintf, timeGcvt:
+ *	ns per value for rounds over all the values
+ *********************************************************************************
+ */
+static double timeFormat (const struct genieFormat *fmt, int rounds)
+{
+  char out [GENIE_MAX_TEXT + 1] ;
+  unsigned long long start = benchNanos () ;
+  int r, i ;
+
+  for (r = 0 ; r < rounds ; ++r)
+    for (i = 0 ; i < VALUES ; ++i)
+      sink += genieFormat (out, fmt, values [i]) ;
+
+  return (double)(benchNanos () - start) / ((double)rounds * VALUES) ;
+}
+
+static double timeSnprintf (const char *spec, int integer, int rounds)
+{
+  char out [GENIE_MAX_TEXT + 1] ;
+  unsigned long long start = benchNanos () ;
+  int r, i ;
+
+  for (r = 0 ; r < rounds ; ++r)
+    for (i = 0 ; i < VALUES ; ++i)
+      if (integer)
+	sink += snprintf (out, sizeof (out), spec, (int)values [i]) ;
+      else
+	sink += snprintf (out, sizeof (out), spec, values [i]) ;
+
+  return (double)(benchNanos () - start) / ((double)rounds * VALUES) ;
+}
+
+static double timeGcvt (int precision, int rounds)
+{
+  char out [64] ;
+  unsigned long long start = benchNanos () ;
+  int r, i ;
+
+  for (r = 0 ; r < rounds ; ++r)
+    for (i = 0 ; i < VALUES ; ++i)
+      sink += strlen (gcvt ((float)values [i], precision, out)) ;
+
+  return (double)(benchNanos () - start) / ((double)rounds * VALUES) ;
+}
+
+
+/*
+ * check:
+ *	See that genieFormat says what printf would. Negative numbers in
+ *	hex and the like are left out: printf shows the two's complement,
+ *	and we show a minus sign.
+ *********************************************************************************
+ */
+static int check (const struct genieFormat *fmt, const char *spec, int integer)
+{
+  char a [GENIE_MAX_TEXT + 1], b [GENIE_MAX_TEXT + 1] ;
+  int i, len, bad = 0 ;
+
+  for (i = 0 ; i < VALUES ; ++i)
+  {
+    if ((fmt->base != 0) && (fmt->base != 10) && (values [i] < 0))
+      continue ;
+    len = genieFormat (a, fmt, values [i]) ;
+    a [len] = 0 ;
+    if (integer)
+      snprintf (b, sizeof (b), spec, (int)values [i]) ;
+    else
+      snprintf (b, sizeof (b), spec, values [i]) ;
+    if (strcmp (a, b) != 0)
+      ++bad ;
+  }
+
+  return bad ;
+}
+
+
+int main (int argc, char *argv [])
+{
+  struct genieFormat fmt ;
+  double ours, theirs ;
+  int rounds = 200 ;
+  int i, integer ;
+
+  if (argc > 1)
+    rounds = atoi (argv [1]) ;
+  if (rounds < 1)
+  {
+    fprintf (stderr, "Usage: %s [rounds]\n", argv [0]) ;
+    return EXIT_FAILURE ;
+  }
+
+  srand (1) ;
+  for (i = 0 ; i < VALUES ; ++i)
+    values [i] = (i & 1) ? (rand () % 20000) - 10000 : (rand () % 2000000 - 1000000) / 1000.0 ;
+
+  printf ("%-16s %10s %10s %8s %s\n", "template", "genieFormat", "snprintf", "speedup", "") ;
+
+  for (i = 0 ; i < (int)(sizeof (templates) / sizeof (templates [0])) ; ++i)
+  {
+    if (genieFormatCompile (&fmt, templates [i]) != 0)
+      continue ;
+    integer = (fmt.base != 0) ;
+
+    ours   = timeFormat   (&fmt, rounds) ;
+    theirs = timeSnprintf (templates [i], integer, rounds) ;
+
+    printf ("%-16s %9.1fnS %9.1fnS %7.2fx %s\n", templates [i], ours, theirs, theirs / ours,
+	check (&fmt, templates [i], integer) ? "(differs)" : "") ;
+  }
+
+  genieFormatCompile (&fmt, "%.6g") ;
+  ours   = timeFormat (&fmt, rounds) ;
+  theirs = timeGcvt   (6, rounds) ;
+  printf ("%-16s %9.1fnS %9.1fnS %7.2fx (against gcvt)\n", "%.6g", ours, theirs, theirs / ours) ;
+
+  return EXIT_SUCCESS ;
+}
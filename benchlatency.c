@@ -0,0 +1,216 @@
+/*
+ * benchlatency.c:
+ *	How long events take from the display sending them to being in the
+ *	library's queue, under each of the listener thread's scheduling
+ *	setups. A pretend display on a pty stamps each event as it writes
+ *	it, and hands the stamp to the latency probe with
+ *	genieSetLatencyClock, so what's measured includes the time to
+ *	wake the listener up - the part the scheduling options change.
+ *
+ *	Every setup is run in a process of its own, with busy threads on
+ *	each CPU (-l to change how many) to compete with. The real-time
+ *	ones need root, or CAP_SYS_NICE.
+ *
+ *	Copyright (c) 2020 4D Systems PTY Ltd, Sydney, Australia
+ ***********************************************************************
+ * This file is part of geniePi:
+ *    geniePi is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as
+ *    published by the Free Software Foundation, either version 3 of the
+ *    License, or (at your option) any later version.
+ *
+ *    geniePi is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with geniePi.
+ *    If not, see <http://www.gnu.org/licenses/>.
+ ***********************************************************************
+ */
+
+#define	_GNU_SOURCE
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/wait.h>
+
+#include "geniePi.h"
+#include "benchpty.h"
+
+#ifndef	TRUE
+#  define	TRUE (1==1)
+#  define	FALSE (1==0)
+#endif
+
+struct setup
+{
+  const char *name ;
+  int policy ;
+  int priority ;
+  int pinned ;			// To the last CPU
+  int lockMemory ;
+} ;
+
+static const struct setup setups [] =
+{
+  { "inherited",			-1,		 0,	FALSE,	FALSE },
+  { "SCHED_OTHER",			SCHED_OTHER,	 0,	FALSE,	FALSE },
+  { "SCHED_RR 20 (default)",		SCHED_RR,	20,	FALSE,	FALSE },
+  { "SCHED_FIFO 50",			SCHED_FIFO,	50,	FALSE,	FALSE },
+  { "SCHED_FIFO 50, pinned",		SCHED_FIFO,	50,	TRUE,	FALSE },
+  { "SCHED_FIFO 50, pinned, mlock",	SCHED_FIFO,	50,	TRUE,	TRUE  },
+} ;
+
+static volatile unsigned long long sent [65536] ;
+static int count  = 5000 ;
+static int period = 500 ;		// uS between events
+
+
+static unsigned long long sentAt (const struct genieReplyExStruct *event)
+{
+  return sent [event->data & 0xFFFF] ;
+}
+
+static void *busy (void *data)
+{
+  volatile unsigned long n = 0 ;
+
+  for (;;)
+    ++n ;
+
+  return NULL ;
+}
+
+static void *sender (void *data)
+{
+  int i ;
+
+  for (i = 0 ; i < count ; ++i)
+  {
+    benchDisplayEvent (GENIE_OBJ_WINBUTTON, 0, i & 0xFFFF, &sent [i & 0xFFFF]) ;
+    usleep (period) ;
+  }
+
+  return NULL ;
+}
+
+
+/*
+ * run:
+ *	Try one setup, in the process it's forked into
+ *********************************************************************************
+ */
+static int run (const struct setup *s, int load)
+{
+  struct genieSetupOptions opts ;
+  struct genieReplyExStruct event ;
+  struct genieLatencyStats stats ;
+  unsigned long total ;
+  pthread_t thread ;
+  char *device ;
+  int i, cpus, p99 ;
+
+  cpus = sysconf (_SC_NPROCESSORS_ONLN) ;
+
+  genieDefaultOptions (&opts) ;
+  opts.policy     = s->policy ;
+  opts.priority   = s->priority ;
+  opts.cpuMask    = s->pinned ? (1UL << (cpus - 1)) : 0 ;
+  opts.lockMemory = s->lockMemory ;
+
+  if (((device = benchDisplayStart (0)) == NULL) || (genieSetupEx (device, 115200, &opts) != 0))
+  {
+    printf ("%-30s %s\n", s->name, strerror (errno)) ;
+    return EXIT_FAILURE ;
+  }
+  genieSetLatencyClock (sentAt) ;
+
+  for (i = 0 ; i < load ; ++i)
+    pthread_create (&thread, NULL, busy, NULL) ;
+
+  usleep (100000) ;
+  genieGetLatencyStats (&stats, TRUE) ;
+  pthread_create (&thread, NULL, sender, NULL) ;
+
+  for (i = 0 ; i < count ; ++i)
+  {
+    while (!genieReplyAvail ())
+    {
+      if (pthread_tryjoin_np (thread, NULL) == 0)	// All sent, and none left
+      {
+	usleep (100000) ;
+	if (!genieReplyAvail ())
+	  goto done ;
+      }
+      usleep (50) ;
+    }
+    genieGetReplyEx (&event) ;
+  }
+
+done:
+  genieGetLatencyStats (&stats, FALSE) ;
+
+  if (stats.count == 0)
+  {
+    printf ("%-30s no events\n", s->name) ;
+    return EXIT_FAILURE ;
+  }
+
+  for (p99 = 0, total = 0 ; p99 < GENIE_LATENCY_BUCKETS - 1 ; ++p99)
+    if ((total += stats.buckets [p99]) * 100 >= stats.count * 99)
+      break ;
+
+  printf ("%-30s %6lu  %6llu  %8.1f  %8u  %8llu\n", s->name, stats.count,
+	stats.minUs, (double)stats.totalUs / stats.count, 2U << p99, stats.maxUs) ;
+
+  return EXIT_SUCCESS ;
+}
+
+
+static void usage (const char *name)
+{
+  fprintf (stderr, "Usage: %s [-l busy threads] [-n events] [-p uS between them]\n", name) ;
+  exit (EXIT_FAILURE) ;
+}
+
+
+int main (int argc, char *argv [])
+{
+  int load = sysconf (_SC_NPROCESSORS_ONLN) ;
+  int opt, i ;
+  pid_t pid ;
+
+  while ((opt = getopt (argc, argv, "l:n:p:")) != -1)
+    switch (opt)
+    {
+      case 'l':	load   = atoi (optarg) ;	break ;
+      case 'n':	count  = atoi (optarg) ;	break ;
+      case 'p':	period = atoi (optarg) ;	break ;
+      default:	usage (argv [0]) ;
+    }
+
+  if ((count < 1) || (count > 65536) || (load < 0))
+    usage (argv [0]) ;
+
+  printf ("%d busy threads, %d events %duS apart; times in uS\n", load, count, period) ;
+  printf ("%-30s %6s  %6s  %8s  %8s  %8s\n", "listener", "events", "min", "average", "p99 <", "max") ;
+  fflush (stdout) ;
+
+  for (i = 0 ; i < (int)(sizeof (setups) / sizeof (setups [0])) ; ++i)
+  {
+    if ((pid = fork ()) == 0)
+      exit (run (&setups [i], load)) ;
+    if (pid > 0)
+      waitpid (pid, NULL, 0) ;
+  }
+
+  return EXIT_SUCCESS ;
+}
@@ -0,0 +1,148 @@
+/*
+ * benchlink.c:
+ *	Time the serial link's transport against a pretend display on a
+ *	pty: object writes and reads one at a time, then pipelined async
+ *	writes. make bench builds this twice, benchlink against the library
+ *	as configured (io_uring if liburing is there) and benchlink-poll
+ *	against the plain poll() transport, so the two can be compared.
+ *
+ *	CPU time is for the whole process, pretend display included; it's
+ *	the same for both, so the difference is the transport's.
+ *
+ *	Copyright (c) 2020 4D Systems PTY Ltd, Sydney, Australia
+ ***********************************************************************
+ * This file is part of geniePi:
+ *    geniePi is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as
+ *    published by the Free Software Foundation, either version 3 of the
+ *    License, or (at your option) any later version.
+ *
+ *    geniePi is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with geniePi.
+ *    If not, see <http://www.gnu.org/licenses/>.
+ ***********************************************************************
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include "geniePi.h"
+#include "benchpty.h"
+
+static volatile int completed ;
+
+static void done (void *arg, int result, unsigned int value)
+{
+  __sync_fetch_and_add (&completed, 1) ;
+}
+
+
+/*
+ * cpuUs:
+ *	User and system time used so far, and context switches
+ *********************************************************************************
+ */
+static unsigned long long cpuUs (long *switches)
+{
+  struct rusage ru ;
+
+  getrusage (RUSAGE_SELF, &ru) ;
+  *switches = ru.ru_nvcsw + ru.ru_nivcsw ;
+
+  return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000ULL + ru.ru_utime.tv_usec + ru.ru_stime.tv_usec ;
+}
+
+
+/*
+ * report:
+ *	Print what one run, started at start with cpu and switches used so
+ *	far, came to
+ *********************************************************************************
+ */
+static void report (const char *name, const char *what, int count, unsigned long long start,
+	unsigned long long cpu, long switches, unsigned long long *lat)
+{
+  unsigned long long took = benchNanos () - start ;
+  long now ;
+
+  cpu = cpuUs (&now) - cpu ;
+  printf ("%-16s %-12s %8.0f/s  cpu %6.1fuS  switches %5.2f", name, what,
+	count * 1e9 / took, (double)cpu / count, (double)(now - switches) / count) ;
+  if (lat != NULL)
+    printf ("  p50 %6.1fuS  p99 %6.1fuS",
+	benchPercentile (lat, count, 50) / 1e3, benchPercentile (lat, count, 99) / 1e3) ;
+  putchar ('\n') ;
+}
+
+
+int main (int argc, char *argv [])
+{
+  unsigned long long *lat, start, cpu, t ;
+  long sw ;
+  char *device ;
+  int count = 20000, i ;
+
+  if (argc > 1)
+    count = atoi (argv [1]) ;
+  if ((count < 1) || ((lat = malloc (count * sizeof (*lat))) == NULL))
+  {
+    fprintf (stderr, "Usage: %s [count]\n", argv [0]) ;
+    return EXIT_FAILURE ;
+  }
+
+  if (((device = benchDisplayStart (0)) == NULL) || (genieSetup (device, 115200) != 0))
+  {
+    fprintf (stderr, "%s: Unable to start the display: %s\n", argv [0], strerror (errno)) ;
+    return EXIT_FAILURE ;
+  }
+
+  for (i = 0 ; i < 100 ; ++i)			// Settle the link model
+    genieWriteObj (GENIE_OBJ_GAUGE, 0, i) ;
+
+// One at a time
+
+  cpu   = cpuUs (&sw) ;
+  start = benchNanos () ;
+  for (i = 0 ; i < count ; ++i)
+  {
+    t = benchNanos () ;
+    genieWriteObj (GENIE_OBJ_GAUGE, i & 0xFF, i) ;
+    lat [i] = benchNanos () - t ;
+  }
+  report (argv [0], "write", count, start, cpu, sw, lat) ;
+
+  cpu   = cpuUs (&sw) ;
+  start = benchNanos () ;
+  for (i = 0 ; i < count ; ++i)
+  {
+    t = benchNanos () ;
+    genieReadObj (GENIE_OBJ_GAUGE, i & 0xFF) ;
+    lat [i] = benchNanos () - t ;
+  }
+  report (argv [0], "read", count, start, cpu, sw, lat) ;
+
+// Pipelined, as many in flight as the window allows
+
+  completed = 0 ;
+  cpu   = cpuUs (&sw) ;
+  start = benchNanos () ;
+  for (i = 0 ; i < count ; ++i)
+    while (genieWriteObjAsync (GENIE_OBJ_GAUGE, i & 0xFF, i, done, NULL) != 0)
+      usleep (100) ;
+  while (completed < count)
+    usleep (100) ;
+  report (argv [0], "async write", count, start, cpu, sw, NULL) ;
+
+  return EXIT_SUCCESS ;
+}
@@ -0,0 +1,282 @@
+/*
+ * benchpty.c:
+ *	What the benchmarks share. The pretend display sits on the master
+ *	side of a pty and answers as a real one would: an ACK for every
+ *	write, a REPORT_OBJ with the last value written for a read and a
+ *	NAK for anything it can't make sense of, after turnaroundUs. It can
+ *	also send events, as if someone were pressing buttons.
+ *
+ *	Copyright (c) 2020 4D Systems PTY Ltd, Sydney, Australia
+ ***********************************************************************
+ * This file is part of geniePi:
+ *    geniePi is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as
+ *    published by the Free Software Foundation, either version 3 of the
+ *    License, or (at your option) any later version.
+ *
+ *    geniePi is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with geniePi.
+ *    If not, see <http://www.gnu.org/licenses/>.
+ ***********************************************************************
+ */
+
+#define	_GNU_SOURCE
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "geniePi.h"
+#include "benchpty.h"
+
+#ifndef	TRUE
+#  define	TRUE (1==1)
+#  define	FALSE (1==0)
+#endif
+
+static int                   master = -1 ;
+static unsigned int          turnaround ;
+static volatile unsigned long frames = 0 ;
+static unsigned short        values [256][256] ;
+static pthread_mutex_t       writeMutex = PTHREAD_MUTEX_INITIALIZER ;
+
+
+/*
+ * benchNanos:
+ *	CLOCK_MONOTONIC in nS, as the library's own stamps are.
+ *********************************************************************************
+ */
+unsigned long long benchNanos (void)
+{
+  struct timespec ts ;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts) ;
+
+  return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec ;
+}
+
+
+/*
+ * benchPercentile:
+ *	The percent'th percentile of count samples, which get sorted.
+ *********************************************************************************
+ */
+static int compare (const void *a, const void *b)
+{
+  unsigned long long x = *(const unsigned long long *)a ;
+  unsigned long long y = *(const unsigned long long *)b ;
+
+  return (x > y) - (x < y) ;
+}
+
+unsigned long long benchPercentile (unsigned long long *samples, int count, int percent)
+{
+  if (count == 0)
+    return 0 ;
+
+  qsort (samples, count, sizeof (samples [0]), compare) ;
+
+  return samples [(int)((long long)(count - 1) * percent / 100)] ;
+}
+
+
+/*
+ * reply:
+ *	Send something back, checksum added, as one write so events and
+ *	answers don't get mixed up. If sent isn't NULL, it's set to when
+ *	(benchNanos) just before the write.
+ *********************************************************************************
+ */
+static int reply (unsigned char *buf, int len, int sum, volatile unsigned long long *sent)
+{
+  int i, result ;
+
+  if (sum)
+  {
+    buf [len] = 0 ;
+    for (i = 0 ; i < len ; ++i)
+      buf [len] ^= buf [i] ;
+    ++len ;
+  }
+
+  pthread_mutex_lock (&writeMutex) ;
+    if (sent != NULL)
+      *sent = benchNanos () ;
+    result = (write (master, buf, len) == len) ? 0 : -1 ;
+  pthread_mutex_unlock (&writeMutex) ;
+
+  return result ;
+}
+
+
+/*
+ * frameLength:
+ *	How long the frame starting at buf is, once we have enough of it
+ *	to tell; 0 if we don't, -1 if it's not something we know.
+ *********************************************************************************
+ */
+static int frameLength (const unsigned char *buf, int have)
+{
+  switch (buf [0])
+  {
+    case GENIE_READ_OBJ:		return 4 ;
+    case GENIE_WRITE_OBJ:		return 6 ;
+    case GENIE_WRITE_CONTRAST:		return 3 ;
+    case GENIE_WRITE_STR:
+    case GENIE_WRITE_INH_LABEL:
+    case GENIE_MAGIC_BYTES:		return (have < 3) ? 0 : 4 + buf [2] ;
+    case GENIE_WRITE_STRU:
+    case GENIE_DOUBLE_BYTES:		return (have < 3) ? 0 : 4 + 2 * buf [2] ;
+  }
+
+  return -1 ;
+}
+
+
+/*
+ * display:
+ *	The display itself: take frames as they come and answer them
+ *********************************************************************************
+ */
+static void *display (void *data)
+{
+  unsigned char buf [4096], out [8] ;
+  int have = 0, len, n, i, sum ;
+
+  for (;;)
+  {
+    if ((n = read (master, buf + have, sizeof (buf) - have)) <= 0)
+    {
+      if ((n < 0) && (errno != EINTR) && (errno != EAGAIN))
+	return NULL ;
+      continue ;
+    }
+    have += n ;
+
+    while (have > 0)
+    {
+      if ((len = frameLength (buf, have)) < 0)
+      {
+	out [0] = GENIE_NAK ;
+	reply (out, 1, FALSE, NULL) ;
+	memmove (buf, buf + 1, --have) ;
+	continue ;
+      }
+      if ((len == 0) || (have < len))
+	break ;
+
+      for (i = sum = 0 ; i < len ; ++i)
+	sum ^= buf [i] ;
+
+      if (turnaround != 0)
+	usleep (turnaround) ;
+
+      if (sum != 0)
+      {
+	out [0] = GENIE_NAK ;
+	reply (out, 1, FALSE, NULL) ;
+      }
+      else if (buf [0] == GENIE_READ_OBJ)
+      {
+	out [0] = GENIE_REPORT_OBJ ;
+	out [1] = buf [1] ;
+	out [2] = buf [2] ;
+	out [3] = values [buf [1]][buf [2]] >> 8 ;
+	out [4] = values [buf [1]][buf [2]] & 0xFF ;
+	reply (out, 5, TRUE, NULL) ;
+      }
+      else
+      {
+	if (buf [0] == GENIE_WRITE_OBJ)
+	  values [buf [1]][buf [2]] = (buf [3] << 8) | buf [4] ;
+	out [0] = GENIE_ACK ;
+	reply (out, 1, FALSE, NULL) ;
+      }
+
+      ++frames ;
+      memmove (buf, buf + len, have -= len) ;
+    }
+  }
+
+  return NULL ;
+}
+
+
+/*
+ * benchDisplayStart:
+ *	Start the pretend display, and return the device to hand to
+ *	genieSetup.
+ *********************************************************************************
+ */
+char *benchDisplayStart (unsigned int turnaroundUs)
+{
+  struct termios options ;
+  pthread_t thread ;
+  char *slave ;
+  int fd ;
+
+  if ((master = posix_openpt (O_RDWR | O_NOCTTY)) == -1)
+    return NULL ;
+  if ((grantpt (master) != 0) || (unlockpt (master) != 0) || ((slave = ptsname (master)) == NULL))
+    return NULL ;
+
+// Keep the far end open, and raw, for as long as we're running
+
+  if ((fd = open (slave, O_RDWR | O_NOCTTY)) == -1)
+    return NULL ;
+  tcgetattr (fd, &options) ;
+  cfmakeraw (&options) ;
+  tcsetattr (fd, TCSANOW, &options) ;
+
+  turnaround = turnaroundUs ;
+
+  if (pthread_create (&thread, NULL, display, NULL) != 0)
+    return NULL ;
+  pthread_detach (thread) ;
+
+  return slave ;
+}
+
+
+/*
+ * benchDisplayEvent:
+ *	Have the display report an event. sent, if not NULL, is set to when
+ *	(benchNanos) it was written to the pty - before the write, so it's
+ *	there for anyone who sees the event.
+ *********************************************************************************
+ */
+int benchDisplayEvent (int object, int index, unsigned int data, volatile unsigned long long *sent)
+{
+  unsigned char out [6] ;
+
+  out [0] = GENIE_REPORT_EVENT ;
+  out [1] = object ;
+  out [2] = index ;
+  out [3] = (data >> 8) & 0xFF ;
+  out [4] = data & 0xFF ;
+
+  return reply (out, 5, TRUE, sent) ;
+}
+
+
+/*
+ * benchDisplayFrames:
+ *	How many frames the display has answered
+ *********************************************************************************
+ */
+unsigned long benchDisplayFrames (void)
+{
+  return frames ;
+}
@@ -0,0 +1,38 @@
+/*
+ * benchpty.h:
+ *	What the benchmarks share: a pretend display on a pty, a clock,
+ *	and percentiles. Not part of the library.
+ *
+ *	Copyright (c) 2020 4D Systems PTY Ltd, Sydney, Australia
+ ***********************************************************************
+ * This file is part of geniePi:
+ *    geniePi is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as
+ *    published by the Free Software Foundation, either version 3 of the
+ *    License, or (at your option) any later version.
+ *
+ *    geniePi is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with geniePi.
+ *    If not, see <http://www.gnu.org/licenses/>.
+ ***********************************************************************
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern char               *benchDisplayStart	(unsigned int turnaroundUs) ;
+extern int                 benchDisplayEvent	(int object, int index, unsigned int data, volatile unsigned long long *sent) ;
+extern unsigned long       benchDisplayFrames	(void) ;
+
+extern unsigned long long  benchNanos		(void) ;
+extern unsigned long long  benchPercentile	(unsigned long long *samples, int count, int percent) ;
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,173 @@
+/*
+ * benchqueue.c:
+ *	How the async request queue copes with many threads at once.
+ *	For 1 to 16 producer threads, each writing to its own objects on
+ *	a pretend display as fast as it can, time every genieWriteObjAsync
+ *	and count how many get through; then the same with genieWriteObj,
+ *	which takes the link in turn, for comparison.
+ *
+ *	The display can only take so many, so once the queue is full the
+ *	producers are told EAGAIN and try again: those tries are counted,
+ *	but only the calls that queued something are timed.
+ *
+ *	Copyright (c) 2020 4D Systems PTY Ltd, Sydney, Australia
+ ***********************************************************************
+ * This file is part of geniePi:
+ *    geniePi is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as
+ *    published by the Free Software Foundation, either version 3 of the
+ *    License, or (at your option) any later version.
+ *
+ *    geniePi is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with geniePi.
+ *    If not, see <http://www.gnu.org/licenses/>.
+ ***********************************************************************
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "geniePi.h"
+#include "benchpty.h"
+
+#define	MAX_PRODUCERS	16
+
+struct producer
+{
+  pthread_t           thread ;
+  int                 id ;
+  int                 async ;
+  unsigned long long *lat ;
+  unsigned long       full ;
+} ;
+
+static volatile unsigned long completed ;
+static volatile int go ;
+static int count = 5000 ;		// Per producer
+
+static void done (void *arg, int result, unsigned int value)
+{
+  __sync_fetch_and_add (&completed, 1) ;
+}
+
+static void *produce (void *data)
+{
+  struct producer *p = (struct producer *)data ;
+  unsigned long long t ;
+  int i ;
+
+  while (!go)
+    sched_yield () ;
+
+  for (i = 0 ; i < count ; ++i)
+  {
+    if (!p->async)
+    {
+      t = benchNanos () ;
+      genieWriteObj (GENIE_OBJ_GAUGE, p->id, i) ;
+      p->lat [i] = benchNanos () - t ;
+      continue ;
+    }
+
+    for (;;)
+    {
+      t = benchNanos () ;
+      if (genieWriteObjAsync (GENIE_OBJ_GAUGE, p->id, i, done, NULL) == 0)
+	break ;
+      ++p->full ;
+      sched_yield () ;
+    }
+    p->lat [i] = benchNanos () - t ;
+  }
+
+  return NULL ;
+}
+
+
+/*
+ * run:
+ *	n producers at once, async or not
+ *********************************************************************************
+ */
+static void run (int n, int async, unsigned long long *all)
+{
+  struct producer p [MAX_PRODUCERS] ;
+  unsigned long long start, took ;
+  unsigned long full = 0 ;
+  int i, total = n * count ;
+
+  completed = 0 ;
+  go        = 0 ;
+
+  for (i = 0 ; i < n ; ++i)
+  {
+    p [i].id    = i ;
+    p [i].async = async ;
+    p [i].lat   = all + i * count ;
+    p [i].full  = 0 ;
+    pthread_create (&p [i].thread, NULL, produce, &p [i]) ;
+  }
+
+  start = benchNanos () ;
+  go    = 1 ;
+
+  for (i = 0 ; i < n ; ++i)
+  {
+    pthread_join (p [i].thread, NULL) ;
+    full += p [i].full ;
+  }
+  if (async)
+    while (completed < (unsigned long)total)
+      usleep (100) ;
+  took = benchNanos () - start ;
+
+  printf ("%-7s %9d %9.0f/s %9.2fuS %9.2fuS %11.2f\n", async ? "async" : "sync", n,
+	total * 1e9 / took, benchPercentile (all, total, 50) / 1e3,
+	benchPercentile (all, total, 99) / 1e3, (double)full / total) ;
+}
+
+
+int main (int argc, char *argv [])
+{
+  static const int producers [] = { 1, 2, 4, 8, 16 } ;
+  unsigned long long *all ;
+  char *device ;
+  int i, async ;
+
+  if (argc > 1)
+    count = atoi (argv [1]) ;
+  if ((count < 1) || ((all = malloc (MAX_PRODUCERS * count * sizeof (*all))) == NULL))
+  {
+    fprintf (stderr, "Usage: %s [writes per producer]\n", argv [0]) ;
+    return EXIT_FAILURE ;
+  }
+
+  if (((device = benchDisplayStart (0)) == NULL) || (genieSetup (device, 115200) != 0))
+  {
+    fprintf (stderr, "%s: Unable to start the display: %s\n", argv [0], strerror (errno)) ;
+    return EXIT_FAILURE ;
+  }
+
+  for (i = 0 ; i < 100 ; ++i)			// Settle the link model
+    genieWriteObj (GENIE_OBJ_GAUGE, 0, i) ;
+
+  printf ("%d writes per producer\n", count) ;
+  printf ("%-7s %9s %11s %11s %11s %11s\n", "", "producers", "writes", "p50 call", "p99 call", "full/write") ;
+
+  for (async = 1 ; async >= 0 ; --async)
+    for (i = 0 ; i < (int)(sizeof (producers) / sizeof (producers [0])) ; ++i)
+      run (producers [i], async, all) ;
+
+  return EXIT_SUCCESS ;
+}
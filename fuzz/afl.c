@@ -0,0 +1,65 @@
+/*
+ * afl.c:
+ *	AFL++ driver for decode.c: reads the input from stdin, in a loop
+ *	when built with afl-clang-fast so one process runs many.
+ *
+ *	Copyright (c) 2020 4D Systems PTY Ltd, Sydney, Australia
+ ***********************************************************************
+ * This file is part of geniePi:
+ *    geniePi is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as
+ *    published by the Free Software Foundation, either version 3 of the
+ *    License, or (at your option) any later version.
+ *
+ *    geniePi is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with geniePi.
+ *    If not, see <http://www.gnu.org/licenses/>.
+ ***********************************************************************
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define	MAX_INPUT	(1 << 20)
+
+#ifndef	__AFL_LOOP
+#  define	__AFL_LOOP(n)	(runs++ == 0)
+#endif
+
+extern int LLVMFuzzerTestOneInput (const uint8_t *data, size_t size) ;
+
+static unsigned char input [MAX_INPUT] ;
+
+int main (int argc, char *argv [])
+{
+  unsigned char *copy ;
+  ssize_t n ;
+  size_t len ;
+  int runs = 0 ;
+
+  while (__AFL_LOOP (10000))
+  {
+    for (len = 0 ; len < MAX_INPUT ; len += n)
+      if ((n = read (0, input + len, MAX_INPUT - len)) <= 0)
+	break ;
+
+// An exact copy, so reading past the end is caught
+
+    if ((copy = malloc (len ? len : 1)) == NULL)
+      return EXIT_FAILURE ;
+    memcpy (copy, input, len) ;
+    LLVMFuzzerTestOneInput (copy, len) ;
+    free (copy) ;
+  }
+
+  (void)runs ;
+  return EXIT_SUCCESS ;
+}
@@ -0,0 +1,101 @@
+/*
+ * decode.c:
+ *	Fuzz target for genieDecodeFrame. The input is taken as bytes
+ *	from the display and picked apart as the listener does, a byte
+ *	at a time until a frame is complete, checking that what comes
+ *	back stays inside the buffer and agrees with itself. Built with
+ *	libFuzzer (make libfuzzer) or, through afl.c, AFL++ (make afl).
+ *
+ *	Copyright (c) 2020 4D Systems PTY Ltd, Sydney, Australia
+ ***********************************************************************
+ * This file is part of geniePi:
+ *    geniePi is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as
+ *    published by the Free Software Foundation, either version 3 of the
+ *    License, or (at your option) any later version.
+ *
+ *    geniePi is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with geniePi.
+ *    If not, see <http://www.gnu.org/licenses/>.
+ ***********************************************************************
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "geniePi.h"
+
+#define	CHECK(c)	do { if (!(c)) { fprintf (stderr, "decode.c:%d: %s\n", __LINE__, #c) ; abort () ; } } while (0)
+
+int LLVMFuzzerTestOneInput (const uint8_t *data, size_t size) ;
+
+
+/*
+ * check:
+ *	One frame decoded from have bytes at buf, which returned len.
+ *********************************************************************************
+ */
+static void check (const unsigned char *buf, int have, int len, const struct genieFrame *frame)
+{
+  int n = (len < 0) ? -len : len ;
+
+  CHECK (n == have) ;				// Not a byte early or late
+  CHECK (n <= GENIE_MAX_FRAME) ;
+  CHECK (frame->cmd == buf [0]) ;
+
+  if ((buf [0] == GENIE_ACK) || (buf [0] == GENIE_NAK))
+  {
+    CHECK (len == 1) ;
+    return ;
+  }
+
+  CHECK (n >= 4) ;
+  CHECK ((frame->object == buf [1]) && (frame->index == buf [2])) ;
+
+  if ((buf [0] == GENIE_REPORT_MAGIC_BYTES) || (buf [0] == GENIE_REPORT_DOUBLE_BYTES))
+  {
+    CHECK (n == 4 + frame->index * ((buf [0] == GENIE_REPORT_MAGIC_BYTES) ? 1 : 2)) ;
+    CHECK ((frame->payload == NULL) || ((frame->payload == buf + 3) && (frame->payload + n - 4 <= buf + have))) ;
+  }
+  else
+  {
+    CHECK (n == 6) ;
+    CHECK (frame->data == (unsigned int)(buf [3] << 8 | buf [4])) ;
+  }
+}
+
+
+int LLVMFuzzerTestOneInput (const uint8_t *data, size_t size)
+{
+  struct genieFrame frame ;
+  size_t pos = 0 ;
+  int have, len = 0 ;
+
+  while (pos < size)
+  {
+    for (have = 1 ; pos + have <= size ; ++have)
+    {
+      memset (&frame, 0xA5, sizeof (frame)) ;
+      if ((len = genieDecodeFrame (data + pos, have, &frame)) != 0)
+	break ;
+      CHECK (have < GENIE_MAX_FRAME) ;		// Must know by then
+    }
+
+    if (len == 0)				// Ran out part way through one
+      break ;
+
+    check (data + pos, have, len, &frame) ;
+    CHECK (genieDecodeFrame (data + pos, size - pos, &frame) == len) ;	// More doesn't change it
+
+    pos += (len < 0) ? -len : len ;
+  }
+
+  return 0 ;
+}
@@ -27,6 +27,9 @@
  ***********************************************************************
  */
 
+#define	_GNU_SOURCE
+
+#include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
@@ -34,18 +37,56 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <float.h>
+#include <limits.h>
+#include <errno.h>
+#include <poll.h>
 #include <sys/ioctl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
 
 #include <time.h>
 #include <sys/time.h>
 
 #include <sched.h>
 #include <pthread.h>
+#include <semaphore.h>
+
+#ifdef	GENIE_URING
+#include <liburing.h>
+#endif
+
+#if	defined (__ARM_NEON) || defined (__ARM_NEON__)
+#include <arm_neon.h>
+#define	GENIE_NEON
+#elif	defined (__SSE2__)
+#include <emmintrin.h>
+#define	GENIE_SSE2
+#endif
 
 #include "geniePi.h"
 
+// Static tracepoints for perf and bpftrace (provider geniePi), when
+//	built with GENIE_USDT - see the Makefile. Without it they, and
+//	anything they'd have to work out for their arguments, vanish.
+
+#ifdef	GENIE_USDT
+#include <sys/sdt.h>
+#  define	GENIE_PROBE2(n,a,b)		DTRACE_PROBE2 (geniePi, n, a, b)
+#  define	GENIE_PROBE3(n,a,b,c)		DTRACE_PROBE3 (geniePi, n, a, b, c)
+#  define	GENIE_PROBE4(n,a,b,c,d)		DTRACE_PROBE4 (geniePi, n, a, b, c, d)
+#  define	GENIE_PROBE5(n,a,b,c,d,e)	DTRACE_PROBE5 (geniePi, n, a, b, c, d, e)
+#  define	GENIE_TRACE_STAMP(v)		((v) = genieNanos ())
+#else
+#  define	GENIE_PROBE2(n,a,b)		do { } while (0)
+#  define	GENIE_PROBE3(n,a,b,c)		do { } while (0)
+#  define	GENIE_PROBE4(n,a,b,c,d)		do { } while (0)
+#  define	GENIE_PROBE5(n,a,b,c,d,e)	do { } while (0)
+#  define	GENIE_TRACE_STAMP(v)		do { } while (0)
+#endif
+
 #ifndef	TRUE
 #  define	TRUE (1==1)
 #  define	FALSE (1==0)
@@ -63,10 +104,40 @@ union FloatLongFrame {
 
 #define	MAX_GENIE_REPLYS	16
 
-static struct genieReplyStruct genieReplys [MAX_GENIE_REPLYS] ;
+static struct genieReplyExStruct genieReplys [MAX_GENIE_REPLYS] ;
 static struct genieMagicReplyStruct genieMagicReplys [MAX_GENIE_REPLYS] ;
+static unsigned char genieReplyFrames [MAX_GENIE_REPLYS][GENIE_MAX_FRAME] ;	// As they came
+static int genieReplyFrameLen [MAX_GENIE_REPLYS] ;
 static int genieReplysHead = 0 ;
 static int genieReplysTail = 0 ;
+static unsigned int genieReplySeq = 0 ;
+static pthread_mutex_t genieReplyMutex = PTHREAD_MUTEX_INITIALIZER ;
+
+// Object types whose events are merged while still queued: dragging
+//	a slider reports every step, but only the latest position matters
+
+static unsigned char genieCoalesce [256] =
+{
+  [GENIE_OBJ_KNOB]		= 1,
+  [GENIE_OBJ_SLIDER]		= 1,
+  [GENIE_OBJ_TRACKBAR]		= 1,
+  [GENIE_OBJ_SMARTSLIDER]	= 1,
+  [GENIE_OBJ_SMARTKNOB]		= 1,
+  [GENIE_OBJ_ISLIDERE]		= 1,
+  [GENIE_OBJ_IMEDIA_SLIDER]	= 1,
+  [GENIE_OBJ_ISLIDERH]		= 1,
+  [GENIE_OBJ_ISLIDERG]		= 1,
+  [GENIE_OBJ_ISLIDERF]		= 1,
+  [GENIE_OBJ_ISLIDERD]		= 1,
+  [GENIE_OBJ_ISLIDERC]		= 1,
+} ;
+
+// How we were set up, and how long events take from arrival to queue
+
+static struct genieSetupOptions genieOptions ;
+static struct genieLatencyStats genieLatency ;
+static pthread_mutex_t genieLatencyMutex = PTHREAD_MUTEX_INITIALIZER ;
+static genieLatencyClock genieLatencyRef = NULL ;
 
 #ifdef	GENIE_DEBUG
 int genieAck = FALSE ;
@@ -80,23 +151,93 @@ static int genieChecksumErrors = 0 ;
 static int genieTimeouts       = 0 ;
 #endif
 
-static pthread_mutex_t genieMutex ;
+// Running totals of ACKs and NAKs, for when more than one frame is
+//	waiting on a reply.
+
+static volatile unsigned int genieAckCount = 0 ;
+static volatile unsigned int genieNakCount = 0 ;
+static unsigned int genieAckBase, genieNakBase ;	// When the link holder sent
+static pthread_mutex_t genieAckMutex = PTHREAD_MUTEX_INITIALIZER ;
+static pthread_cond_t  genieAckCond  = PTHREAD_COND_INITIALIZER ;
+static pthread_once_t  genieAckOnce  = PTHREAD_ONCE_INIT ;
 
 static int genieFd = -1;
+static int genieBaud = 115200 ;
+
+#ifdef	GENIE_USDT
+static unsigned long long genieTxStamp ;	// When we last sent anything
+static unsigned long long genieLinkStamp ;	// When the link was last granted
+#endif
+
+// The reads in progress (if any): the listener hands the matching
+//	REPORT_OBJs straight back here rather than queueing them.
+
+#define	GENIE_MAX_READS		16
+
+struct genieReadSlot
+{
+  int          object ;
+  int          index ;
+  unsigned int data ;
+  volatile int done ;
+} ;
+
+static struct genieReadSlot genieReads [GENIE_MAX_READS] ;
+static volatile int genieReadsPending = 0 ;
+
+// Bumped on a form change to invalidate everything in the string cache
+
+static volatile unsigned int genieStringCacheGen = 1 ;
+
+
+/*
+ * genieConnect:
+ *	Connect to a genied display server on a Unix domain socket. The
+ *	server speaks the same protocol as the display itself.
+ *********************************************************************************
+ */
+static int genieConnect (char *path)
+{
+  struct sockaddr_un addr ;
+  int fd ;
+
+  if (strlen (path) >= sizeof (addr.sun_path))
+    return -1 ;
+
+  if ((fd = socket (AF_UNIX, SOCK_STREAM, 0)) == -1)
+    return -1 ;
+
+  memset (&addr, 0, sizeof (addr)) ;
+  addr.sun_family = AF_UNIX ;
+  strcpy (addr.sun_path, path) ;
+
+  if (connect (fd, (struct sockaddr *)&addr, sizeof (addr)) == -1)
+  {
+    close (fd) ;
+    return -1 ;
+  }
+
+  return fd ;
+}
 
 
 /*
  * genieOpen:
  *	Open and initialise the serial port, setting all the right
  *	port parameters - or as many as are required - hopefully!
+ *	If the device is a socket, then it's a genied server.
  *********************************************************************************
  */
 static int genieOpen (char *device, int baud)
 {
   struct termios options ;
+  struct stat st ;
   speed_t myBaud ;
   int     status, fd ;
 
+  if ((stat (device, &st) == 0) && S_ISSOCK (st.st_mode))
+    return genieConnect (device) ;
+
   switch (baud)
   {
     case     50:	myBaud =     B50 ; break ;
@@ -154,7 +295,7 @@ static int genieOpen (char *device, int baud)
 
   ioctl (fd, TIOCMSET, &status);
 
-  usleep (10000) ;	// 10mS
+  usleep (1000 + 200000000 / baud) ;	// 1mS and 20 characters' time
 
   return fd ;
 }
@@ -171,33 +312,6 @@ static void genieFlush (int fd)
 }
 
 
-/*
- * genieClose:
- *	Release the serial port and any other data we have.
- *********************************************************************************
- */
-void genieClose (void)
-{
-  close (genieFd) ;
-}
-
-
-/*
- * genieDataAvail:
- *	Return the number of bytes of data avalable to be read in the serial port
- *********************************************************************************
- */
-static int genieDataAvail (int fd)
-{
-  int result ;
-
-  if (ioctl (fd, FIONREAD, &result) == -1)
-    return -1 ;
-
-  return result ;
-}
-
-
 /*
  * Support timing functions. These are based on those in wiringPi
  *********************************************************************************
@@ -216,6 +330,20 @@ static unsigned int millis (void)
   return (unsigned int)(t1 - epoch) ;
 }
 
+static unsigned long long genieNanos (void)
+{
+  struct timespec ts ;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts) ;
+
+  return (unsigned long long)ts.tv_sec * 1000000000 + ts.tv_nsec ;
+}
+
+static unsigned long long genieMicros (void)
+{
+  return genieNanos () / 1000 ;
+}
+
 static void delay (unsigned int howLong)
 {
   struct timespec sleeper, dummy ;
@@ -236,788 +364,5710 @@ static void delayMicroseconds (unsigned int howLong)
   nanosleep (&sleeper, &dummy) ;
 }
 
-
 /*
- * genieGetchar:
- *	Return a single character from the device, or -1 if nothing
- *	avalable in 5mS.
+ * Link model:
+ *	What the link to this display has actually been doing, so waits
+ *	and pacing can follow it rather than being fixed guesses. For each
+ *	class of request it keeps a smoothed turnaround - the time from
+ *	sending to the answer less the time the bytes spend on the wire -
+ *	and how much that varies (as TCP does for its RTT), and from runs
+ *	of frames it works out the bytes/S really being carried.
+ *
+ *	Samples are taken by whoever holds the link, from when the frames
+ *	went out to when the listener saw the last answer arrive. They're
+ *	made under genieLinkMutex and published through a seqlock, as the
+ *	mirror's entries are, so the async and animation threads can read
+ *	a consistent view without taking it.
  *********************************************************************************
  */
-static int genieGetchar (void)
+
+#define	GENIE_LINK_CLASSES	3
+#define	GENIE_LINK_MIN_WAIT	10		// mS, least we'll wait for an answer
+#define	GENIE_LINK_IDLE_WAIT	100		// mS, listener wait between frames
+
+static unsigned long long genieLinkSent ;		// When we last sent anything
+static volatile unsigned long long genieAnswerStamp ;	// When the last answer arrived
+
+static double        genieLinkRtt    [GENIE_LINK_CLASSES] ;	// uS
+static double        genieLinkRttVar [GENIE_LINK_CLASSES] ;
+static unsigned long genieLinkSamples [GENIE_LINK_CLASSES] ;
+static double        genieLinkBps = 0.0 ;			// 0 until we know the baud rate
+static volatile unsigned int genieLinkSeq = 0 ;		// Odd while changing
+static pthread_mutex_t genieLinkMutex = PTHREAD_MUTEX_INITIALIZER ;
+
+struct genieLinkView
 {
-  unsigned int timeUp = millis () + 5 ;
-  unsigned char x ;
+  double        rtt ;
+  double        rttVar ;
+  double        bps ;
+  unsigned long samples ;
+} ;
 
-  while (millis () < timeUp)
-    if (genieDataAvail (genieFd))
-    {
-      if (read (genieFd, &x, 1) == 1)
-	return ((int)x) & 0xFF ;
-      return -1 ;
-    }
-    else
-      delayMicroseconds (101) ;
-  
-  return -1 ;
+static double genieLinkRate (double bps)
+{
+  return (bps == 0.0) ? genieBaud / 10.0 : bps ;
 }
 
 
 /*
- * geniePutchar:
- *	Send a single character (byte) to the Genie display
+ * genieLinkGet:
+ *	A consistent copy of the model for one class of request.
  *********************************************************************************
  */
-static void geniePutchar (int data)
-{  
-  unsigned char c = (unsigned char)data ;
-  write (genieFd, &c, 1) ;
+static void genieLinkGet (int cls, struct genieLinkView *v)
+{
+  unsigned int seq ;
+
+  do
+  {
+    while ((seq = genieLinkSeq) & 1)
+      ;
+    __sync_synchronize () ;
+    v->rtt     = genieLinkRtt     [cls] ;
+    v->rttVar  = genieLinkRttVar  [cls] ;
+    v->samples = genieLinkSamples [cls] ;
+    v->bps     = genieLinkRate (genieLinkBps) ;
+    __sync_synchronize () ;
+  } while (genieLinkSeq != seq) ;
 }
 
 
 /*
- * genieReplyListener:
- *	Listen for bytes from the Genie display and build them into
- *	messages, and store them in the message queue
+ * genieLinkSample:
+ *	A request of class cls went out at sent (nS): tx bytes in frames
+ *	frames, answered with rx bytes, the last at genieAnswerStamp.
  *********************************************************************************
  */
-static void *genieReplyListener (void *data)
+static void genieLinkSample (int cls, unsigned long long sent, int tx, int rx, int frames)
 {
-  struct sched_param sched ;
-  int pri = 20 ;
+  double took, wire, err, rate ;
 
-  unsigned int cmd, object, index, msb=0, lsb=0, csum ;
-  unsigned int totalLength = 0, readLength;
-  unsigned int byteData[100];
-  struct genieReplyStruct *reply ;
-  struct genieMagicReplyStruct *magicByteReply ;  
-  int next ;
+  if (genieAnswerStamp <= sent)
+    return ;
 
-// Set to a real-time priority
+  pthread_mutex_lock (&genieLinkMutex) ;
+  ++genieLinkSeq ;
+  __sync_synchronize () ;
 
-  memset (&sched, 0, sizeof(sched)) ;
+  genieLinkBps = genieLinkRate (genieLinkBps) ;
+  took = (genieAnswerStamp - sent) / 1000.0 ;
+  wire = (tx + rx) * 1000000.0 / genieLinkBps ;
 
-  if (pri > sched_get_priority_max (SCHED_RR))
-    pri = sched_get_priority_max (SCHED_RR) ;
+  if (frames == 1)				// Turnaround
+  {
+    if ((took -= wire) < 0.0)
+      took = 0.0 ;
+    if (genieLinkSamples [cls]++ == 0)
+    {
+      genieLinkRtt    [cls] = took ;
+      genieLinkRttVar [cls] = took / 2 ;
+    }
+    else
+    {
+      err = took - genieLinkRtt [cls] ;
+      genieLinkRtt    [cls] += err / 8 ;
+      genieLinkRttVar [cls] += (((err < 0) ? -err : err) - genieLinkRttVar [cls]) / 4 ;
+    }
+  }
+  else if (took > genieLinkRtt [cls])		// Throughput
+  {
+    rate = (tx + rx) * 1000000.0 / (took - genieLinkRtt [cls]) ;
+    if (rate > genieBaud / 10.0)
+      rate = genieBaud / 10.0 ;
+    genieLinkBps = 0.75 * genieLinkBps + 0.25 * rate ;
+  }
 
-  sched.sched_priority = pri ;
-  sched_setscheduler (0, SCHED_RR, &sched) ;
+  __sync_synchronize () ;
+  ++genieLinkSeq ;
+  pthread_mutex_unlock (&genieLinkMutex) ;
+}
 
-// Make sure the serial port is actually open
 
-  while (genieFd == -1)
-    delay (1) ;
+/*
+ * genieLinkPredict:
+ *	How long (uS) until the last answer to frames frames of tx bytes,
+ *	answered with rx, should be back. With margin, it's the time after
+ *	which we can give up on them.
+ *********************************************************************************
+ */
+static double genieLinkPredictFrom (const struct genieLinkView *v, int tx, int rx, int margin)
+{
+  double us ;
 
-// Loop, forever, catching events coming back from the display
+  us = v->rtt + (tx + rx) * 1000000.0 / v->bps ;
+  if (margin)
+    us = 2 * (us + 4 * v->rttVar) ;
 
-  for (;;)
-  {
-    while ((cmd = genieGetchar ()) == -1)
-      ;
+  return us ;
+}
 
-    if (cmd == GENIE_ACK)
-      { genieAck = TRUE ; continue ; }
-    if (cmd == GENIE_NAK)
-      { genieNak = TRUE ; continue ; }
-	  	  
-    csum  = cmd ;
-    if ((object = genieGetchar ()) == -1) { ++genieTimeouts ; continue ; } ; csum ^= object ;
-    if ((index  = genieGetchar ()) == -1) { ++genieTimeouts ; continue ; } ; csum ^= index ;
-	
-	// Check if data received is for magic bytes. If not proceed to normal process in 'else' routine
-	if(cmd == GENIE_REPORT_MAGIC_BYTES || cmd == GENIE_REPORT_DOUBLE_BYTES)
-	{			
-		// total receivable bytes for Double Byte is twice the length specified
-		totalLength = index;
-		if(cmd == GENIE_REPORT_DOUBLE_BYTES) totalLength = index * 2;
-		
-		for(readLength = 0; readLength < totalLength; readLength ++)
-		{
-			if ((byteData[readLength]  = genieGetchar ()) == -1) { ++genieTimeouts ; continue ; } ; csum ^= byteData[readLength] ;
-		}		
-	}
-	
-	else
-	{		
-		if ((msb    = genieGetchar ()) == -1) { ++genieTimeouts ; continue ; } ; csum ^= msb ;
-		if ((lsb    = genieGetchar ()) == -1) { ++genieTimeouts ; continue ; } ; csum ^= lsb ;
-	}
-	
-	// Check resulting checksum value and compare with received checksum byte
-	
-    if (genieGetchar () != csum)
-    {
-      ++genieChecksumErrors ;
-      continue ;
-    }
+static double genieLinkPredict (int cls, int tx, int rx, int margin)
+{
+  struct genieLinkView v ;
 
-	// We have valid data - store it into the buffer
-    next = (genieReplysHead + 1) & (MAX_GENIE_REPLYS - 1) ;
-	
-	
-	if(cmd == GENIE_REPORT_MAGIC_BYTES || cmd == GENIE_REPORT_DOUBLE_BYTES)
-	{	
-		if (next != genieReplysTail)			// Discard rather than overflow
-		{
-		  magicByteReply 		  = &genieMagicReplys[genieReplysHead] ;
-		  magicByteReply->cmd     = cmd ;
-		  magicByteReply->index   = object ;	
-		  magicByteReply->length  = index ;	
-		  		  
-		  if(cmd == GENIE_REPORT_MAGIC_BYTES)
-		  {			  
-			  for(readLength = 0; readLength < totalLength; readLength ++)
-				{
-					magicByteReply->data[readLength]   = byteData[readLength];
-				}  
-		  }
-		  
-		  if(cmd == GENIE_REPORT_DOUBLE_BYTES)
-		  {			  
-			  for(readLength = 1; readLength < totalLength; readLength ++)
-				{
-					magicByteReply->data[readLength]   = byteData[readLength * 2] << 8 | byteData[(readLength * 2) + 1];
-				}  
-		  }
-		  	  
-		  genieReplysHead 		  = next ;
-		}
-	}
-	
-	else
-	{
-		if (next != genieReplysTail)			// Discard rather than overflow
-			{
-			  reply 		= &genieReplys [genieReplysHead] ;
-			  reply->cmd    = cmd ;
-			  reply->object = object ;
-			  reply->index  = index ;
-			  reply->data   = msb << 8 | lsb ;			 
-			  genieReplysHead = next ;
-			}
-	}	
-  }
+  genieLinkGet (cls, &v) ;
 
-  return (void *)NULL ;
+  return genieLinkPredictFrom (&v, tx, rx, margin) ;
+}
+
+static unsigned int genieLinkTimeout (int cls, int tx, int rx, int frames)
+{
+  struct genieLinkView v ;
+  unsigned int ms ;
+
+  genieLinkGet (cls, &v) ;
+
+  if (v.samples == 0)				// Until we know better
+    return 50 + (frames - 1) * 6 + (tx + rx) * 1000 / (unsigned int)v.bps ;
+
+  ms = (unsigned int)(genieLinkPredictFrom (&v, tx, rx, TRUE) / 1000.0) + 1 ;
+
+  return (ms < GENIE_LINK_MIN_WAIT) ? GENIE_LINK_MIN_WAIT : ms ;
 }
 
 
 /*
- * genieReplyAvail:
- *	Return TRUE if there are pending messages from the display
+ * genieLinkByteWait:
+ *	How long (mS) to wait for the next byte of a frame the display is
+ *	part way through sending: a few characters' time, and a bit.
  *********************************************************************************
  */
-int genieReplyAvail (void)
+static unsigned int genieLinkByteWait (void)
 {
-  return (genieReplysHead != genieReplysTail) ;
+  return 2 + 40000 / genieBaud ;
 }
 
 
 /*
- * genieGetReply:
- *	Get the next message out of the Genie Reply queue, or
- *	wait until a message has been sent from the display
+ * genieLinkWindow:
+ *	How many frames of len bytes to send together before waiting for
+ *	their answers: enough that the turnaround is a small part of the
+ *	time, but no more, so anything urgent doesn't wait long behind
+ *	them. Up to most.
  *********************************************************************************
  */
-void genieGetReply (struct genieReplyStruct *reply)
+static int genieLinkWindow (int cls, int len, int most)
 {
-  while (!genieReplyAvail ())
-    delay (1) ;
+  struct genieLinkView v ;
+  double frame ;
+  int n ;
 
-  memcpy (reply, &genieReplys [genieReplysTail], sizeof (struct genieReplyStruct)) ;
+  genieLinkGet (cls, &v) ;
 
-  genieReplysTail = (genieReplysTail + 1) & (MAX_GENIE_REPLYS - 1) ;
+  frame = (len + 1) * 1000000.0 / v.bps ;
+  n = (int)(4 * (v.rtt + 2 * v.rttVar) / frame) ;
+
+  return (n < 4) ? 4 : (n > most) ? most : n ;
 }
 
+
 /*
- * genieReadObj:
- *	Send a read object command to the Genie display and get the result back
+ * genieExpectAck, genieWaitAcks, genieWaitAck:
+ *	Before sending, forget any answers already in, so one that was
+ *	late for an earlier frame isn't taken for this one's. Then wait
+ *	for count ACKs or NAKs, no longer than the link model says they
+ *	could take, and learn from how long they did. 0 if they were all
+ *	ACKed, -1 for a NAK or if they didn't all come.
  *********************************************************************************
  */
-static int _genieReadObj (int object, int index)
+static void genieAckInit (void)		// Timed on a clock NTP can't step
 {
-  struct genieReplyStruct reply ;
-  unsigned int timeUp, checksum ;
-
+  pthread_condattr_t attr ;
 
-// Discard any pending replys
-
-  while (genieReplyAvail ())
-    genieGetReply (&reply) ;
+  pthread_condattr_init (&attr) ;
+  pthread_condattr_setclock (&attr, CLOCK_MONOTONIC) ;
+  pthread_cond_init (&genieAckCond, &attr) ;
+  pthread_condattr_destroy (&attr) ;
+}
 
+static void genieExpectAck (void)
+{
   genieAck = genieNak = FALSE ;
+  genieAckBase = genieAckCount ;
+  genieNakBase = genieNakCount ;
+}
 
-  geniePutchar (GENIE_READ_OBJ) ; checksum   = GENIE_READ_OBJ ;
-  geniePutchar (object) ;         checksum  ^= object ;
-  geniePutchar (index) ;          checksum  ^= index ;
-  geniePutchar (checksum) ;
+static int genieWaitAcks (int cls, int tx, int count)
+{
+  struct timespec deadline ;
+  unsigned long long ns ;
+  unsigned int answered ;
+
+  clock_gettime (CLOCK_MONOTONIC, &deadline) ;
+  ns = deadline.tv_nsec + genieLinkTimeout (cls, tx, count, count) * 1000000ULL ;
+  deadline.tv_sec  += ns / 1000000000ULL ;
+  deadline.tv_nsec  = ns % 1000000000ULL ;
+
+  pthread_mutex_lock (&genieAckMutex) ;
+    while ((answered = (genieAckCount - genieAckBase) + (genieNakCount - genieNakBase)) < (unsigned int)count)
+      if (pthread_cond_timedwait (&genieAckCond, &genieAckMutex, &deadline) != 0)
+	break ;
+  pthread_mutex_unlock (&genieAckMutex) ;
+
+  if (answered < (unsigned int)count)
+    return -1 ;
 
-// Wait up to 50mS for a reply
-//	Note: @9600 baud 5 characters will take 5mS!
+  genieLinkSample (cls, genieLinkSent, tx, count, count) ;
 
-  for (timeUp = millis () + 50 ; millis () < timeUp ;)
-  {
-    if (genieNak)
-      return -1 ;
+  return (genieNakCount != genieNakBase) ? -1 : 0 ;
+}
 
-    if (genieReplyAvail ())
-    {
-      genieGetReply (&reply) ;
-      if ((reply.cmd == GENIE_REPORT_OBJ) && (reply.object == object) && (reply.index == index))
-	return reply.data ;
-    }
+static int genieWaitAck (int cls, int tx)
+{
+  return genieWaitAcks (cls, tx, 1) ;
+}
 
-    delayMicroseconds (101) ;
-  }
 
-  return -1 ;
-}
-int genieReadObj (int object, int index)
+/*
+ * genieGetLinkStats:
+ *	What the link model's worked out so far.
+ *********************************************************************************
+ */
+int genieGetLinkStats (struct genieLinkStats *stats)
 {
-  int result ;
- 
-  pthread_mutex_lock   (&genieMutex) ;
-    result = _genieReadObj (object, index) ;
-  pthread_mutex_unlock (&genieMutex) ;
+  int i ;
 
-  return result ;
+  pthread_mutex_lock (&genieLinkMutex) ;
+    for (i = 0 ; i < GENIE_LINK_CLASSES ; ++i)
+    {
+      stats->rttUs    [i] = (unsigned int)genieLinkRtt    [i] ;
+      stats->rttVarUs [i] = (unsigned int)genieLinkRttVar [i] ;
+      stats->samples  [i] = genieLinkSamples [i] ;
+    }
+    stats->bytesPerSec = (unsigned int)genieLinkRate (genieLinkBps) ;
+    stats->readTimeout = genieLinkTimeout (GENIE_LINK_READ, 4, 6, 1) ;
+    stats->byteTimeout = genieLinkByteWait () ;
+    stats->window      = genieLinkWindow (GENIE_LINK_WRITE, 6, 16) ;
+  pthread_mutex_unlock (&genieLinkMutex) ;
 
+  return 0 ;
 }
 
 
 /*
- * genieWriteObj:
- *	Write data to an object on the display
+ * Transport:
+ *	All bytes to and from the display go through one of these. Frames
+ *	are handed to send() whole, and the receive side fills a small
+ *	buffer that genieGetchar() then hands out a byte at a time.
+ *
+ *	The default transport is poll() + read()/write() on genieFd. When
+ *	built with GENIE_URING (see the Makefile) an io_uring transport is
+ *	tried first and we fall back to the poll one if the kernel or the
+ *	device won't play.
  *********************************************************************************
  */
-static int _genieWriteObj (int object, int index, unsigned int data)
-{
-  unsigned int checksum, msb, lsb ;
-
-  lsb = (data >> 0) & 0xFF ;
-  msb = (data >> 8) & 0xFF ;
 
-  genieAck = genieNak = FALSE ;
+#define	GENIE_RX_BUF_SIZE	256
 
-  geniePutchar (GENIE_WRITE_OBJ) ; checksum  = GENIE_WRITE_OBJ ;
-  geniePutchar (object) ;          checksum ^= object ;
-  geniePutchar (index) ;           checksum ^= index ;
-  geniePutchar (msb) ;             checksum ^= msb ;
-  geniePutchar (lsb) ;             checksum ^= lsb ;
-  geniePutchar (checksum) ;
+struct genieTransport
+{
+  const char *name ;
+  int  (*start)   (int fd) ;
+  int  (*send)    (const unsigned char *buf, int len) ;
+  int  (*receive) (unsigned char *buf, int len, int timeout) ;
+  void (*stop)    (void) ;
+} ;
 
-// TODO: Really ought to timeout here, but if the display doesn't
-//	respond, then it's probably game over anyway.
+static unsigned char genieRxBuf [GENIE_RX_BUF_SIZE] ;
+static int genieRxHead = 0 ;
+static int genieRxLen  = 0 ;
+static unsigned long long genieRxStamp ;	// When what's in genieRxBuf arrived
 
-  while ((genieAck == FALSE) && (genieNak == FALSE))
-    delay (1) ;
 
+/*
+ * genie(Poll)*:
+ *	The plain transport: one write() per frame, and wait for input
+ *	with poll() rather than spinning on FIONREAD.
+ *********************************************************************************
+ */
+static int geniePollStart (int fd)
+{
   return 0 ;
 }
 
-int genieWriteObj (int object, int index, unsigned int data)
+static int geniePollSend (const unsigned char *buf, int len)
 {
-  int result ;
+  int sent = 0, n ;
 
-  pthread_mutex_lock   (&genieMutex) ;
-    result = _genieWriteObj (object, index, data) ;
-  pthread_mutex_unlock (&genieMutex) ;
+  while (sent < len)
+  {
+    if ((n = write (genieFd, buf + sent, len - sent)) < 0)
+    {
+      if (errno == EINTR)
+	continue ;
+      return -1 ;
+    }
+    sent += n ;
+  }
 
-  return result ;
+  return sent ;
 }
 
-int genieWriteShortToIntLedDigits (int index, int16_t data) {
-    return genieWriteObj(GENIE_OBJ_ILED_DIGITS_L, index, data);
-}
+static int geniePollReceive (unsigned char *buf, int len, int timeout)
+{
+  struct pollfd pfd ;
+  int n ;
 
-int genieWriteFloatToIntLedDigits (int index, float data) {
-    union FloatLongFrame frame;
-    frame.floatValue = data;
-    int retval;
-    retval = genieWriteObj(GENIE_OBJ_ILED_DIGITS_H, index, frame.wordValue[1]);
-    if (retval != 1) return retval;
-    return genieWriteObj(GENIE_OBJ_ILED_DIGITS_L, index, frame.wordValue[0]);
+  pfd.fd     = genieFd ;
+  pfd.events = POLLIN ;
+
+  if ((n = poll (&pfd, 1, timeout)) <= 0)
+    return (n == 0 || errno == EINTR) ? 0 : -1 ;
+
+  if ((n = read (genieFd, buf, len)) < 0)
+    return (errno == EINTR || errno == EAGAIN) ? 0 : -1 ;
+
+  return n ;
 }
 
-int genieWriteLongToIntLedDigits (int index, int32_t data) {
-    union FloatLongFrame frame;
-    frame.longValue = data;
-    int retval;
-    retval = genieWriteObj(GENIE_OBJ_ILED_DIGITS_H, index, frame.wordValue[1]);
-    if (retval != 1) return retval;
-    return genieWriteObj(GENIE_OBJ_ILED_DIGITS_L, index, frame.wordValue[0]);
+static void geniePollStop (void)
+{
 }
 
+static struct genieTransport geniePollTransport =
+{
+  "poll", geniePollStart, geniePollSend, geniePollReceive, geniePollStop
+} ;
+
+
+#ifdef	GENIE_URING
 /*
- * genieWriteContrast:
+ * genieUring*:
+ *	io_uring transport. A multishot read with a ring of provided
+ *	buffers stays armed on genieFd for the life of the link, so the
+ *	listener only has to reap completions. Writes are copied into a
+ *	small pool of slots and queued; with SQPOLL the kernel thread picks
+ *	them up without a syscall from us.
+ *
+ *	Only the listener reaps the completion queue (write completions
+ *	just free their slot), the submission queue is shared and has its
+ *	own lock. Writes can't overtake each other as every frame has been
+ *	ACKed (and so fully written) before the next one goes out.
+ *********************************************************************************
+ */
+
+#define	GENIE_URING_DEPTH	32
+#define	GENIE_URING_RX_BUFS	16
+#define	GENIE_URING_TX_SLOTS	8
+#define	GENIE_URING_BGID	0
+#define	GENIE_URING_READ	0xFFFF
+
+static struct io_uring           genieRing ;
+static struct io_uring_buf_ring *genieBufRing = NULL ;
+static unsigned char             genieUringRx [GENIE_URING_RX_BUFS][GENIE_RX_BUF_SIZE] ;
+static unsigned char             genieUringTx [GENIE_URING_TX_SLOTS][GENIE_MAX_FRAME] ;
+static volatile int              genieUringTxBusy [GENIE_URING_TX_SLOTS] ;
+static pthread_mutex_t           genieUringMutex = PTHREAD_MUTEX_INITIALIZER ;
+
+// A buffer the last receive couldn't take all of: it stays out of the
+//	ring until the rest has been handed over.
+
+static int genieUringPartBid = -1 ;
+static int genieUringPartOff ;
+static int genieUringPartLen ;
+
+static void genieUringArmRead (void)
+{
+  struct io_uring_sqe *sqe ;
+
+  pthread_mutex_lock (&genieUringMutex) ;
+    if ((sqe = io_uring_get_sqe (&genieRing)) != NULL)
+    {
+      io_uring_prep_read_multishot (sqe, genieFd, 0, 0, GENIE_URING_BGID) ;
+      io_uring_sqe_set_data64 (sqe, GENIE_URING_READ) ;
+      io_uring_submit (&genieRing) ;
+    }
+  pthread_mutex_unlock (&genieUringMutex) ;
+}
+
+static int genieUringStart (int fd)
+{
+  struct io_uring_params params ;
+  struct io_uring_cqe *cqe ;
+  struct __kernel_timespec ts ;
+  int i, ret ;
+
+  memset (&params, 0, sizeof (params)) ;
+  params.flags          = IORING_SETUP_SQPOLL ;
+  params.sq_thread_idle = 1000 ;
+
+  if (io_uring_queue_init_params (GENIE_URING_DEPTH, &genieRing, &params) < 0)
+  {
+    memset (&params, 0, sizeof (params)) ;
+    if (io_uring_queue_init_params (GENIE_URING_DEPTH, &genieRing, &params) < 0)
+      return -1 ;
+  }
+
+  if ((genieBufRing = io_uring_setup_buf_ring (&genieRing, GENIE_URING_RX_BUFS, GENIE_URING_BGID, 0, &ret)) == NULL)
+  {
+    io_uring_queue_exit (&genieRing) ;
+    return -1 ;
+  }
+
+  for (i = 0 ; i < GENIE_URING_RX_BUFS ; ++i)
+    io_uring_buf_ring_add (genieBufRing, genieUringRx [i], GENIE_RX_BUF_SIZE, i,
+	io_uring_buf_ring_mask (GENIE_URING_RX_BUFS), i) ;
+  io_uring_buf_ring_advance (genieBufRing, GENIE_URING_RX_BUFS) ;
+
+  genieUringArmRead () ;
+
+// Not every kernel/driver will do a multishot read on a tty: if it's
+//	refused straight away, give up and let the caller fall back.
+
+  ts.tv_sec  = 0 ;
+  ts.tv_nsec = 1000000 ;
+  if (io_uring_wait_cqe_timeout (&genieRing, &cqe, &ts) == 0)
+  {
+    if ((io_uring_cqe_get_data64 (cqe) == GENIE_URING_READ) && (cqe->res < 0) && (cqe->res != -ENOBUFS))
+    {
+      io_uring_free_buf_ring (&genieRing, genieBufRing, GENIE_URING_RX_BUFS, GENIE_URING_BGID) ;
+      io_uring_queue_exit (&genieRing) ;
+      genieBufRing = NULL ;
+      return -1 ;
+    }
+  }
+
+  return 0 ;
+}
+
+static int genieUringSend (const unsigned char *buf, int len)
+{
+  struct io_uring_sqe *sqe ;
+  int slot ;
+
+  if (len > GENIE_MAX_FRAME)
+    return -1 ;
+
+  for (;;)
+  {
+    for (slot = 0 ; slot < GENIE_URING_TX_SLOTS ; ++slot)
+      if (__sync_bool_compare_and_swap (&genieUringTxBusy [slot], 0, 1))
+	break ;
+    if (slot < GENIE_URING_TX_SLOTS)
+      break ;
+    delayMicroseconds (50) ;
+  }
+
+  memcpy (genieUringTx [slot], buf, len) ;
+
+  pthread_mutex_lock (&genieUringMutex) ;
+    if ((sqe = io_uring_get_sqe (&genieRing)) == NULL)
+    {
+      io_uring_submit (&genieRing) ;
+      sqe = io_uring_get_sqe (&genieRing) ;
+    }
+    if (sqe != NULL)
+    {
+      io_uring_prep_write (sqe, genieFd, genieUringTx [slot], len, -1) ;
+      io_uring_sqe_set_data64 (sqe, (((uint64_t)len) << 16) | slot) ;
+      io_uring_submit (&genieRing) ;
+    }
+  pthread_mutex_unlock (&genieUringMutex) ;
+
+  if (sqe == NULL)
+  {
+    genieUringTxBusy [slot] = 0 ;
+    return -1 ;
+  }
+
+  return len ;
+}
+
+static void genieUringRecycle (unsigned int bid)
+{
+  io_uring_buf_ring_add (genieBufRing, genieUringRx [bid], GENIE_RX_BUF_SIZE, bid,
+      io_uring_buf_ring_mask (GENIE_URING_RX_BUFS), 0) ;
+  io_uring_buf_ring_advance (genieBufRing, 1) ;
+}
+
+static int genieUringReceive (unsigned char *buf, int len, int timeout)
+{
+  struct io_uring_cqe *cqe ;
+  struct __kernel_timespec ts ;
+  uint64_t tag ;
+  unsigned int bid ;
+  int got = 0, slot, n, rearm ;
+
+// Whatever was left over last time goes first
+
+  if (genieUringPartBid >= 0)
+  {
+    n = genieUringPartLen - genieUringPartOff ;
+    if (n > len)
+      n = len ;
+    memcpy (buf, genieUringRx [genieUringPartBid] + genieUringPartOff, n) ;
+    got                = n ;
+    genieUringPartOff += n ;
+    if (genieUringPartOff < genieUringPartLen)
+      return got ;
+    genieUringRecycle (genieUringPartBid) ;
+    genieUringPartBid = -1 ;
+    if (io_uring_peek_cqe (&genieRing, &cqe) != 0)
+      return got ;
+  }
+  else
+  {
+    ts.tv_sec  = timeout / 1000 ;
+    ts.tv_nsec = (timeout % 1000) * 1000000LL ;
+
+    if (io_uring_peek_cqe (&genieRing, &cqe) != 0)
+      if (io_uring_wait_cqe_timeout (&genieRing, &cqe, &ts) != 0)
+	return 0 ;
+  }
+
+  do
+  {
+    tag   = io_uring_cqe_get_data64 (cqe) ;
+    rearm = FALSE ;
+
+    if (tag == GENIE_URING_READ)
+    {
+      if ((cqe->res > 0) && (cqe->flags & IORING_CQE_F_BUFFER))
+      {
+	bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT ;
+	n   = cqe->res < (len - got) ? cqe->res : (len - got) ;
+	memcpy (buf + got, genieUringRx [bid], n) ;
+	got += n ;
+	if (n < cqe->res)			// Keep the rest for next time
+	{
+	  genieUringPartBid = bid ;
+	  genieUringPartOff = n ;
+	  genieUringPartLen = cqe->res ;
+	}
+	else
+	  genieUringRecycle (bid) ;
+      }
+      if (!(cqe->flags & IORING_CQE_F_MORE))
+	rearm = TRUE ;
+    }
+    else
+    {
+      slot = (int)(tag & 0xFFFF) ;
+      n    = (int)(tag >> 16) ;
+      if ((cqe->res > 0) && (cqe->res < n))		// Short write, send the rest
+	geniePollSend (genieUringTx [slot] + cqe->res, n - cqe->res) ;
+      genieUringTxBusy [slot] = 0 ;
+    }
+
+    io_uring_cqe_seen (&genieRing, cqe) ;
+
+    if (rearm)
+      genieUringArmRead () ;
+
+  } while ((got < len) && (genieUringPartBid < 0) && (io_uring_peek_cqe (&genieRing, &cqe) == 0)) ;
+
+  return got ;
+}
+
+static void genieUringStop (void)
+{
+  genieUringPartBid = -1 ;
+  if (genieBufRing != NULL)
+    io_uring_free_buf_ring (&genieRing, genieBufRing, GENIE_URING_RX_BUFS, GENIE_URING_BGID) ;
+  io_uring_queue_exit (&genieRing) ;
+  genieBufRing = NULL ;
+}
+
+static struct genieTransport genieUringTransport =
+{
+  "io_uring", genieUringStart, genieUringSend, genieUringReceive, genieUringStop
+} ;
+#endif
+
+static struct genieTransport *genieTransport = &geniePollTransport ;
+
+
+/*
+ * Capture:
+ *	Optionally log everything sent and received, with the time, to a
+ *	ring in a memory-mapped file so it survives us crashing. Taking a
+ *	record is a clock read and a memcpy under an uncontended mutex.
+ *********************************************************************************
+ */
+
+#define	GENIE_CAPTURE_DEFAULT	(4 * 1024 * 1024)
+
+static struct genieCaptureHeader *volatile genieCap = NULL ;
+static unsigned char  *genieCapRing ;
+static size_t          genieCapMapped ;
+static int             genieCapFd = -1 ;
+static pthread_mutex_t genieCapMutex = PTHREAD_MUTEX_INITIALIZER ;
+
+static void genieCapCopyIn (unsigned long long pos, const void *src, unsigned int len)
+{
+  unsigned int off = pos % genieCap->size ;
+  unsigned int first = genieCap->size - off ;
+
+  if (first >= len)
+    memcpy (genieCapRing + off, src, len) ;
+  else
+  {
+    memcpy (genieCapRing + off, src, first) ;
+    memcpy (genieCapRing, (const unsigned char *)src + first, len - first) ;
+  }
+}
+
+static void genieCapCopyOut (const struct genieCaptureHeader *cap, const unsigned char *ring,
+				void *dst, unsigned long long pos, unsigned int len)
+{
+  unsigned int off = pos % cap->size ;
+  unsigned int first = cap->size - off ;
+
+  if (first >= len)
+    memcpy (dst, ring + off, len) ;
+  else
+  {
+    memcpy (dst, ring + off, first) ;
+    memcpy ((unsigned char *)dst + first, ring, len - first) ;
+  }
+}
+
+static void genieCaptureRecord (int dir, const unsigned char *buf, int len, unsigned long long stamp)
+{
+  struct genieCaptureRecord rec ;
+  unsigned long long need = sizeof (rec) + len ;
+
+  pthread_mutex_lock (&genieCapMutex) ;
+
+  if ((genieCap != NULL) && (need <= genieCap->size))
+  {
+
+// Make room by dropping the oldest records
+
+    while (genieCap->head + need - genieCap->tail > genieCap->size)
+    {
+      genieCapCopyOut (genieCap, genieCapRing, &rec, genieCap->tail, sizeof (rec)) ;
+      genieCap->tail += sizeof (rec) + rec.len ;
+    }
+
+    memset (&rec, 0, sizeof (rec)) ;
+    rec.stamp = stamp ;
+    rec.len   = len ;
+    rec.dir   = dir ;
+
+    genieCapCopyIn (genieCap->head, &rec, sizeof (rec)) ;
+    genieCapCopyIn (genieCap->head + sizeof (rec), buf, len) ;
+    genieCap->head += need ;
+    ++genieCap->records ;
+  }
+
+  pthread_mutex_unlock (&genieCapMutex) ;
+}
+
+
+/*
+ * Event log:
+ *	Optionally publish every frame, with the time, into a ring in
+ *	shared memory (a file in /dev/shm, say) for other processes to
+ *	watch. Nothing waits on anything: writers claim a record each by
+ *	moving the head on, and readers that fall behind just lose what's
+ *	been written over.
+ *********************************************************************************
+ */
+
+#define	GENIE_EVLOG_DEFAULT	4096
+
+static struct genieEventLogHeader *volatile genieEvLog = NULL ;
+static size_t        genieEvLogMapped ;
+static volatile int  genieEvLogUsers = 0 ;		// Writing to it just now
+static pthread_mutex_t genieEvLogMutex = PTHREAD_MUTEX_INITIALIZER ;
+
+static void genieEventLogFrame (int dir, const unsigned char *buf, int len, unsigned long long stamp)
+{
+  struct genieEventLogHeader *log ;
+  struct genieEventLogRecord *rec ;
+  unsigned long long pos ;
+
+  __sync_fetch_and_add (&genieEvLogUsers, 1) ;
+
+  if ((log = genieEvLog) != NULL)
+  {
+    pos = __sync_fetch_and_add (&log->head, 1) ;
+    rec = (struct genieEventLogRecord *)(log + 1) + (pos & (log->records - 1)) ;
+
+    rec->seq = 2 * pos + 1 ;
+    __sync_synchronize () ;
+
+    rec->stamp = stamp ;
+    rec->len   = len ;
+    rec->dir   = dir ;
+    memcpy (rec->data, buf, (len < GENIE_EVLOG_DATA) ? len : GENIE_EVLOG_DATA) ;
+
+    __sync_synchronize () ;
+    rec->seq = 2 * pos + 2 ;
+  }
+
+  __sync_fetch_and_sub (&genieEvLogUsers, 1) ;
+}
+
+
+/*
+ * genieTxFrameLength:
+ *	How long the frame we're sending at buf is, so the log gets one
+ *	record per frame. Anything we don't know takes the rest.
+ *********************************************************************************
+ */
+static int genieTxFrameLength (const unsigned char *buf, int have)
+{
+  int len ;
+
+  switch (buf [0])
+  {
+    case GENIE_READ_OBJ:	len = 4 ; break ;
+    case GENIE_WRITE_OBJ:	len = 6 ; break ;
+    case GENIE_WRITE_CONTRAST:	len = 3 ; break ;
+    case GENIED_SUBSCRIBE:	len = 5 ; break ;
+    case GENIED_UNSUBSCRIBE:	len = 5 ; break ;
+
+    case GENIE_WRITE_STR:
+    case GENIE_WRITE_INH_LABEL:
+    case GENIE_MAGIC_BYTES:
+      len = (have < 3) ? have : 4 + buf [2] ;
+      break ;
+
+    case GENIE_WRITE_STRU:
+    case GENIE_DOUBLE_BYTES:
+      len = (have < 3) ? have : 4 + 2 * buf [2] ;
+      break ;
+
+    default:
+      len = have ;
+  }
+
+  return (len > have) ? have : len ;
+}
+
+
+/*
+ * genieEventLogStop:
+ *	Stop publishing, and let go of the log once no-one's writing to
+ *	it. It stays there for readers to finish with.
+ *********************************************************************************
+ */
+void genieEventLogStop (void)
+{
+  struct genieEventLogHeader *log ;
+
+  pthread_mutex_lock (&genieEvLogMutex) ;
+
+  if ((log = genieEvLog) != NULL)
+  {
+    genieEvLog = NULL ;
+    __sync_synchronize () ;
+    while (__sync_fetch_and_add (&genieEvLogUsers, 0) != 0)	// They're quick
+      sched_yield () ;
+    munmap (log, genieEvLogMapped) ;
+  }
+
+  pthread_mutex_unlock (&genieEvLogMutex) ;
+}
+
+
+/*
+ * genieEventLogStart:
+ *	Start publishing frames into a ring of records (rounded up to a
+ *	power of 2, 0 for the default of 4096) in the file at path.
+ *********************************************************************************
+ */
+int genieEventLogStart (const char *path, unsigned int records)
+{
+  struct genieEventLogHeader *log ;
+  unsigned int n ;
+  size_t mapped ;
+  int fd ;
+
+  if (records == 0)
+    records = GENIE_EVLOG_DEFAULT ;
+  if ((records < 64) || (records > (1 << 24)))
+    { errno = EINVAL ; return -1 ; }
+
+  for (n = 64 ; n < records ; n <<= 1)
+    ;
+
+  mapped = sizeof (struct genieEventLogHeader) + n * sizeof (struct genieEventLogRecord) ;
+
+  if ((fd = open (path, O_RDWR | O_CREAT | O_TRUNC, 0644)) == -1)
+    return -1 ;
+
+  if ((ftruncate (fd, mapped) == -1) ||
+      ((log = mmap (NULL, mapped, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED))
+  {
+    close (fd) ;
+    return -1 ;
+  }
+  close (fd) ;
+
+  log->records    = n ;
+  log->recordSize = sizeof (struct genieEventLogRecord) ;
+  log->head       = 0 ;
+  log->version    = GENIE_EVLOG_VERSION ;
+  __sync_synchronize () ;
+  log->magic      = GENIE_EVLOG_MAGIC ;		// Last, so readers see it all
+
+  genieEventLogStop () ;
+
+  pthread_mutex_lock (&genieEvLogMutex) ;
+    genieEvLogMapped = mapped ;
+    genieEvLog       = log ;
+  pthread_mutex_unlock (&genieEvLogMutex) ;
+
+  return 0 ;
+}
+
+
+/*
+ * genieSend:
+ *	Hand bytes to the transport, logging them first if capturing or
+ *	publishing to the event log.
+ *********************************************************************************
+ */
+static int genieSend (const unsigned char *buf, int len)
+{
+  unsigned long long stamp ;
+  int at, n ;
+
+  if (genieCap != NULL)
+    genieCaptureRecord (GENIE_CAPTURE_TX, buf, len, genieNanos ()) ;
+
+  if (genieEvLog != NULL)
+    for (at = 0, stamp = genieNanos () ; at < len ; at += n)
+    {
+      n = genieTxFrameLength (buf + at, len - at) ;
+      genieEventLogFrame (GENIE_CAPTURE_TX, buf + at, n, stamp) ;
+    }
+
+  genieLinkSent = genieNanos () ;
+  GENIE_TRACE_STAMP (genieTxStamp) ;
+  GENIE_PROBE4 (frame_send, buf [0], len > 1 ? buf [1] : 0, len > 2 ? buf [2] : 0, len) ;
+
+  return genieTransport->send (buf, len) ;
+}
+
+
+/*
+ * genieCaptureStop:
+ *	Stop logging and close the capture file.
+ *********************************************************************************
+ */
+void genieCaptureStop (void)
+{
+  pthread_mutex_lock (&genieCapMutex) ;
+
+  if (genieCap != NULL)
+  {
+    msync (genieCap, genieCapMapped, MS_SYNC) ;
+    munmap (genieCap, genieCapMapped) ;
+    close (genieCapFd) ;
+    genieCap   = NULL ;
+    genieCapFd = -1 ;
+  }
+
+  pthread_mutex_unlock (&genieCapMutex) ;
+}
+
+
+/*
+ * genieCaptureStart:
+ *	Start logging traffic to the display into a ring of size bytes
+ *	(0 for the default of 4MB) in the file at path.
+ *********************************************************************************
+ */
+int genieCaptureStart (const char *path, unsigned long size)
+{
+  struct genieCaptureHeader *cap ;
+  size_t mapped ;
+  int fd ;
+
+  if (size == 0)
+    size = GENIE_CAPTURE_DEFAULT ;
+  if (size < 1024)
+    { errno = EINVAL ; return -1 ; }
+
+  mapped = sizeof (struct genieCaptureHeader) + size ;
+
+  if ((fd = open (path, O_RDWR | O_CREAT | O_TRUNC, 0644)) == -1)
+    return -1 ;
+
+  if ((ftruncate (fd, mapped) == -1) ||
+      ((cap = mmap (NULL, mapped, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED))
+  {
+    close (fd) ;
+    return -1 ;
+  }
+
+  cap->magic   = GENIE_CAPTURE_MAGIC ;
+  cap->version = GENIE_CAPTURE_VERSION ;
+  cap->size    = size ;
+  cap->head    = 0 ;
+  cap->tail    = 0 ;
+  cap->records = 0 ;
+
+  genieCaptureStop () ;
+
+  pthread_mutex_lock (&genieCapMutex) ;
+    genieCapRing   = (unsigned char *)(cap + 1) ;
+    genieCapMapped = mapped ;
+    genieCapFd     = fd ;
+    genieCap       = cap ;
+  pthread_mutex_unlock (&genieCapMutex) ;
+
+  return 0 ;
+}
+
+
+/*
+ * genie(Replay)*:
+ *	A transport that plays back what was received in a capture file,
+ *	at the speed it arrived (or speed times faster; 0 for as fast as
+ *	possible). What we send is thrown away. The listener, the ACK
+ *	waits and the timeouts all run exactly as they would on the wire.
+ *********************************************************************************
+ */
+static const struct genieCaptureHeader *genieReplayCap = NULL ;
+static const unsigned char *genieReplayRing ;
+static size_t genieReplayMapped ;
+static unsigned long long genieReplayPos ;	// Next record
+static unsigned int       genieReplayOff ;	// Bytes of it already given out
+static unsigned long long genieReplayFirst ;	// Stamp of the first record
+static unsigned long long genieReplayEpoch ;	// ... and when we played it
+static double             genieReplaySpeed ;
+static volatile int       genieReplayEnd = FALSE ;
+
+static int genieReplayStart (int fd)
+{
+  struct genieCaptureRecord rec ;
+
+  genieReplayPos = genieReplayCap->tail ;
+  genieReplayOff = 0 ;
+  genieReplayEnd = FALSE ;
+
+  if (genieReplayPos < genieReplayCap->head)
+  {
+    genieCapCopyOut (genieReplayCap, genieReplayRing, &rec, genieReplayPos, sizeof (rec)) ;
+    genieReplayFirst = rec.stamp ;
+  }
+  genieReplayEpoch = genieNanos () ;
+
+  return 0 ;
+}
+
+static int genieReplaySend (const unsigned char *buf, int len)
+{
+  return len ;
+}
+
+static int genieReplayReceive (unsigned char *buf, int len, int timeout)
+{
+  struct genieCaptureRecord rec ;
+  unsigned long long due, now ;
+
+  for (;;)
+  {
+    if (genieReplayPos >= genieReplayCap->head)
+    {
+      genieReplayEnd = TRUE ;
+      delay (timeout) ;
+      return 0 ;
+    }
+
+    genieCapCopyOut (genieReplayCap, genieReplayRing, &rec, genieReplayPos, sizeof (rec)) ;
+    if ((rec.dir == GENIE_CAPTURE_RX) && (rec.len > genieReplayOff))
+      break ;
+
+    genieReplayPos += sizeof (rec) + rec.len ;
+    genieReplayOff  = 0 ;
+  }
+
+// Wait until it's due, or for timeout mS if it's not due by then
+
+  if (genieReplaySpeed > 0.0)
+  {
+    due = genieReplayEpoch + (unsigned long long)((rec.stamp - genieReplayFirst) / genieReplaySpeed) ;
+    now = genieNanos () ;
+    if (due > now + (unsigned long long)timeout * 1000000)
+    {
+      delay (timeout) ;
+      return 0 ;
+    }
+    if (due > now)
+      delayMicroseconds ((due - now) / 1000) ;
+  }
+
+  if (len > rec.len - genieReplayOff)
+    len = rec.len - genieReplayOff ;
+
+  genieCapCopyOut (genieReplayCap, genieReplayRing, buf, genieReplayPos + sizeof (rec) + genieReplayOff, len) ;
+
+  if ((genieReplayOff += len) == rec.len)
+  {
+    genieReplayPos += sizeof (rec) + rec.len ;
+    genieReplayOff  = 0 ;
+  }
+
+  return len ;
+}
+
+static void genieReplayStop (void)
+{
+  if (genieReplayCap != NULL)
+    munmap ((void *)genieReplayCap, genieReplayMapped) ;
+  genieReplayCap = NULL ;
+}
+
+static struct genieTransport genieReplayTransport =
+{
+  "replay", genieReplayStart, genieReplaySend, genieReplayReceive, genieReplayStop
+} ;
+
+
+/*
+ * genieReplayDone:
+ *	Return TRUE once everything in the capture has been played back.
+ *********************************************************************************
+ */
+int genieReplayDone (void)
+{
+  return genieReplayEnd ;
+}
+
+
+/*
+ * genieGetchar:
+ *	Return a single character from the device, or -1 if nothing
+ *	avalable in 5mS.
+ *********************************************************************************
+ */
+static int genieGetcharWait (unsigned int timeout)
+{
+  unsigned int timeUp ;
+  int n ;
+
+  if (genieRxHead < genieRxLen)
+    return genieRxBuf [genieRxHead++] ;
+
+  for (timeUp = millis () + timeout ; millis () < timeUp ;)
+  {
+    if ((n = genieTransport->receive (genieRxBuf, GENIE_RX_BUF_SIZE, timeout)) < 0)
+      return -1 ;
+    if (n > 0)
+    {
+      genieRxStamp = genieNanos () ;
+      if (genieCap != NULL)
+	genieCaptureRecord (GENIE_CAPTURE_RX, genieRxBuf, n, genieRxStamp) ;
+      genieRxHead = 1 ;
+      genieRxLen  = n ;
+      return genieRxBuf [0] ;
+    }
+  }
+
+  return -1 ;
+}
+
+static int genieGetchar (void)
+{
+  return genieGetcharWait (genieLinkByteWait ()) ;
+}
+
+
+/*
+ * geniePutchar:
+ *	Send a single character (byte) to the Genie display
+ *********************************************************************************
+ */
+static void geniePutchar (int data)
+{  
+  unsigned char c = (unsigned char)data ;
+  genieSend (&c, 1) ;
+}
+
+
+/*
+ * genieSendFrame:
+ *	Add the checksum to the end of the frame in buf (there must be
+ *	room for it) and send the lot to the display in one go.
+ *********************************************************************************
+ */
+static int genieSendFrame (unsigned char *buf, int len)
+{
+  unsigned int checksum = 0 ;
+  int i ;
+
+  for (i = 0 ; i < len ; ++i)
+    checksum ^= buf [i] ;
+  buf [len] = (unsigned char)checksum ;
+
+  return genieSend (buf, len + 1) ;
+}
+
+
+/*
+ * genieSendFrameSum:
+ *	As genieSendFrame, for when the checksum of the payload (from
+ *	buf [3] on) is already known: only the header is added in.
+ *********************************************************************************
+ */
+static int genieSendFrameSum (unsigned char *buf, int len, unsigned int payloadSum)
+{
+  buf [len] = (unsigned char)(buf [0] ^ buf [1] ^ buf [2] ^ payloadSum) ;
+
+  return genieSend (buf, len + 1) ;
+}
+
+
+/*
+ * genieLock:
+ *	Take the link for one transaction. Frames (and the wait for
+ *	their ACK) are never interleaved, but when the link is busy it's
+ *	handed on by priority class rather than in whatever order the
+ *	mutex happens to wake people: interactive, then normal, then bulk.
+ *	Each class is worth GENIE_SCHED_AGING_US of waiting, so bulk
+ *	traffic that has waited long enough still gets its turn.
+ *********************************************************************************
+ */
+
+#define	GENIE_SCHED_AGING_US	20000
+
+struct genieWaiter
+{
+  int pri ;
+  int granted ;
+  unsigned long long since ;
+  struct genieWaiter *next ;
+} ;
+
+static pthread_mutex_t genieSchedMutex = PTHREAD_MUTEX_INITIALIZER ;
+static pthread_cond_t  genieSchedCond  = PTHREAD_COND_INITIALIZER ;
+static struct genieWaiter *genieWaiters [GENIE_PRI_CLASSES] ;
+static struct genieSchedStats genieSchedStats [GENIE_PRI_CLASSES] ;
+static int genieLinkBusy = FALSE ;
+
+static __thread int geniePriority = GENIE_PRI_NORMAL ;
+
+static void genieSchedGranted (int pri, unsigned long long waited)
+{
+  struct genieSchedStats *st = &genieSchedStats [pri] ;
+
+  GENIE_TRACE_STAMP (genieLinkStamp) ;
+  GENIE_PROBE2 (lock_acquire, pri, waited) ;
+
+  ++st->transactions ;
+  st->waitTotalUs += waited ;
+  if (waited > st->waitMaxUs)
+    st->waitMaxUs = waited ;
+}
+
+static void genieLock (void)
+{
+  struct genieWaiter me, **p ;
+  int pri = geniePriority ;
+
+  pthread_mutex_lock (&genieSchedMutex) ;
+
+  if (!genieLinkBusy)
+  {
+    genieLinkBusy = TRUE ;
+    genieSchedGranted (pri, 0) ;
+    pthread_mutex_unlock (&genieSchedMutex) ;
+    return ;
+  }
+
+  me.pri     = pri ;
+  me.granted = FALSE ;
+  me.since   = genieMicros () ;
+  me.next    = NULL ;
+  for (p = &genieWaiters [pri] ; *p != NULL ; p = &(*p)->next)
+    ;
+  *p = &me ;
+
+  if (++genieSchedStats [pri].depth > genieSchedStats [pri].maxDepth)
+    genieSchedStats [pri].maxDepth = genieSchedStats [pri].depth ;
+  GENIE_PROBE2 (lock_contended, pri, genieSchedStats [pri].depth) ;
+
+  while (!me.granted)
+    pthread_cond_wait (&genieSchedCond, &genieSchedMutex) ;
+
+  pthread_mutex_unlock (&genieSchedMutex) ;
+}
+
+static void genieUnlock (void)
+{
+  struct genieWaiter *next = NULL ;
+  unsigned long long now ;
+  long long score, best = 0 ;
+  int pri, nextPri = 0 ;
+
+  pthread_mutex_lock (&genieSchedMutex) ;
+
+  GENIE_PROBE2 (lock_release, geniePriority, genieNanos () - genieLinkStamp) ;
+
+  now = genieMicros () ;
+  for (pri = 0 ; pri < GENIE_PRI_CLASSES ; ++pri)
+  {
+    if (genieWaiters [pri] == NULL)
+      continue ;
+    score = (long long)pri * GENIE_SCHED_AGING_US - (long long)(now - genieWaiters [pri]->since) ;
+    if ((next == NULL) || (score < best))
+    {
+      next    = genieWaiters [pri] ;
+      nextPri = pri ;
+      best    = score ;
+    }
+  }
+
+  if (next == NULL)
+    genieLinkBusy = FALSE ;
+  else
+  {
+    genieWaiters [nextPri] = next->next ;
+    --genieSchedStats [nextPri].depth ;
+    genieSchedGranted (nextPri, now - next->since) ;
+    next->granted = TRUE ;
+    pthread_cond_broadcast (&genieSchedCond) ;
+  }
+
+  pthread_mutex_unlock (&genieSchedMutex) ;
+}
+
+
+/*
+ * genieSetPriority:
+ *	Set the priority class used for the calling thread's traffic
+ *********************************************************************************
+ */
+int genieSetPriority (int pri)
+{
+  if ((pri < 0) || (pri >= GENIE_PRI_CLASSES))
+    return -1 ;
+
+  geniePriority = pri ;
+  return 0 ;
+}
+
+int genieGetPriority (void)
+{
+  return geniePriority ;
+}
+
+
+/*
+ * genieGetSchedStats:
+ *	Return the queue depth and waiting time figures for a class
+ *********************************************************************************
+ */
+int genieGetSchedStats (int pri, struct genieSchedStats *stats)
+{
+  if ((pri < 0) || (pri >= GENIE_PRI_CLASSES))
+    return -1 ;
+
+  pthread_mutex_lock (&genieSchedMutex) ;
+    *stats = genieSchedStats [pri] ;
+  pthread_mutex_unlock (&genieSchedMutex) ;
+
+  return 0 ;
+}
+
+
+/*
+ * genieClose:
+ *	Release the serial port and any other data we have.
+ *********************************************************************************
+ */
+void genieClose (void)
+{
+  genieTransport->stop () ;
+  close (genieFd) ;
+}
+
+
+/*
+ * genieLatencyProbe:
+ *	Note how long it took from an event being sent to it being in the
+ *	queue. We only see it once our read of its first byte returns,
+ *	which is after any delay in waking us up, so when the clock set by
+ *	genieSetLatencyClock can say when it was really sent, that's used.
+ *********************************************************************************
+ */
+static void genieLatencyProbe (const struct genieReplyExStruct *reply)
+{
+  unsigned long long from = reply->timestamp, sent, us ;
+  int bucket = 0 ;
+
+  if ((genieLatencyRef != NULL) && ((sent = genieLatencyRef (reply)) != 0))
+    from = sent ;
+  us = (genieNanos () - from) / 1000 ;
+
+  while ((bucket < GENIE_LATENCY_BUCKETS - 1) && (us >= (2ULL << bucket)))
+    ++bucket ;
+
+  pthread_mutex_lock (&genieLatencyMutex) ;
+    if ((genieLatency.count == 0) || (us < genieLatency.minUs))
+      genieLatency.minUs = us ;
+    if (us > genieLatency.maxUs)
+      genieLatency.maxUs = us ;
+    genieLatency.totalUs += us ;
+    ++genieLatency.buckets [bucket] ;
+    ++genieLatency.count ;
+  pthread_mutex_unlock (&genieLatencyMutex) ;
+}
+
+
+/*
+ * genieSetLatencyClock:
+ *	Give the latency probe a way to find out when an event was sent
+ *	(CLOCK_MONOTONIC, nS), from outside the listener - a test rig that
+ *	stamps what it sends, say. It's called on the listener thread as
+ *	each event is queued, and returns 0 if it doesn't know.
+ *********************************************************************************
+ */
+void genieSetLatencyClock (genieLatencyClock clock)
+{
+  pthread_mutex_lock (&genieReplyMutex) ;
+    genieLatencyRef = clock ;
+  pthread_mutex_unlock (&genieReplyMutex) ;
+}
+
+
+/*
+ * genieGetLatencyStats:
+ *	Return (and optionally reset) the arrival to queue latency figures
+ *********************************************************************************
+ */
+void genieGetLatencyStats (struct genieLatencyStats *stats, int reset)
+{
+  pthread_mutex_lock (&genieLatencyMutex) ;
+    *stats = genieLatency ;
+    if (reset)
+      memset (&genieLatency, 0, sizeof (genieLatency)) ;
+  pthread_mutex_unlock (&genieLatencyMutex) ;
+}
+
+
+/*
+ * Mirror:
+ *	What we believe every object on the display is showing, from our
+ *	own (ACKed) writes and from the reports and events the display
+ *	sends us, with when we learned it. A table of 256 indexes for
+ *	each object type is allocated the first time it's needed.
+ *
+ *	Entries are seqlocked: updaters make the sequence odd while they
+ *	change an entry, readers on any thread just retry if it was odd or
+ *	moved under them, and never block.
+ *********************************************************************************
+ */
+
+struct genieMirrorEntry
+{
+  volatile unsigned int seq ;
+  unsigned int          value ;
+  unsigned long long    stamp ;		// 0 if we've never known it
+} ;
+
+static struct genieMirrorEntry *volatile genieMirror [256] ;
+
+static struct genieMirrorEntry *genieMirrorTable (int object, int create)
+{
+  struct genieMirrorEntry *table ;
+
+  if (((table = genieMirror [object & 0xFF]) != NULL) || !create)
+    return table ;
+
+  if ((table = calloc (256, sizeof (struct genieMirrorEntry))) == NULL)
+    return NULL ;
+
+  if (!__sync_bool_compare_and_swap (&genieMirror [object & 0xFF], NULL, table))
+  {
+    free (table) ;			// Someone else got there first
+    table = genieMirror [object & 0xFF] ;
+  }
+
+  return table ;
+}
+
+static void genieMirrorUpdate (int object, int index, unsigned int value, unsigned long long stamp)
+{
+  struct genieMirrorEntry *e ;
+  unsigned int seq ;
+
+  if ((e = genieMirrorTable (object, TRUE)) == NULL)
+    return ;
+  e += index & 0xFF ;
+
+  for (;;)
+  {
+    seq = e->seq ;
+    if (!(seq & 1) && __sync_bool_compare_and_swap (&e->seq, seq, seq + 1))
+      break ;
+  }
+
+  e->value = value ;
+  e->stamp = stamp ;
+  __sync_synchronize () ;
+  e->seq = seq + 2 ;
+}
+
+static int genieMirrorGet (int object, int index, unsigned int *value, unsigned long long *stamp)
+{
+  struct genieMirrorEntry *e ;
+  unsigned int seq ;
+
+  if ((e = genieMirrorTable (object, FALSE)) == NULL)
+    return FALSE ;
+  e += index & 0xFF ;
+
+  do
+  {
+    while ((seq = e->seq) & 1)
+      ;
+    __sync_synchronize () ;
+    *value = e->value ;
+    *stamp = e->stamp ;
+    __sync_synchronize () ;
+  } while (e->seq != seq) ;
+
+  return *stamp != 0 ;
+}
+
+
+/*
+ * Form filtering:
+ *	Objects registered with genieFormAdd belong to a form. A write to
+ *	one whose form isn't showing is held (the latest value for each)
+ *	rather than sent, and everything held for a form goes out as soon
+ *	as it's shown, in the same hold of the link as the write that
+ *	showed it, or by the async thread when the display or genieFormAdd
+ *	did. A write that does go out while its form's showing replaces
+ *	anything held. Until we've seen which form is showing, nothing's
+ *	held.
+ *********************************************************************************
+ */
+
+struct genieFormMember
+{
+  unsigned char  object ;
+  unsigned char  index ;
+  unsigned char  form ;
+  unsigned char  held ;
+  unsigned int   data ;
+} ;
+
+static struct genieFormMember *genieFormMembers = NULL ;
+static int genieFormMemberCount = 0 ;
+static int genieFormMemberMax   = 0 ;
+static unsigned short *genieFormSlot [256] ;		// Per object, member + 1
+static volatile int genieActiveForm = -1 ;
+static volatile int genieFormDue    = FALSE ;		// Held values to send
+static pthread_mutex_t genieFormMutex = PTHREAD_MUTEX_INITIALIZER ;
+
+
+/*
+ * genieFormHold:
+ *	Hold a write if it's to an object on a form that isn't showing.
+ *	If it is showing the write's about to go out, so anything held
+ *	for the object is stale.
+ *********************************************************************************
+ */
+static int genieFormHold (int object, int index, unsigned int data)
+{
+  struct genieFormMember *m ;
+  int held = FALSE ;
+
+  if ((genieActiveForm < 0) || (genieFormSlot [object & 0xFF] == NULL))
+    return FALSE ;
+
+  pthread_mutex_lock (&genieFormMutex) ;
+    if ((genieFormSlot [object & 0xFF] != NULL) && (genieFormSlot [object & 0xFF][index & 0xFF] != 0))
+    {
+      m = &genieFormMembers [genieFormSlot [object & 0xFF][index & 0xFF] - 1] ;
+      if ((genieActiveForm >= 0) && (m->form != genieActiveForm))
+      {
+	m->data = data ;
+	m->held = TRUE ;
+	held    = TRUE ;
+      }
+      else
+	m->held = FALSE ;
+    }
+  pthread_mutex_unlock (&genieFormMutex) ;
+
+  return held ;
+}
+
+
+/*
+ * genieFormHoldDigits:
+ *	genieFormHold for both halves of a 32-bit internal LED digits
+ *	value at once, so they're held, or not, together. genieFormAdd
+ *	always puts the halves on the same form.
+ *********************************************************************************
+ */
+static int genieFormHoldDigits (int index, uint32_t value)
+{
+  struct genieFormMember *h, *l ;
+  int held = FALSE ;
+
+  if ((genieActiveForm < 0) || (genieFormSlot [GENIE_OBJ_ILED_DIGITS_H] == NULL))
+    return FALSE ;
+
+  pthread_mutex_lock (&genieFormMutex) ;
+    if ((genieFormSlot [GENIE_OBJ_ILED_DIGITS_L] != NULL) &&
+	(genieFormSlot [GENIE_OBJ_ILED_DIGITS_H][index] != 0) && (genieFormSlot [GENIE_OBJ_ILED_DIGITS_L][index] != 0))
+    {
+      h = &genieFormMembers [genieFormSlot [GENIE_OBJ_ILED_DIGITS_H][index] - 1] ;
+      l = &genieFormMembers [genieFormSlot [GENIE_OBJ_ILED_DIGITS_L][index] - 1] ;
+      held    = (genieActiveForm >= 0) && (h->form != genieActiveForm) ;
+      h->held = l->held = held ;
+      h->data = value >> 16 ;
+      l->data = value & 0xFFFF ;
+    }
+  pthread_mutex_unlock (&genieFormMutex) ;
+
+  return held ;
+}
+
+
+/*
+ * genieFormActivated:
+ *	A form's now showing, by our write or the user's doing. Nothing is
+ *	sent here, as this is called from the listener too: whoever has
+ *	the link sends what's held, through genieFormTake.
+ *********************************************************************************
+ */
+static void genieFormActivated (int form)
+{
+  int i ;
+
+  pthread_mutex_lock (&genieFormMutex) ;
+    genieActiveForm = form ;
+
+    for (i = 0 ; i < genieFormMemberCount ; ++i)
+      if (genieFormMembers [i].held && (genieFormMembers [i].form == form))
+      {
+	genieFormDue = TRUE ;
+	break ;
+      }
+  pthread_mutex_unlock (&genieFormMutex) ;
+}
+
+
+/*
+ * genieFormTake:
+ *	Up to max of the WRITE_OBJ frames (checksums included) held for
+ *	the form that's showing; they're no longer held once taken. Only
+ *	called with the link held, so they go out before anything newer.
+ *********************************************************************************
+ */
+static int genieFormTake (unsigned char *frames, int max)
+{
+  struct genieFormMember *m ;
+  unsigned char *f = frames ;
+  int i, n = 0 ;
+
+  pthread_mutex_lock (&genieFormMutex) ;
+    for (i = 0 ; (i < genieFormMemberCount) && (n < max) ; ++i)
+    {
+      m = &genieFormMembers [i] ;
+      if (!m->held || (m->form != genieActiveForm))
+	continue ;
+
+      f [0] = GENIE_WRITE_OBJ ;
+      f [1] = m->object ;
+      f [2] = m->index ;
+      f [3] = (m->data >> 8) & 0xFF ;
+      f [4] = (m->data >> 0) & 0xFF ;
+      f [5] = f [0] ^ f [1] ^ f [2] ^ f [3] ^ f [4] ;
+      f += 6 ;
+      ++n ;
+      m->held = FALSE ;
+    }
+    if (i == genieFormMemberCount)			// Got them all
+      genieFormDue = FALSE ;
+  pthread_mutex_unlock (&genieFormMutex) ;
+
+  return n ;
+}
+
+
+/*
+ * genieObjWritten:
+ *	Everything that follows from a WRITE_OBJ having been answered,
+ *	however it was sent.
+ *********************************************************************************
+ */
+static void genieObjWritten (int object, int index, unsigned int data, int acked)
+{
+  if (acked)
+    genieMirrorUpdate (object, index, data & 0xFFFF, genieNanos ()) ;
+
+  if (object == GENIE_OBJ_FORM)				// Strings are redrawn
+  {
+    ++genieStringCacheGen ;
+    if (acked)
+      genieFormActivated (index) ;
+  }
+}
+
+
+/*
+ * Asynchronous reads and writes:
+ *	genieReadObjAsync and genieWriteObjAsync just queue the request
+ *	and return. A thread takes the link, sends up to a window's worth
+ *	of them back to back, and the listener completes each one as its
+ *	ACK, NAK or REPORT_OBJ comes back - the display answers in order,
+ *	so that's always the oldest one still waiting.
+ *
+ *	The queue is lock free, many threads in and the one out, so
+ *	queueing a request costs a few atomic operations and never waits
+ *	on anyone, let alone the display. genieWriteObjQueued uses it for
+ *	a write that waits for its answer without holding the link, so
+ *	writes from many threads go out together rather than in turn.
+ *
+ *	Writes with a deadline (genieWriteObjDeadline) wait in a heap
+ *	instead, and go first, earliest deadline first. One that can't
+ *	make its deadline, going by how long frames are taking to be
+ *	answered, is dropped without being sent, as is one overtaken by
+ *	a newer write to the same object.
+ *
+ *	Completions are called on the listener thread, so they must be
+ *	quick and mustn't call anything here that waits on the display.
+ *********************************************************************************
+ */
+
+#define	GENIE_ASYNC_QUEUE	512		// Power of 2
+#define	GENIE_ASYNC_WINDOW	16		// Frames in flight at once
+#define	GENIE_MAX_DEADLINES	256
+
+struct genieAsyncOp
+{
+  unsigned char      frame [6] ;
+  int                len ;
+  genieCompletion    done ;
+  void              *arg ;
+  unsigned long long deadline ;		// uS, 0 for none
+} ;
+
+// Each slot's seq says whose turn it is: equal to the position it's
+//	next to be filled for, and one past that once it has been.
+
+struct genieAsyncSlot
+{
+  volatile unsigned int seq ;
+  struct genieAsyncOp   op ;
+} ;
+
+static struct genieAsyncSlot genieAsyncQ [GENIE_ASYNC_QUEUE] ;
+static volatile unsigned int genieAsyncHead = 0 ;	// Next free
+static volatile unsigned int genieAsyncTail = 0 ;	// Next to send
+static volatile int genieAsyncSleeping = FALSE ;
+
+static struct genieAsyncOp genieDeadlines [GENIE_MAX_DEADLINES] ;	// Min-heap
+static int genieDeadlineCount = 0 ;
+static struct genieDeadlineStats genieDeadlineStats [256] ;
+
+static struct genieAsyncOp genieAsyncFlight [GENIE_ASYNC_WINDOW] ;
+static int genieAsyncFlightN = 0 ;
+static int genieAsyncFlightDone = 0 ;
+static volatile int genieAsyncBusy = FALSE ;		// Ours in flight
+
+static int genieAsyncRunning = FALSE ;
+static pthread_once_t  genieAsyncOnce  = PTHREAD_ONCE_INIT ;
+static pthread_mutex_t genieAsyncMutex = PTHREAD_MUTEX_INITIALIZER ;
+static pthread_cond_t  genieAsyncCond  = PTHREAD_COND_INITIALIZER ;
+
+
+/*
+ * genieDeadline(Push|Remove):
+ *	Keep the heap of writes with deadlines in order
+ *********************************************************************************
+ */
+static void genieDeadlineSift (int i)
+{
+  struct genieAsyncOp t ;
+  int up, down ;
+
+  while ((i > 0) && (genieDeadlines [i].deadline < genieDeadlines [up = (i - 1) / 2].deadline))
+  {
+    t = genieDeadlines [i] ; genieDeadlines [i] = genieDeadlines [up] ; genieDeadlines [up] = t ;
+    i = up ;
+  }
+
+  for (;;)
+  {
+    down = 2 * i + 1 ;
+    if (down >= genieDeadlineCount)
+      break ;
+    if ((down + 1 < genieDeadlineCount) && (genieDeadlines [down + 1].deadline < genieDeadlines [down].deadline))
+      ++down ;
+    if (genieDeadlines [i].deadline <= genieDeadlines [down].deadline)
+      break ;
+    t = genieDeadlines [i] ; genieDeadlines [i] = genieDeadlines [down] ; genieDeadlines [down] = t ;
+    i = down ;
+  }
+}
+
+static void genieDeadlinePush (const struct genieAsyncOp *op)
+{
+  genieDeadlines [genieDeadlineCount] = *op ;
+  genieDeadlineSift (genieDeadlineCount++) ;
+}
+
+static struct genieAsyncOp genieDeadlineRemove (int i)
+{
+  struct genieAsyncOp op = genieDeadlines [i] ;
+
+  genieDeadlines [i] = genieDeadlines [--genieDeadlineCount] ;
+  if (i < genieDeadlineCount)
+    genieDeadlineSift (i) ;
+
+  return op ;
+}
+
+
+/*
+ * genieAsync(Put|Get|Empty):
+ *	The queue. Producers claim n positions together by moving the head
+ *	on, then fill the slots and say so with their seqs; the thread only
+ *	takes what has been said so, in order.
+ *********************************************************************************
+ */
+static int genieAsyncPut (const struct genieAsyncOp *ops, int n)
+{
+  struct genieAsyncSlot *slot ;
+  unsigned int pos ;
+  int diff, i ;
+
+  for (pos = genieAsyncHead ;;)
+  {
+    slot = &genieAsyncQ [pos % GENIE_ASYNC_QUEUE] ;
+    diff = (int)(slot->seq - pos) ;
+
+    if (diff == 0)
+    {
+      for (i = 1 ; i < n ; ++i)			// The rest must be free too
+	if ((int)(genieAsyncQ [(pos + i) % GENIE_ASYNC_QUEUE].seq - (pos + i)) < 0)
+	  return FALSE ;
+      if (__sync_bool_compare_and_swap (&genieAsyncHead, pos, pos + n))
+	break ;
+      pos = genieAsyncHead ;
+    }
+    else if (diff < 0)				// Still to be sent from last time round
+      return FALSE ;
+    else
+      pos = genieAsyncHead ;
+  }
+
+  for (i = 0 ; i < n ; ++i)
+  {
+    slot = &genieAsyncQ [(pos + i) % GENIE_ASYNC_QUEUE] ;
+    slot->op = ops [i] ;
+    __sync_synchronize () ;
+    slot->seq = pos + i + 1 ;
+  }
+
+  return TRUE ;
+}
+
+static int genieAsyncEmpty (void)
+{
+  return genieAsyncQ [genieAsyncTail % GENIE_ASYNC_QUEUE].seq != genieAsyncTail + 1 ;
+}
+
+// From any thread: nothing's waiting to be sent. Anything this thread
+//	queued has been taken by the time it says so.
+
+static int genieAsyncIdle (void)
+{
+  return (genieAsyncHead == genieAsyncTail) && (genieDeadlineCount == 0) ;
+}
+
+static int genieAsyncGet (struct genieAsyncOp *op)
+{
+  struct genieAsyncSlot *slot = &genieAsyncQ [genieAsyncTail % GENIE_ASYNC_QUEUE] ;
+
+  if (slot->seq != genieAsyncTail + 1)
+    return FALSE ;
+  __sync_synchronize () ;
+
+  *op = slot->op ;
+  __sync_synchronize () ;
+  slot->seq = genieAsyncTail + GENIE_ASYNC_QUEUE ;
+  ++genieAsyncTail ;
+
+  return TRUE ;
+}
+
+
+/*
+ * genieAsyncWindow:
+ *	With the link held, send a window's worth of what's been queued -
+ *	values held for a form that's now showing first, then writes with
+ *	deadlines, then the rest - and wait until the listener has seen
+ *	all the replies (or we give up). How many were sent.
+ *********************************************************************************
+ */
+static int genieAsyncWindow (void)
+{
+  unsigned char frames [GENIE_ASYNC_WINDOW * 6] ;
+  unsigned char formFrames [GENIE_ASYNC_WINDOW * 6] ;
+  struct genieAsyncOp dropped [GENIE_ASYNC_WINDOW], held [GENIE_ASYNC_WINDOW], op ;
+  struct timespec deadline ;
+  unsigned long long now, ns ;
+  int len, rx, n, nForm, nDropped, nHeld, window, reads, i ;
+
+  window = genieLinkWindow (GENIE_LINK_WRITE, 6, GENIE_ASYNC_WINDOW) ;
+  nForm  = genieFormDue ? genieFormTake (formFrames, window) : 0 ;
+
+// Fill the window: anything that can still make its deadline, in
+//	deadline order, then everything else in the order it came
+
+  pthread_mutex_lock (&genieAsyncMutex) ;
+    now = genieMicros () ;
+    n = nDropped = nHeld = 0 ;
+
+    for ( ; n < nForm ; ++n)
+    {
+      memset (&genieAsyncFlight [n], 0, sizeof (struct genieAsyncOp)) ;
+      memcpy (genieAsyncFlight [n].frame, formFrames + n * 6, 6) ;
+      genieAsyncFlight [n].len = 6 ;
+    }
+
+    while ((n < window) && (nDropped < GENIE_ASYNC_WINDOW) && (genieDeadlineCount > 0))
+    {
+      op = genieDeadlineRemove (0) ;
+      if (now + (unsigned long long)genieLinkPredict (GENIE_LINK_WRITE, (n + 1) * 6, n + 1, FALSE) > op.deadline)
+      {
+	++genieDeadlineStats [op.frame [1]].dropped ;
+	dropped [nDropped++] = op ;
+      }
+      else
+	genieAsyncFlight [n++] = op ;
+    }
+
+    while ((n < window) && (nHeld < GENIE_ASYNC_WINDOW) && genieAsyncGet (&op))
+      if (op.len == 0)					// Held for its form
+	held [nHeld++] = op ;
+      else
+	genieAsyncFlight [n++] = op ;
+
+    for (i = len = reads = 0 ; i < n ; ++i)
+    {
+      memcpy (frames + len, genieAsyncFlight [i].frame, genieAsyncFlight [i].len) ;
+      len += genieAsyncFlight [i].len ;
+      if (genieAsyncFlight [i].frame [0] == GENIE_READ_OBJ)
+	++reads ;
+    }
+    rx = reads * 6 + (n - reads) ;
+    genieAsyncFlightN    = n ;
+    genieAsyncFlightDone = 0 ;
+    genieAsyncBusy       = (n > 0) ;
+    pthread_cond_broadcast (&genieAsyncCond) ;
+  pthread_mutex_unlock (&genieAsyncMutex) ;
+
+  for (i = 0 ; i < nDropped ; ++i)
+    if (dropped [i].done != NULL)
+      dropped [i].done (dropped [i].arg, GENIE_ASYNC_DROPPED, 0) ;
+
+  for (i = 0 ; i < nHeld ; ++i)				// As genieWriteObj: that's done
+    if (held [i].done != NULL)
+      held [i].done (held [i].arg, 0, 0) ;
+
+  if (n == 0)
+    return nHeld + nDropped ;
+
+  genieSend (frames, len) ;
+
+// Wait as long as the link model says the answers could take, then
+//	give up on the rest
+
+  clock_gettime (CLOCK_REALTIME, &deadline) ;
+  ns = deadline.tv_nsec + genieLinkTimeout (reads ? GENIE_LINK_READ : GENIE_LINK_WRITE, len, rx, n) * 1000000ULL ;
+  deadline.tv_sec  += ns / 1000000000ULL ;
+  deadline.tv_nsec  = ns % 1000000000ULL ;
+
+  pthread_mutex_lock (&genieAsyncMutex) ;
+    while (genieAsyncFlightDone != genieAsyncFlightN)
+      if (pthread_cond_timedwait (&genieAsyncCond, &genieAsyncMutex, &deadline) != 0)
+	break ;
+
+    if (genieAsyncFlightDone == genieAsyncFlightN)
+      genieLinkSample (reads ? GENIE_LINK_READ : GENIE_LINK_WRITE, genieLinkSent, len, rx, n) ;
+
+    while (genieAsyncFlightDone != genieAsyncFlightN)
+    {
+      op = genieAsyncFlight [genieAsyncFlightDone++] ;
+      if (op.deadline != 0)
+	++genieDeadlineStats [op.frame [1]].late ;
+      pthread_mutex_unlock (&genieAsyncMutex) ;
+	if (op.done != NULL)
+	  op.done (op.arg, -1, 0) ;
+      pthread_mutex_lock (&genieAsyncMutex) ;
+    }
+    genieAsyncBusy = FALSE ;
+  pthread_mutex_unlock (&genieAsyncMutex) ;
+
+  return n ;
+}
+
+
+/*
+ * genieAsyncThread:
+ *	Send windows while there's anything queued. A form write in one
+ *	can leave values held for that form to send, and they go in the
+ *	next without letting go of the link.
+ *********************************************************************************
+ */
+static void *genieAsyncThread (void *data)
+{
+  pthread_setname_np (pthread_self (), "genieAsync") ;
+
+  for (;;)
+  {
+    pthread_mutex_lock (&genieAsyncMutex) ;
+      genieAsyncSleeping = TRUE ;
+      __sync_synchronize () ;
+      while (genieAsyncEmpty () && (genieDeadlineCount == 0) && !genieFormDue)
+	pthread_cond_wait (&genieAsyncCond, &genieAsyncMutex) ;
+      genieAsyncSleeping = FALSE ;
+    pthread_mutex_unlock (&genieAsyncMutex) ;
+
+    genieLock () ;
+      while ((genieAsyncWindow () > 0) && genieFormDue)
+	;
+    genieUnlock () ;
+  }
+
+  return (void *)NULL ;
+}
+
+
+/*
+ * genieAsyncStart, genieAsyncWake:
+ *	Get the queue ready and start the thread, once. Wake it up for
+ *	something other than a request, such as held form values.
+ *********************************************************************************
+ */
+static void genieAsyncStart (void)
+{
+  pthread_t myThread ;
+  int i ;
+
+  for (i = 0 ; i < GENIE_ASYNC_QUEUE ; ++i)
+    genieAsyncQ [i].seq = i ;
+
+  if (pthread_create (&myThread, NULL, genieAsyncThread, NULL) == 0)
+  {
+    pthread_detach (myThread) ;
+    genieAsyncRunning = TRUE ;
+  }
+}
+
+static void genieAsyncWake (void)
+{
+  pthread_once (&genieAsyncOnce, genieAsyncStart) ;
+
+  pthread_mutex_lock (&genieAsyncMutex) ;
+    pthread_cond_broadcast (&genieAsyncCond) ;
+  pthread_mutex_unlock (&genieAsyncMutex) ;
+}
+
+
+/*
+ * genieAsyncSubmit:
+ *	Queue a frame (checksum added here) to go out, by deadline (uS,
+ *	genieMicros time) if it has one. 0, or -1 with errno EAGAIN if
+ *	the queue's full. A len of 0 sends nothing, but still completes
+ *	in turn: that's a write held for its form.
+ *********************************************************************************
+ */
+static int genieAsyncSubmit (unsigned char *frame, int len, unsigned long long deadline, genieCompletion done, void *arg)
+{
+  struct genieAsyncOp op, old ;
+  int i, replaced = FALSE ;
+
+  memset (&op, 0, sizeof (op)) ;
+  old = op ;
+  memcpy (op.frame, frame, len) ;
+  for (i = 0 ; i < len ; ++i)
+    op.frame [len] ^= frame [i] ;
+  op.len      = (len == 0) ? 0 : len + 1 ;
+  op.done     = done ;
+  op.arg      = arg ;
+  op.deadline = deadline ;
+
+  pthread_once (&genieAsyncOnce, genieAsyncStart) ;
+  if (!genieAsyncRunning)
+    return -1 ;
+
+  if (deadline == 0)				// No locks, unless the thread's asleep
+  {
+    if (!genieAsyncPut (&op, 1))
+    {
+      errno = EAGAIN ;
+      return -1 ;
+    }
+    __sync_synchronize () ;
+    if (genieAsyncSleeping)
+    {
+      pthread_mutex_lock   (&genieAsyncMutex) ;
+      pthread_cond_broadcast (&genieAsyncCond) ;
+      pthread_mutex_unlock (&genieAsyncMutex) ;
+    }
+    return 0 ;
+  }
+
+  pthread_mutex_lock (&genieAsyncMutex) ;
+
+  for (i = 0 ; i < genieDeadlineCount ; ++i)		// Overtaken?
+    if ((genieDeadlines [i].frame [1] == op.frame [1]) && (genieDeadlines [i].frame [2] == op.frame [2]))
+    {
+      old = genieDeadlineRemove (i) ;
+      ++genieDeadlineStats [old.frame [1]].superseded ;
+      replaced = TRUE ;
+      break ;
+    }
+
+  if (genieDeadlineCount == GENIE_MAX_DEADLINES)
+  {
+    pthread_mutex_unlock (&genieAsyncMutex) ;
+    errno = EAGAIN ;
+    return -1 ;
+  }
+  genieDeadlinePush (&op) ;
+
+  pthread_cond_broadcast (&genieAsyncCond) ;
+  pthread_mutex_unlock (&genieAsyncMutex) ;
+
+  if (replaced && (old.done != NULL))
+    old.done (old.arg, GENIE_ASYNC_DROPPED, 0) ;
+
+  return 0 ;
+}
+
+
+/*
+ * genieReadObjAsync, genieWriteObjAsync:
+ *	Start a read or write of an object. done (arg, result, value) is
+ *	called when it's finished: result is 0, or -1 for a NAK or no
+ *	reply, and value is what was read. A write held for its form is
+ *	finished with 0, as genieWriteObj returns.
+ *********************************************************************************
+ */
+int genieReadObjAsync (int object, int index, genieCompletion done, void *arg)
+{
+  unsigned char frame [3] ;
+
+  frame [0] = GENIE_READ_OBJ ;
+  frame [1] = object ;
+  frame [2] = index ;
+
+  return genieAsyncSubmit (frame, 3, 0, done, arg) ;
+}
+
+int genieWriteObjAsync (int object, int index, unsigned int data, genieCompletion done, void *arg)
+{
+  unsigned char frame [5] ;
+
+  frame [0] = GENIE_WRITE_OBJ ;
+  frame [1] = object ;
+  frame [2] = index ;
+  frame [3] = (data >> 8) & 0xFF ;
+  frame [4] = (data >> 0) & 0xFF ;
+
+  if (genieFormHold (object, index, data))		// Not showing, send later
+    return genieAsyncSubmit (frame, 0, 0, done, arg) ;
+
+  return genieAsyncSubmit (frame, 5, 0, done, arg) ;
+}
+
+
+/*
+ * genieWriteObjDeadline:
+ *	As genieWriteObjAsync, but it's only worth doing if it gets there
+ *	within deadline mS. If it can't, or another write to the object
+ *	comes along first, done is called with GENIE_ASYNC_DROPPED.
+ *********************************************************************************
+ */
+int genieWriteObjDeadline (int object, int index, unsigned int data, int deadline, genieCompletion done, void *arg)
+{
+  unsigned char frame [5] ;
+
+  if (deadline <= 0)
+    return -1 ;
+
+  frame [0] = GENIE_WRITE_OBJ ;
+  frame [1] = object ;
+  frame [2] = index ;
+  frame [3] = (data >> 8) & 0xFF ;
+  frame [4] = (data >> 0) & 0xFF ;
+
+  if (genieFormHold (object, index, data))
+    return genieAsyncSubmit (frame, 0, 0, done, arg) ;
+
+  return genieAsyncSubmit (frame, 5, genieMicros () + (unsigned long long)deadline * 1000, done, arg) ;
+}
+
+
+/*
+ * genieGetDeadlineStats:
+ *	How writes with deadlines to an object type have fared, or all
+ *	of them for GENIE_ALL.
+ *********************************************************************************
+ */
+int genieGetDeadlineStats (int object, struct genieDeadlineStats *stats)
+{
+  int i ;
+
+  if ((object != GENIE_ALL) && ((object < 0) || (object > 255)))
+    return -1 ;
+
+  pthread_mutex_lock (&genieAsyncMutex) ;
+
+  if (object != GENIE_ALL)
+    *stats = genieDeadlineStats [object] ;
+  else
+  {
+    memset (stats, 0, sizeof (struct genieDeadlineStats)) ;
+    for (i = 0 ; i < 256 ; ++i)
+    {
+      stats->hits       += genieDeadlineStats [i].hits ;
+      stats->late       += genieDeadlineStats [i].late ;
+      stats->dropped    += genieDeadlineStats [i].dropped ;
+      stats->superseded += genieDeadlineStats [i].superseded ;
+    }
+  }
+
+  pthread_mutex_unlock (&genieAsyncMutex) ;
+
+  return 0 ;
+}
+
+
+/*
+ * genieFormAdd, genieFormRemove:
+ *	Say which form an object's on, or forget it. The two halves of
+ *	internal LED digits are one object as far as this goes.
+ *********************************************************************************
+ */
+static int genieFormPartner (int object)
+{
+  return (object == GENIE_OBJ_ILED_DIGITS_H) ? GENIE_OBJ_ILED_DIGITS_L :
+	 (object == GENIE_OBJ_ILED_DIGITS_L) ? GENIE_OBJ_ILED_DIGITS_H : -1 ;
+}
+
+static int genieFormJoin (int form, int object, int index)
+{
+  struct genieFormMember *members ;
+  unsigned short *slot ;
+
+  if ((slot = genieFormSlot [object]) == NULL)
+  {
+    if ((slot = calloc (256, sizeof (unsigned short))) == NULL)
+      return -1 ;
+    genieFormSlot [object] = slot ;
+  }
+
+  if (slot [index] == 0)
+  {
+    if (genieFormMemberCount == genieFormMemberMax)
+    {
+      if ((members = realloc (genieFormMembers, (genieFormMemberMax + 64) * sizeof (struct genieFormMember))) == NULL)
+	return -1 ;
+      genieFormMembers    = members ;
+      genieFormMemberMax += 64 ;
+    }
+    slot [index] = ++genieFormMemberCount ;
+    genieFormMembers [slot [index] - 1].object = object ;
+    genieFormMembers [slot [index] - 1].index  = index ;
+    genieFormMembers [slot [index] - 1].held   = FALSE ;
+  }
+
+  genieFormMembers [slot [index] - 1].form = form ;
+
+  return 0 ;
+}
+
+int genieFormAdd (int form, int object, int index)
+{
+  int result ;
+
+  if ((form < 0) || (form > 255) || (object < 0) || (object > 255) || (object == GENIE_OBJ_FORM) ||
+      (index < 0) || (index > 255))
+    return -1 ;
+
+  pthread_mutex_lock (&genieFormMutex) ;
+    if (genieFormPartner (object) < 0)
+      result = genieFormJoin (form, object, index) ;
+    else						// High half first, as they're sent
+      result = (genieFormJoin (form, GENIE_OBJ_ILED_DIGITS_H, index) == 0) ?
+		genieFormJoin (form, GENIE_OBJ_ILED_DIGITS_L, index) : -1 ;
+  pthread_mutex_unlock (&genieFormMutex) ;
+
+  if (result != 0)
+    return -1 ;
+
+  if (form == genieActiveForm)				// Moved onto the one showing
+  {
+    genieFormActivated (form) ;
+    if (genieFormDue)
+      genieAsyncWake () ;
+  }
+
+  return 0 ;
+}
+
+static int genieFormLeave (int object, int index)
+{
+  struct genieFormMember *m ;
+  unsigned char frame [5] ;
+  int member, last ;
+
+  if ((genieFormSlot [object] == NULL) || ((member = genieFormSlot [object][index]) == 0))
+    return -1 ;
+
+  m = &genieFormMembers [--member] ;
+  if (m->held)						// Don't lose it
+  {
+    frame [0] = GENIE_WRITE_OBJ ;
+    frame [1] = m->object ;
+    frame [2] = m->index ;
+    frame [3] = (m->data >> 8) & 0xFF ;
+    frame [4] = (m->data >> 0) & 0xFF ;
+    genieAsyncSubmit (frame, 5, 0, NULL, NULL) ;
+  }
+
+  genieFormSlot [object][index] = 0 ;
+  last = --genieFormMemberCount ;
+  if (member != last)					// Last one fills the gap
+  {
+    genieFormMembers [member] = genieFormMembers [last] ;
+    genieFormSlot [genieFormMembers [member].object][genieFormMembers [member].index] = member + 1 ;
+  }
+
+  return 0 ;
+}
+
+int genieFormRemove (int object, int index)
+{
+  int partner, result ;
+
+  if ((object < 0) || (object > 255) || (index < 0) || (index > 255))
+    return -1 ;
+
+  pthread_mutex_lock (&genieFormMutex) ;
+    result = genieFormLeave (object, index) ;
+    if ((result == 0) && ((partner = genieFormPartner (object)) >= 0))
+      genieFormLeave (partner, index) ;
+  pthread_mutex_unlock (&genieFormMutex) ;
+
+  return result ;
+}
+
+
+/*
+ * genieGetActiveForm:
+ *	The form we think is showing, or -1 if we don't know yet.
+ *********************************************************************************
+ */
+int genieGetActiveForm (void)
+{
+  return genieActiveForm ;
+}
+
+
+/*
+ * genieWriteObjQueued:
+ *	As genieWriteObj, but through the async queue: it waits for the
+ *	display's answer without holding the link, so other threads' writes
+ *	can go out alongside it.
+ *********************************************************************************
+ */
+struct genieQueuedWait
+{
+  sem_t *sem ;
+  int    result ;
+} ;
+
+static __thread sem_t genieQueuedSem ;
+static __thread int   genieQueuedSemReady = FALSE ;
+
+static void genieQueuedDone (void *arg, int result, unsigned int value)
+{
+  struct genieQueuedWait *w = (struct genieQueuedWait *)arg ;
+
+  if (result != 0)
+    w->result = result ;
+  sem_post (w->sem) ;			// Runs on the listener: the waiter's semaphore
+}
+
+int genieWriteObjQueued (int object, int index, unsigned int data)
+{
+  struct genieQueuedWait w ;
+
+  if (!genieQueuedSemReady)
+  {
+    if (sem_init (&genieQueuedSem, 0, 0) != 0)
+      return -1 ;
+    genieQueuedSemReady = TRUE ;
+  }
+  w.sem    = &genieQueuedSem ;
+  w.result = 0 ;
+
+  if (genieWriteObjAsync (object, index, data, genieQueuedDone, &w) != 0)
+    return -1 ;
+
+  while (sem_wait (&genieQueuedSem) != 0)
+    ;
+
+  return w.result ;
+}
+
+
+/*
+ * genieWriteObjsQueued:
+ *	As genieWriteObjQueued, for count ready made WRITE_OBJ frames
+ *	(checksums included) that go into the queue together, so nothing
+ *	else queued can come between them. -1 if any was NAKed or not
+ *	answered. Form holds are the caller's business.
+ *********************************************************************************
+ */
+static int genieWriteObjsQueued (const unsigned char *frames, int count)
+{
+  struct genieAsyncOp ops [GENIE_ASYNC_WINDOW] ;
+  struct genieQueuedWait w ;
+  int i ;
+
+  if ((count < 1) || (count > GENIE_ASYNC_WINDOW))
+    return -1 ;
+
+  if (!genieQueuedSemReady)
+  {
+    if (sem_init (&genieQueuedSem, 0, 0) != 0)
+      return -1 ;
+    genieQueuedSemReady = TRUE ;
+  }
+  w.sem    = &genieQueuedSem ;
+  w.result = 0 ;
+
+  memset (ops, 0, sizeof (ops)) ;
+  for (i = 0 ; i < count ; ++i)
+  {
+    memcpy (ops [i].frame, frames + i * 6, 6) ;
+    ops [i].len  = 6 ;
+    ops [i].done = genieQueuedDone ;
+    ops [i].arg  = &w ;
+  }
+
+  pthread_once (&genieAsyncOnce, genieAsyncStart) ;
+  if (!genieAsyncRunning)
+    return -1 ;
+
+  while (!genieAsyncPut (ops, count))		// Full: it's being emptied
+    sched_yield () ;
+
+  __sync_synchronize () ;
+  if (genieAsyncSleeping)
+  {
+    pthread_mutex_lock   (&genieAsyncMutex) ;
+    pthread_cond_broadcast (&genieAsyncCond) ;
+    pthread_mutex_unlock (&genieAsyncMutex) ;
+  }
+
+  for (i = 0 ; i < count ; ++i)
+    while (sem_wait (&genieQueuedSem) != 0)
+      ;
+
+  return w.result ;
+}
+
+
+/*
+ * genieAsyncComplete:
+ *	Finish the oldest request in flight. Returns FALSE if there's
+ *	none, or a REPORT_OBJ isn't for it, and it's not ours.
+ *********************************************************************************
+ */
+static int genieAsyncComplete (int cmd, int object, int index, unsigned int value)
+{
+  struct genieAsyncOp op ;
+  int result ;
+
+  pthread_mutex_lock (&genieAsyncMutex) ;
+
+  if (genieAsyncFlightDone == genieAsyncFlightN)
+  {
+    pthread_mutex_unlock (&genieAsyncMutex) ;
+    return FALSE ;
+  }
+
+  op = genieAsyncFlight [genieAsyncFlightDone] ;
+
+  if ((cmd == GENIE_REPORT_OBJ) && ((op.frame [0] != GENIE_READ_OBJ) ||
+	(op.frame [1] != object) || (op.frame [2] != index)))
+  {
+    pthread_mutex_unlock (&genieAsyncMutex) ;
+    return FALSE ;
+  }
+
+  ++genieAsyncFlightDone ;
+
+  if (op.deadline != 0)
+  {
+    if (genieMicros () <= op.deadline)
+      ++genieDeadlineStats [op.frame [1]].hits ;
+    else
+      ++genieDeadlineStats [op.frame [1]].late ;
+  }
+
+  pthread_cond_broadcast (&genieAsyncCond) ;
+  pthread_mutex_unlock (&genieAsyncMutex) ;
+
+  if (cmd == GENIE_REPORT_OBJ)
+    result = 0 ;
+  else
+  {
+    result = (cmd == GENIE_ACK) ? 0 : -1 ;
+    value  = 0 ;
+    if (op.frame [0] == GENIE_WRITE_OBJ)		// The thread sends what's held
+      genieObjWritten (op.frame [1], op.frame [2], op.frame [3] << 8 | op.frame [4], result == 0) ;
+  }
+
+  if (op.done != NULL)
+    op.done (op.arg, result, value) ;
+
+  return TRUE ;
+}
+
+
+/*
+ * genieReadMatch:
+ *	If a read in progress is waiting for this object, hand it over.
+ *********************************************************************************
+ */
+static int genieReadMatch (int object, int index, unsigned int data)
+{
+  int i, n = genieReadsPending ;
+
+  for (i = 0 ; i < n ; ++i)
+    if (!genieReads [i].done && (genieReads [i].object == object) && (genieReads [i].index == index))
+    {
+      GENIE_PROBE4 (read_reply, object, index, data, genieNanos () - genieTxStamp) ;
+      genieReads [i].data = data ;
+      __sync_synchronize () ;
+      genieReads [i].done = TRUE ;
+      return TRUE ;
+    }
+
+  return FALSE ;
+}
+
+
+/*
+ * genieDecodeFrame:
+ *	Make sense of the frame from the display at the start of buf, of
+ *	which we have len bytes. It only looks at the buffer, so it can be
+ *	tried on anything. Returns the length of the frame, 0 if we need
+ *	more of it to tell, or minus the length if the checksum's wrong -
+ *	*frame is filled in either way, so the caller knows what it lost.
+ *	Anything we don't know is taken to be the usual 6 bytes.
+ *********************************************************************************
+ */
+int genieDecodeFrame (const unsigned char *buf, int len, struct genieFrame *frame)
+{
+  unsigned int checksum = 0 ;
+  int need, i ;
+
+  if (len < 1)
+    return 0 ;
+
+  switch (buf [0])
+  {
+    case GENIE_ACK:
+    case GENIE_NAK:
+      need = 1 ;
+      break ;
+
+    case GENIE_REPORT_MAGIC_BYTES:		// Length byte's in place of the index
+      if (len < 3)
+	return 0 ;
+      need = 4 + buf [2] ;
+      break ;
+
+    case GENIE_REPORT_DOUBLE_BYTES:
+      if (len < 3)
+	return 0 ;
+      need = 4 + 2 * buf [2] ;
+      break ;
+
+    default:
+      need = 6 ;
+      break ;
+  }
+
+  if (len < need)
+    return 0 ;
+
+  frame->cmd     = buf [0] ;
+  frame->object  = (need > 1) ? buf [1] : 0 ;
+  frame->index   = (need > 1) ? buf [2] : 0 ;
+  frame->data    = (need == 6) ? (buf [3] << 8 | buf [4]) : 0 ;
+  frame->payload = (need > 4) ? buf + 3 : NULL ;
+
+  if (need == 1)
+    return 1 ;
+
+  for (i = 0 ; i < need ; ++i)
+    checksum ^= buf [i] ;
+
+  return (checksum == 0) ? need : -need ;
+}
+
+
+/*
+ * genieReplyListener:
+ *	Listen for bytes from the Genie display and build them into
+ *	messages, and store them in the message queue
+ *********************************************************************************
+ */
+static void *genieReplyListener (void *data)
+{
+  unsigned char buf [GENIE_MAX_FRAME] ;
+  struct genieFrame frame ;
+  unsigned int cmd, object, index, value ;
+  unsigned int count, i ;
+  unsigned long long stamp ;
+  struct genieReplyExStruct *reply ;
+  struct genieMagicReplyStruct *magicByteReply ;  
+  int c, have, len, next ;
+
+// Scheduling and affinity were set up when we were created
+
+  if (genieOptions.threadName != NULL)
+    pthread_setname_np (pthread_self (), genieOptions.threadName) ;
+
+// Make sure the serial port is actually open
+
+  while (genieFd == -1)
+    delay (1) ;
+
+// Loop, forever, catching events coming back from the display
+
+  for (;;)
+  {
+    while ((c = genieGetcharWait (GENIE_LINK_IDLE_WAIT)) == -1)
+      ;
+
+    stamp    = genieRxStamp ;
+    buf [0]  = c ;
+    have     = 1 ;
+
+// Gather the rest of the frame, giving up if the display stalls in it
+
+    while ((len = genieDecodeFrame (buf, have, &frame)) == 0)
+    {
+      if ((c = genieGetchar ()) == -1)
+	break ;
+      buf [have++] = c ;
+    }
+
+    if (len == 0)
+    {
+      ++genieTimeouts ;
+      GENIE_PROBE2 (timeout, buf [0], have) ;
+      continue ;
+    }
+
+    if (genieEvLog != NULL)
+      genieEventLogFrame (GENIE_CAPTURE_RX, buf, (len < 0) ? -len : len, stamp) ;
+
+    cmd    = frame.cmd ;
+    object = frame.object ;
+    index  = frame.index ;
+    value  = frame.data ;
+
+    if (cmd == GENIE_ACK)
+    {
+      GENIE_PROBE2 (ack, genieAckCount + 1, genieNanos () - genieTxStamp) ;
+      genieAnswerStamp = stamp ;
+      if (genieAsyncBusy)
+	genieAsyncComplete (cmd, 0, 0, 0) ;
+      pthread_mutex_lock (&genieAckMutex) ;
+	++genieAckCount ; genieAck = TRUE ;
+	pthread_cond_broadcast (&genieAckCond) ;
+      pthread_mutex_unlock (&genieAckMutex) ;
+      continue ;
+    }
+    if (cmd == GENIE_NAK)
+    {
+      GENIE_PROBE2 (nak, genieNakCount + 1, genieNanos () - genieTxStamp) ;
+      genieAnswerStamp = stamp ;
+      if (genieAsyncBusy)
+	genieAsyncComplete (cmd, 0, 0, 0) ;
+      pthread_mutex_lock (&genieAckMutex) ;
+	++genieNakCount ; genieNak = TRUE ;
+	pthread_cond_broadcast (&genieAckCond) ;
+      pthread_mutex_unlock (&genieAckMutex) ;
+      continue ;
+    }
+
+    if (len < 0)
+    {
+      GENIE_PROBE3 (checksum_error, cmd, object, index) ;
+      ++genieChecksumErrors ;
+      continue ;
+    }
+
+    GENIE_PROBE5 (frame_receive, cmd, object, index, value, genieNanos () - stamp) ;
+
+	// Keep the mirror of what the display shows up to date
+
+    if ((cmd == GENIE_REPORT_OBJ) || (cmd == GENIE_REPORT_EVENT))
+      genieMirrorUpdate (object, index, value, stamp) ;
+
+    if (cmd == GENIE_REPORT_OBJ)
+      genieAnswerStamp = stamp ;
+
+	// We have valid data - store it into the buffer
+    next = (genieReplysHead + 1) & (MAX_GENIE_REPLYS - 1) ;
+	
+	
+	if(cmd == GENIE_REPORT_MAGIC_BYTES || cmd == GENIE_REPORT_DOUBLE_BYTES)
+	{	
+		pthread_mutex_lock (&genieReplyMutex) ;
+		if (next != genieReplysTail)			// Discard rather than overflow
+		{
+		  reply 		  = &genieReplys [genieReplysHead] ;
+		  reply->cmd		  = cmd ;		// Never merged into
+		  reply->object		  = object ;
+		  reply->index		  = index ;
+		  reply->data		  = 0 ;
+		  reply->count		  = 1 ;
+		  reply->seq		  = genieReplySeq ;
+		  reply->timestamp	  = stamp ;
+
+		  memcpy (genieReplyFrames [genieReplysHead], buf, len) ;
+		  genieReplyFrameLen [genieReplysHead] = len ;
+
+		  magicByteReply 		  = &genieMagicReplys[genieReplysHead] ;
+		  magicByteReply->cmd     = cmd ;
+		  magicByteReply->index   = object ;	
+		  count = index ;				// Only as many as we've room for
+		  if (count > sizeof (magicByteReply->data) / sizeof (magicByteReply->data [0]))
+		    count = sizeof (magicByteReply->data) / sizeof (magicByteReply->data [0]) ;
+		  magicByteReply->length = count ;
+
+		  if (cmd == GENIE_REPORT_MAGIC_BYTES)
+		    for (i = 0 ; i < count ; ++i)
+		      magicByteReply->data [i] = frame.payload [i] ;
+		  else
+		    for (i = 0 ; i < count ; ++i)
+		      magicByteReply->data [i] = frame.payload [i * 2] << 8 | frame.payload [i * 2 + 1] ;
+
+		  genieReplysHead 		  = next ;
+		}
+		++genieReplySeq ;
+		pthread_mutex_unlock (&genieReplyMutex) ;
+	}
+	
+	else if ((cmd == GENIE_REPORT_OBJ) && genieAsyncBusy && genieAsyncComplete (cmd, object, index, value))
+		;
+
+	else if ((cmd == GENIE_REPORT_OBJ) && genieReadMatch (object, index, value))
+		;
+	
+	else
+	{
+		if (object == GENIE_OBJ_FORM)			// Form change: strings are redrawn
+		  ++genieStringCacheGen ;
+
+		if ((cmd == GENIE_REPORT_EVENT) && (object == GENIE_OBJ_FORM))
+		{
+		  genieFormActivated (index) ;
+		  if (genieFormDue)				// The async thread sends them
+		    genieAsyncWake () ;
+		}
+
+		pthread_mutex_lock (&genieReplyMutex) ;
+		reply = &genieReplys [(genieReplysHead - 1) & (MAX_GENIE_REPLYS - 1)] ;
+
+		if ((cmd == GENIE_REPORT_EVENT) && genieCoalesce [object]	// Merge into the last
+		    && (genieReplysHead != genieReplysTail)		//	one, if unread
+		    && (reply->cmd == cmd) && (reply->object == object) && (reply->index == index))
+			{
+			  reply->data   = value ;
+			  reply->seq    = genieReplySeq ;
+			  reply->timestamp = stamp ;
+			  ++reply->count ;
+			  memcpy (genieReplyFrames [(genieReplysHead - 1) & (MAX_GENIE_REPLYS - 1)], buf, len) ;
+			  GENIE_PROBE4 (queue_merge, cmd, object, index, reply->count) ;
+			}
+		else if (next != genieReplysTail)			// Discard rather than overflow
+			{
+			  reply 		= &genieReplys [genieReplysHead] ;
+			  reply->cmd    = cmd ;
+			  reply->object = object ;
+			  reply->index  = index ;
+			  reply->data   = value ;
+			  reply->count  = 1 ;
+			  reply->seq    = genieReplySeq ;
+			  reply->timestamp = stamp ;
+			  memcpy (genieReplyFrames [genieReplysHead], buf, len) ;
+			  genieReplyFrameLen [genieReplysHead] = len ;
+			  genieReplysHead = next ;
+			  genieLatencyProbe (reply) ;
+			  GENIE_PROBE4 (queue_enqueue, cmd, object, index, genieReplySeq) ;
+			}
+		else
+		  GENIE_PROBE4 (queue_drop, cmd, object, index, genieReplySeq) ;
+		++genieReplySeq ;			// Still counted if dropped, to leave a gap
+		pthread_mutex_unlock (&genieReplyMutex) ;
+	}	
+  }
+
+  return (void *)NULL ;
+}
+
+
+/*
+ * genieReplyAvail:
+ *	Return TRUE if there are pending messages from the display
+ *********************************************************************************
+ */
+int genieReplyAvail (void)
+{
+  return (genieReplysHead != genieReplysTail) ;
+}
+
+
+/*
+ * genieGetReply:
+ *	Get the next message out of the Genie Reply queue, or
+ *	wait until a message has been sent from the display
+ *********************************************************************************
+ */
+void genieGetReply (struct genieReplyStruct *reply)
+{
+  struct genieReplyExStruct ex ;
+
+  genieGetReplyEx (&ex) ;
+
+  reply->cmd    = ex.cmd ;
+  reply->object = ex.object ;
+  reply->index  = ex.index ;
+  reply->data   = ex.data ;
+}
+
+
+/*
+ * genieGetReplyEx:
+ *	As genieGetReply, but with the sequence number and the time
+ *	(CLOCK_MONOTONIC, nS) the first byte of the message arrived.
+ *	Merged events carry the newest of these, and how many they hold.
+ *********************************************************************************
+ */
+static int _genieGetReply (struct genieReplyExStruct *reply, unsigned char *frame)
+{
+  int len ;
+
+  while (!genieReplyAvail ())
+    delay (1) ;
+
+  pthread_mutex_lock (&genieReplyMutex) ;
+  memcpy (reply, &genieReplys [genieReplysTail], sizeof (struct genieReplyExStruct)) ;
+  len = genieReplyFrameLen [genieReplysTail] ;
+  if (frame != NULL)
+    memcpy (frame, genieReplyFrames [genieReplysTail], len) ;
+
+  genieReplysTail = (genieReplysTail + 1) & (MAX_GENIE_REPLYS - 1) ;
+  pthread_mutex_unlock (&genieReplyMutex) ;
+
+  GENIE_PROBE4 (queue_dequeue, reply->cmd, reply->object, reply->index, genieNanos () - reply->timestamp) ;
+
+  return len ;
+}
+
+void genieGetReplyEx (struct genieReplyExStruct *reply)
+{
+  _genieGetReply (reply, NULL) ;
+}
+
+
+/*
+ * genieGetReplyFrame:
+ *	As genieGetReplyEx, and copy the frame itself, as the display sent
+ *	it (the newest, for merged events), into frame, which must have
+ *	room for GENIE_MAX_FRAME bytes. Returns its length.
+ *********************************************************************************
+ */
+int genieGetReplyFrame (struct genieReplyExStruct *reply, unsigned char *frame)
+{
+  return _genieGetReply (reply, frame) ;
+}
+
+
+/*
+ * genieSetCoalesce:
+ *	Choose whether queued events from an object type are merged.
+ *	When on, an event arriving while the previous one for the same
+ *	object and index is still unread replaces it, and its count goes
+ *	up. Returns the old setting.
+ *********************************************************************************
+ */
+int genieSetCoalesce (int object, int on)
+{
+  int old ;
+
+  if ((object < 0) || (object > 255))
+    return -1 ;
+
+  pthread_mutex_lock (&genieReplyMutex) ;
+  old = genieCoalesce [object] ;
+  genieCoalesce [object] = (on != 0) ;
+  pthread_mutex_unlock (&genieReplyMutex) ;
+
+  return old ;
+}
+
+/*
+ * genieReadObj:
+ *	Send a read object command to the Genie display and get the result back
+ *********************************************************************************
+ */
+static int _genieReadObjs (const int *objects, const int *indexes, int *values, int count)
+{
+  unsigned char frames [GENIE_MAX_READS * 4] ;
+  unsigned int timeUp, naks ;
+  int i, done ;
+
+  if ((count < 1) || (count > GENIE_MAX_READS))
+    return -1 ;
+
+// Tell the listener what we're waiting for. Events that arrive in the
+//	meantime stay in the queue for the application.
+
+  for (i = 0 ; i < count ; ++i)
+  {
+    genieReads [i].object = objects [i] ;
+    genieReads [i].index  = indexes [i] ;
+    genieReads [i].done   = FALSE ;
+    values [i] = -1 ;
+
+    frames [i * 4 + 0] = GENIE_READ_OBJ ;
+    frames [i * 4 + 1] = objects [i] ;
+    frames [i * 4 + 2] = indexes [i] ;
+    frames [i * 4 + 3] = GENIE_READ_OBJ ^ objects [i] ^ indexes [i] ;
+  }
+  __sync_synchronize () ;
+  genieReadsPending = count ;
+
+  genieExpectAck () ;
+  naks = genieNakCount ;
+
+  genieSend (frames, count * 4) ;
+
+// Wait as long as the link model says the replies could take
+
+  for (timeUp = millis () + genieLinkTimeout (GENIE_LINK_READ, count * 4, count * 6, count) ; millis () < timeUp ;)
+  {
+    for (i = done = 0 ; i < count ; ++i)
+      done += genieReads [i].done ;
+
+    if (done + (genieNakCount - naks) >= (unsigned int)count)
+      break ;
+
+    delayMicroseconds (101) ;
+  }
+
+  genieReadsPending = 0 ;
+
+  for (i = done = 0 ; i < count ; ++i)
+    if (genieReads [i].done)
+    {
+      values [i] = genieReads [i].data ;
+      ++done ;
+    }
+    else
+      GENIE_PROBE3 (read_timeout, objects [i], indexes [i], genieNanos () - genieTxStamp) ;
+
+  if (done == count)
+    genieLinkSample (GENIE_LINK_READ, genieLinkSent, count * 4, count * 6, count) ;
+
+  return done ;
+}
+
+static int _genieReadObj (int object, int index)
+{
+  int value ;
+
+  _genieReadObjs (&object, &index, &value, 1) ;
+
+  return value ;
+}
+int genieReadObj (int object, int index)
+{
+  int result ;
+ 
+  genieLock () ;
+    result = _genieReadObj (object, index) ;
+  genieUnlock () ;
+
+  return result ;
+
+}
+
+
+/*
+ * genieReadObjCached:
+ *	Return what the display is showing for an object from the mirror,
+ *	if we learned it no more than maxAge mS ago (any age if maxAge is
+ *	negative). Otherwise it's read from the display.
+ *********************************************************************************
+ */
+int genieReadObjCached (int object, int index, int maxAge)
+{
+  unsigned int value ;
+  unsigned long long stamp ;
+
+  if (genieMirrorGet (object, index, &value, &stamp))
+    if ((maxAge < 0) || ((genieNanos () - stamp) <= (unsigned long long)maxAge * 1000000))
+      return value ;
+
+  return genieReadObj (object, index) ;
+}
+
+
+/*
+ * Subscriptions:
+ *	Poll object values on behalf of the application, calling back
+ *	when one changes. All of them share one thread and a time wheel
+ *	of GENIE_WHEEL_TICK mS slots; reads that fall due together go
+ *	out as one batch. If the batches are taking up too much of the
+ *	link, every period is stretched until they don't.
+ *********************************************************************************
+ */
+
+#define	GENIE_MAX_SUBSCRIPTIONS	128
+#define	GENIE_WHEEL_TICK	10
+#define	GENIE_WHEEL_SLOTS	256
+#define	GENIE_STRETCH_MAX	8.0
+
+struct genieSubscription
+{
+  int inUse ;
+  int object ;
+  int index ;
+  int period ;				// In ticks
+  genieValueCallback callback ;
+  int haveValue ;
+  unsigned int value ;
+  unsigned long long due ;		// Tick
+  int next ;				// In the wheel slot
+} ;
+
+static struct genieSubscription genieSubs [GENIE_MAX_SUBSCRIPTIONS] ;
+static int genieWheel [GENIE_WHEEL_SLOTS] ;
+static unsigned long long genieWheelNow = 0 ;
+static double genieStretch = 1.0 ;
+static pthread_mutex_t genieSubMutex = PTHREAD_MUTEX_INITIALIZER ;
+static int genieSubThreadRunning = FALSE ;
+
+static void genieWheelInsert (int id, unsigned long long due)
+{
+  int slot = due % GENIE_WHEEL_SLOTS ;
+
+  genieSubs [id].due  = due ;
+  genieSubs [id].next = genieWheel [slot] ;
+  genieWheel [slot]   = id ;
+}
+
+static void genieWheelRemove (int id)
+{
+  int *p = &genieWheel [genieSubs [id].due % GENIE_WHEEL_SLOTS] ;
+
+  for ( ; *p != -1 ; p = &genieSubs [*p].next)
+    if (*p == id)
+    {
+      *p = genieSubs [id].next ;
+      return ;
+    }
+}
+
+static void *genieSubThread (void *data)
+{
+  int due [GENIE_MAX_SUBSCRIPTIONS] ;
+  int objects [GENIE_MAX_READS], indexes [GENIE_MAX_READS], values [GENIE_MAX_READS] ;
+  int nDue, n, i, id, *p, changed ;
+  unsigned long long start, busy, period ;
+  struct genieSubscription *sub ;
+  genieValueCallback callback ;
+
+  pthread_setname_np (pthread_self (), "genieSubscribe") ;
+
+  for (;;)
+  {
+    start = genieMicros () ;
+    busy  = 0 ;
+
+// Take everything that's due off the wheel
+
+    pthread_mutex_lock (&genieSubMutex) ;
+      ++genieWheelNow ;
+      nDue = 0 ;
+      for (p = &genieWheel [genieWheelNow % GENIE_WHEEL_SLOTS] ; *p != -1 ;)
+	if (genieSubs [*p].due <= genieWheelNow)
+	{
+	  id = *p ;
+	  *p = genieSubs [id].next ;
+	  genieSubs [id].next = -2 ;		// Off the wheel while it's read
+	  due [nDue++] = id ;
+	}
+	else
+	  p = &genieSubs [*p].next ;
+    pthread_mutex_unlock (&genieSubMutex) ;
+
+// Read them in batches
+
+    for (i = 0 ; i < nDue ; i += n)
+    {
+      n = (nDue - i > GENIE_MAX_READS) ? GENIE_MAX_READS : nDue - i ;
+
+      pthread_mutex_lock (&genieSubMutex) ;
+	for (id = 0 ; id < n ; ++id)
+	{
+	  objects [id] = genieSubs [due [i + id]].object ;
+	  indexes [id] = genieSubs [due [i + id]].index ;
+	}
+      pthread_mutex_unlock (&genieSubMutex) ;
+
+      genieLock () ;
+	_genieReadObjs (objects, indexes, values, n) ;
+      genieUnlock () ;
+
+      for (id = 0 ; id < n ; ++id)
+      {
+	pthread_mutex_lock (&genieSubMutex) ;
+	  sub      = &genieSubs [due [i + id]] ;
+	  changed  = FALSE ;
+	  callback = NULL ;
+	  if (sub->inUse && (sub->next == -2))
+	  {
+	    if ((values [id] >= 0) && (!sub->haveValue || (sub->value != (unsigned int)values [id])))
+	    {
+	      sub->haveValue = TRUE ;
+	      sub->value     = values [id] ;
+	      changed        = TRUE ;
+	      callback       = sub->callback ;
+	    }
+	    period = (unsigned long long)(sub->period * genieStretch) ;
+	    genieWheelInsert (due [i + id], genieWheelNow + (period ? period : 1)) ;
+	  }
+	pthread_mutex_unlock (&genieSubMutex) ;
+
+	if (changed)
+	  callback (objects [id], indexes [id], values [id]) ;
+      }
+    }
+
+// Adapt: if polling is taking most of the link, back off
+
+    busy = genieMicros () - start ;
+    pthread_mutex_lock (&genieSubMutex) ;
+      if (busy > GENIE_WHEEL_TICK * 800)
+	genieStretch = (genieStretch * 1.25 > GENIE_STRETCH_MAX) ? GENIE_STRETCH_MAX : genieStretch * 1.25 ;
+      else if ((busy < GENIE_WHEEL_TICK * 400) && (genieStretch > 1.0))
+	genieStretch = (genieStretch * 0.98 < 1.0) ? 1.0 : genieStretch * 0.98 ;
+    pthread_mutex_unlock (&genieSubMutex) ;
+
+    if (busy < GENIE_WHEEL_TICK * 1000)
+      delayMicroseconds (GENIE_WHEEL_TICK * 1000 - busy) ;
+  }
+
+  return NULL ;
+}
+
+
+/*
+ * genieSubscribe:
+ *	Poll an object every period mS, and call back when its value
+ *	changes (and the first time it's read). Returns an id for
+ *	genieUnsubscribe, or -1 (with EINVAL for an object or index that
+ *	won't fit in a frame).
+ *********************************************************************************
+ */
+int genieSubscribe (int object, int index, int period, genieValueCallback callback)
+{
+  pthread_t myThread ;
+  int id, i ;
+
+  if ((object < 0) || (object > 255) || (index < 0) || (index > 255))
+    { errno = EINVAL ; return -1 ; }
+
+  if ((period <= 0) || (callback == NULL))
+    return -1 ;
+
+  pthread_mutex_lock (&genieSubMutex) ;
+
+  if (!genieSubThreadRunning)
+  {
+    for (i = 0 ; i < GENIE_WHEEL_SLOTS ; ++i)
+      genieWheel [i] = -1 ;
+    if (pthread_create (&myThread, NULL, genieSubThread, NULL) != 0)
+    {
+      pthread_mutex_unlock (&genieSubMutex) ;
+      return -1 ;
+    }
+    pthread_detach (myThread) ;
+    genieSubThreadRunning = TRUE ;
+  }
+
+  for (id = 0 ; id < GENIE_MAX_SUBSCRIPTIONS ; ++id)
+    if (!genieSubs [id].inUse)
+      break ;
+
+  if (id == GENIE_MAX_SUBSCRIPTIONS)
+  {
+    pthread_mutex_unlock (&genieSubMutex) ;
+    return -1 ;
+  }
+
+  genieSubs [id].inUse     = TRUE ;
+  genieSubs [id].object    = object ;
+  genieSubs [id].index     = index ;
+  genieSubs [id].period    = (period + GENIE_WHEEL_TICK - 1) / GENIE_WHEEL_TICK ;
+  genieSubs [id].callback  = callback ;
+  genieSubs [id].haveValue = FALSE ;
+  genieWheelInsert (id, genieWheelNow + 1) ;
+
+  pthread_mutex_unlock (&genieSubMutex) ;
+
+  return id ;
+}
+
+
+/*
+ * genieUnsubscribe:
+ *	Stop polling. Once this returns the callback won't be called
+ *	again for it, unless it's already running.
+ *********************************************************************************
+ */
+int genieUnsubscribe (int id)
+{
+  if ((id < 0) || (id >= GENIE_MAX_SUBSCRIPTIONS))
+    return -1 ;
+
+  pthread_mutex_lock (&genieSubMutex) ;
+    if (!genieSubs [id].inUse)
+    {
+      pthread_mutex_unlock (&genieSubMutex) ;
+      return -1 ;
+    }
+    if (genieSubs [id].next != -2)		// On the wheel, not being read
+      genieWheelRemove (id) ;
+    genieSubs [id].inUse = FALSE ;
+  pthread_mutex_unlock (&genieSubMutex) ;
+
+  return 0 ;
+}
+
+
+/*
+ * _genieWriteFrames:
+ *	Send a run of frames (checksums included) back to back in one go,
+ *	then wait for all of their ACKs together. -1 if any were NAKed
+ *	or not answered in time.
+ *********************************************************************************
+ */
+#define	GENIE_WIDE_BATCH	16		// Frames or values per transaction
+
+static int _genieWriteFrames (const unsigned char *frames, int len, int count)
+{
+  genieExpectAck () ;
+  genieSend (frames, len) ;
+
+  return genieWaitAcks (GENIE_LINK_WRITE, len, count) ;
+}
+
+
+/*
+ * _genieFormFlush:
+ *	Send what's held for the form that's just been shown, while we
+ *	still have the link from showing it.
+ *********************************************************************************
+ */
+static void _genieFormFlush (void)
+{
+  unsigned char frames [GENIE_WIDE_BATCH * 6] ;
+  const unsigned char *f ;
+  int i, n ;
+
+  while (genieFormDue && ((n = genieFormTake (frames, GENIE_WIDE_BATCH)) > 0))
+    if (_genieWriteFrames (frames, n * 6, n) == 0)
+      for (i = 0, f = frames ; i < n ; ++i, f += 6)
+	genieObjWritten (f [1], f [2], f [3] << 8 | f [4], TRUE) ;
+}
+
+
+/*
+ * genieWriteObj:
+ *	Write data to an object on the display. -1 if it was NAKed or
+ *	not answered.
+ *	While async requests are waiting to go, it joins the end of their
+ *	queue, so it can't overtake writes made before it; otherwise it
+ *	takes the link itself, in its priority class, which is quicker.
+ *********************************************************************************
+ */
+static int _genieWriteObjFrame (const unsigned char *frame)
+{
+  int result ;
+
+  genieExpectAck () ;
+
+  genieSend (frame, 6) ;
+  result = genieWaitAck (GENIE_LINK_WRITE, 6) ;
+
+  genieObjWritten (frame [1], frame [2], frame [3] << 8 | frame [4], result == 0) ;
+  _genieFormFlush () ;
+
+  return result ;
+}
+
+static int _genieWriteObj (int object, int index, unsigned int data)
+{
+  unsigned char frame [6] ;
+
+  frame [0] = GENIE_WRITE_OBJ ;
+  frame [1] = object ;
+  frame [2] = index ;
+  frame [3] = (data >> 8) & 0xFF ;
+  frame [4] = (data >> 0) & 0xFF ;
+  frame [5] = frame [0] ^ frame [1] ^ frame [2] ^ frame [3] ^ frame [4] ;
+
+  return _genieWriteObjFrame (frame) ;
+}
+
+int genieWriteObj (int object, int index, unsigned int data)
+{
+  int result ;
+
+  if (genieFormHold (object, index, data))		// Not showing, send later
+    return 0 ;
+
+  if (!genieAsyncIdle ())
+    return genieWriteObjQueued (object, index, data) ;
+
+  genieLock () ;
+    result = _genieWriteObj (object, index, data) ;
+  genieUnlock () ;
+
+  return result ;
+}
+
+
+/*
+ * genieWriteObjFrame:
+ *	As genieWriteObj, for a WRITE_OBJ frame the caller has already
+ *	made, checksum and all - geniePi.hpp works them out when
+ *	compiling. It's trusted, and goes out as it is.
+ *********************************************************************************
+ */
+int genieWriteObjFrame (const unsigned char *frame)
+{
+  unsigned int data = frame [3] << 8 | frame [4] ;
+  int result ;
+
+  if (genieFormHold (frame [1], frame [2], data))
+    return 0 ;
+
+  if (!genieAsyncIdle ())
+    return genieWriteObjQueued (frame [1], frame [2], data) ;
+
+  genieLock () ;
+    result = _genieWriteObjFrame (frame) ;
+  genieUnlock () ;
+
+  return result ;
+}
+
+/*
+ * genieWriteIntLedDigits32:
+ *	Write 32-bit values to consecutive internal LED digits, starting
+ *	at index. Each value is two WRITE_OBJs, high then low word; all of
+ *	them go out in one transaction so no-one else's writes can land
+ *	between the halves, and the ACKs are waited for together.
+ *	As with genieWriteObj, a value for digits on a form that isn't
+ *	showing is held, both halves, and while async requests are waiting
+ *	each pair joins the end of their queue, the halves together.
+ *	The digits are one byte's worth of indexes, so a run that would go
+ *	past the last of them is refused before anything is sent.
+ *********************************************************************************
+ */
+static int _genieWriteIntLedDigits32 (int index, const uint32_t *values, int count)
+{
+  unsigned char frames [GENIE_WIDE_BATCH * 2 * 6] ;
+  unsigned char *f ;
+  int i, n, len, acked, result = 0 ;
+
+  while (count > 0)
+  {
+    n = (count > GENIE_WIDE_BATCH) ? GENIE_WIDE_BATCH : count ;
+
+    for (i = 0, f = frames ; i < n ; ++i)
+    {
+      if (genieFormHoldDigits (index + i, values [i]))
+	continue ;
+
+      f [0] = GENIE_WRITE_OBJ ;
+      f [1] = GENIE_OBJ_ILED_DIGITS_H ;
+      f [2] = index + i ;
+      f [3] = (values [i] >> 24) & 0xFF ;
+      f [4] = (values [i] >> 16) & 0xFF ;
+      f [5] = f [0] ^ f [1] ^ f [2] ^ f [3] ^ f [4] ;
+
+      f [6]  = GENIE_WRITE_OBJ ;
+      f [7]  = GENIE_OBJ_ILED_DIGITS_L ;
+      f [8]  = index + i ;
+      f [9]  = (values [i] >> 8) & 0xFF ;
+      f [10] = (values [i] >> 0) & 0xFF ;
+      f [11] = f [6] ^ f [7] ^ f [8] ^ f [9] ^ f [10] ;
+      f += 12 ;
+    }
+
+    if ((len = f - frames) > 0)
+    {
+      if (!(acked = (_genieWriteFrames (frames, len, len / 6) == 0)))
+	result = -1 ;
+      for (f = frames ; f < frames + len ; f += 6)
+	genieObjWritten (f [1], f [2], f [3] << 8 | f [4], acked) ;
+      _genieFormFlush () ;
+    }
+
+    index  += n ;
+    values += n ;
+    count  -= n ;
+  }
+
+  return result ;
+}
+
+static int genieWriteIntLedDigitsQueued (int index, const uint32_t *values, int count)
+{
+  unsigned char f [12] ;
+  int i, result = 0 ;
+
+  for (i = 0 ; i < count ; ++i)
+  {
+    if (genieFormHoldDigits (index + i, values [i]))
+      continue ;
+
+    f [0] = GENIE_WRITE_OBJ ;
+    f [1] = GENIE_OBJ_ILED_DIGITS_H ;
+    f [2] = index + i ;
+    f [3] = (values [i] >> 24) & 0xFF ;
+    f [4] = (values [i] >> 16) & 0xFF ;
+    f [5] = f [0] ^ f [1] ^ f [2] ^ f [3] ^ f [4] ;
+
+    f [6]  = GENIE_WRITE_OBJ ;
+    f [7]  = GENIE_OBJ_ILED_DIGITS_L ;
+    f [8]  = index + i ;
+    f [9]  = (values [i] >> 8) & 0xFF ;
+    f [10] = (values [i] >> 0) & 0xFF ;
+    f [11] = f [6] ^ f [7] ^ f [8] ^ f [9] ^ f [10] ;
+
+    if (genieWriteObjsQueued (f, 2) != 0)
+      result = -1 ;
+  }
+
+  return result ;
+}
+
+static int genieWriteIntLedDigits32 (int index, const uint32_t *values, int count)
+{
+  int result ;
+
+  if ((index < 0) || (count < 0) || (index + count > 256))
+    { errno = EINVAL ; return -1 ; }
+
+  if (!genieAsyncIdle ())
+    return genieWriteIntLedDigitsQueued (index, values, count) ;
+
+  genieLock () ;
+    result = _genieWriteIntLedDigits32 (index, values, count) ;
+  genieUnlock () ;
+
+  return result ;
+}
+
+int genieWriteIntLedDigitsLongs (int index, const int32_t *values, int count)
+{
+  return genieWriteIntLedDigits32 (index, (const uint32_t *)values, count) ;
+}
+
+int genieWriteIntLedDigitsFloats (int index, const float *values, int count)
+{
+  union FloatLongFrame frame ;
+  uint32_t words [256] ;
+  int i ;
+
+  if ((index < 0) || (count < 0) || (index + count > 256))
+    { errno = EINVAL ; return -1 ; }
+
+  for (i = 0 ; i < count ; ++i)
+  {
+    frame.floatValue = values [i] ;
+    words [i] = frame.ulongValue ;
+  }
+
+  return genieWriteIntLedDigits32 (index, words, count) ;
+}
+
+
+/*
+ * genieWriteObjBatch:
+ *	Write count ready made WRITE_OBJ frames (6 bytes each, checksums
+ *	included), GENIE_WIDE_BATCH to a transaction, less any held for
+ *	their forms. -1 if any of them is no good or was NAKed.
+ *********************************************************************************
+ */
+static int _genieWriteObjBatch (const unsigned char *frames, int count)
+{
+  unsigned char send [GENIE_WIDE_BATCH * 6] ;
+  const unsigned char *f ;
+  int i, n, len, acked, result = 0 ;
+
+  for (i = 0, f = frames ; i < count ; ++i, f += 6)
+    if ((f [0] != GENIE_WRITE_OBJ) || ((f [0] ^ f [1] ^ f [2] ^ f [3] ^ f [4] ^ f [5]) != 0))
+      return -1 ;
+
+  while (count > 0)
+  {
+    n = (count > GENIE_WIDE_BATCH) ? GENIE_WIDE_BATCH : count ;
+
+    for (i = len = 0, f = frames ; i < n ; ++i, f += 6)	// Leave out what's held
+      if (!genieFormHold (f [1], f [2], f [3] << 8 | f [4]))
+      {
+	memcpy (send + len, f, 6) ;
+	len += 6 ;
+      }
+
+    if (len > 0)
+    {
+      if (!(acked = (_genieWriteFrames (send, len, len / 6) == 0)))
+	result = -1 ;
+      for (f = send ; f < send + len ; f += 6)
+	genieObjWritten (f [1], f [2], f [3] << 8 | f [4], acked) ;
+      _genieFormFlush () ;
+    }
+
+    frames += n * 6 ;
+    count  -= n ;
+  }
+
+  return result ;
+}
+
+int genieWriteObjBatch (const unsigned char *frames, int count)
+{
+  int result ;
+
+  genieLock () ;
+    result = _genieWriteObjBatch (frames, count) ;
+  genieUnlock () ;
+
+  return result ;
+}
+
+int genieWriteShortToIntLedDigits (int index, int16_t data) {
+    return genieWriteObj(GENIE_OBJ_ILED_DIGITS_L, index, data);
+}
+
+int genieWriteFloatToIntLedDigits (int index, float data) {
+    return genieWriteIntLedDigitsFloats (index, &data, 1);
+}
+
+int genieWriteLongToIntLedDigits (int index, int32_t data) {
+    return genieWriteIntLedDigitsLongs (index, &data, 1);
+}
+
+/*
+ * genieWriteContrast:
  *	Alter the display contrast (backlight)
  *********************************************************************************
  */
-static int _genieWriteContrast (int value)
+static int _genieWriteContrast (int value)
+{
+  unsigned char frame [3] ;
+
+  genieExpectAck () ;
+
+  frame [0] = GENIE_WRITE_CONTRAST ;
+  frame [1] = value ;
+  genieSendFrame (frame, 2) ;
+
+  return genieWaitAck (GENIE_LINK_WRITE, 3) ;
+}
+int genieWriteContrast (int value)
+{
+  int result ;
+
+  genieLock () ;
+    result = _genieWriteContrast (value) ;
+  genieUnlock () ;
+
+  return result ;
+}
+
+
+/*
+ * Animation:
+ *	Values that move from one number to another over time. A thread
+ *	works out where everything that's running should be every
+ *	GENIE_ANIM_TICK mS and sends the ones that have changed together,
+ *	in one transaction. Each tick may only use its share of what the
+ *	link can carry (measured as we go); if there are more changes
+ *	than that, animations take turns and the others skip a step. As
+ *	positions come from the clock rather than a count of steps, being
+ *	short of bandwidth makes motion coarser, never late. Steps that
+ *	aren't ACKed are sent again next time; those for objects on a form
+ *	that isn't showing are held, as genieWriteObj holds them, and take
+ *	none of the link.
+ *********************************************************************************
+ */
+
+#define	GENIE_MAX_ANIMATIONS	64
+#define	GENIE_ANIM_TICK		20		// mS: 50 frames a second
+#define	GENIE_ANIM_SHARE	0.8		// Of the link, leaving room for others
+#define	GENIE_ANIM_CONTRAST	-1		// Object number for the backlight
+
+struct genieAnimation
+{
+  int                inUse ;
+  int                object, index ;
+  int                from, to ;
+  int                easing ;
+  unsigned long long start, duration ;	// uS
+  int                sent ;		// Value last sent, or -1
+} ;
+
+static struct genieAnimation genieAnims [GENIE_MAX_ANIMATIONS] ;
+static struct genieAnimStats genieAnimStats ;
+static int genieAnimNext = 0 ;		// Who goes first when rationing
+static int genieAnimRunning = FALSE ;
+static pthread_mutex_t genieAnimMutex = PTHREAD_MUTEX_INITIALIZER ;
+static pthread_cond_t  genieAnimCond  = PTHREAD_COND_INITIALIZER ;
+
+
+/*
+ * genieEase:
+ *	Map t, from 0 to 1, onto the easing curve
+ *********************************************************************************
+ */
+static double genieEase (int easing, double t)
+{
+  switch (easing)
+  {
+    case GENIE_EASE_IN:		return t * t ;
+    case GENIE_EASE_OUT:	return t * (2.0 - t) ;
+    case GENIE_EASE_IN_OUT:	return (t < 0.5) ? 2.0 * t * t : -1.0 + (4.0 - 2.0 * t) * t ;
+    case GENIE_EASE_SMOOTH:	return t * t * (3.0 - 2.0 * t) ;
+    default:			return t ;
+  }
+}
+
+
+/*
+ * genieAnimThread:
+ *	Step everything that's running, within the link's budget
+ *********************************************************************************
+ */
+static void *genieAnimThread (void *data)
+{
+  unsigned char frames [GENIE_MAX_ANIMATIONS * 6], *f ;
+  int who [GENIE_MAX_ANIMATIONS], values [GENIE_MAX_ANIMATIONS] ;
+  unsigned long long now, next ;
+  struct genieAnimation *a ;
+  struct genieLinkView link ;
+  int i, j, n, len, budget, running, value, done ;
+  double t ;
+
+  pthread_setname_np (pthread_self (), "genieAnimate") ;
+
+  next = genieMicros () ;
+
+  for (;;)
+  {
+    pthread_mutex_lock (&genieAnimMutex) ;
+
+    for (;;)					// Sleep while there's nothing to do
+    {
+      for (running = i = 0 ; i < GENIE_MAX_ANIMATIONS ; ++i)
+	running += genieAnims [i].inUse ;
+      if (running != 0)
+	break ;
+      genieAnimStats.running = 0 ;
+      pthread_cond_wait (&genieAnimCond, &genieAnimMutex) ;
+      next = genieMicros () ;
+    }
+
+// Where should everything be now, and what's changed?
+
+    genieLinkGet (GENIE_LINK_WRITE, &link) ;
+    now    = genieMicros () ;
+    budget = (int)((GENIE_ANIM_TICK * 1000.0 - link.rtt) *
+		link.bps / 1000000.0 * GENIE_ANIM_SHARE) / 7 ;			// Frame + ACK
+    if (budget < 1)
+      budget = 1 ;
+
+    for (n = len = running = j = 0 ; j < GENIE_MAX_ANIMATIONS ; ++j)
+    {
+      i = (genieAnimNext + j) % GENIE_MAX_ANIMATIONS ;
+      a = &genieAnims [i] ;
+      if (!a->inUse)
+	continue ;
+      ++running ;
+
+      t = (now >= a->start + a->duration) ? 1.0 : (double)(now - a->start) / a->duration ;
+      value = a->from + (int)((a->to - a->from) * genieEase (a->easing, t) + ((a->to >= a->from) ? 0.5 : -0.5)) ;
+      if (value == a->sent)
+      {
+	if (t >= 1.0)
+	  a->inUse = FALSE ;
+	continue ;
+      }
+
+      if (n == budget)				// Out of room: next time
+      {
+	++genieAnimStats.stepsDropped ;
+	continue ;
+      }
+
+      if ((a->object != GENIE_ANIM_CONTRAST) && genieFormHold (a->object, a->index, value))
+      {
+	a->sent = value ;			// Goes when its form's shown
+	continue ;
+      }
+
+      f = frames + len ;
+      if (a->object == GENIE_ANIM_CONTRAST)
+      {
+	f [0] = GENIE_WRITE_CONTRAST ;
+	f [1] = value ;
+	f [2] = f [0] ^ f [1] ;
+	len += 3 ;
+      }
+      else
+      {
+	f [0] = GENIE_WRITE_OBJ ;
+	f [1] = a->object ;
+	f [2] = a->index ;
+	f [3] = (value >> 8) & 0xFF ;
+	f [4] = (value >> 0) & 0xFF ;
+	f [5] = f [0] ^ f [1] ^ f [2] ^ f [3] ^ f [4] ;
+	len += 6 ;
+      }
+      who    [n] = i ;
+      values [n] = value ;
+      ++n ;
+    }
+
+    if (n == budget)				// Carry on from here next time
+      genieAnimNext = (who [n - 1] + 1) % GENIE_MAX_ANIMATIONS ;
+    genieAnimStats.running = running ;
+
+    pthread_mutex_unlock (&genieAnimMutex) ;
+
+// Out they all go
+
+    if (n > 0)
+    {
+      genieLock () ;
+	done = (_genieWriteFrames (frames, len, n) == 0) ;
+      genieUnlock () ;
+
+      pthread_mutex_lock (&genieAnimMutex) ;
+	if (done)				// Else they're all tried again next time
+	{
+	  for (i = 0 ; i < n ; ++i)
+	  {
+	    a = &genieAnims [who [i]] ;
+	    a->sent = values [i] ;
+	    if (a->object != GENIE_ANIM_CONTRAST)
+	      genieMirrorUpdate (a->object, a->index, values [i] & 0xFFFF, genieNanos ()) ;
+	  }
+	  genieAnimStats.stepsSent += n ;
+	}
+	genieAnimStats.bytesPerSec = (unsigned int)link.bps ;
+      pthread_mutex_unlock (&genieAnimMutex) ;
+    }
+
+// Next tick, skipping any we've already missed
+
+    next += GENIE_ANIM_TICK * 1000 ;
+    now   = genieMicros () ;
+    if (next <= now)
+      next = now + GENIE_ANIM_TICK * 1000 - (now - next) % (GENIE_ANIM_TICK * 1000) ;
+    delayMicroseconds (next - now) ;
+  }
+
+  return (void *)NULL ;
+}
+
+
+/*
+ * genieAnimStart:
+ *	Set an animation going, in place of any already running on the
+ *	same object. Returns its id, or -1.
+ *********************************************************************************
+ */
+static int genieAnimStart (int object, int index, int from, int to, int duration, int easing)
+{
+  pthread_t myThread ;
+  struct genieAnimation *a ;
+  int id, spare = -1 ;
+
+  if (duration < 0)
+    return -1 ;
+
+  pthread_mutex_lock (&genieAnimMutex) ;
+
+  if (!genieAnimRunning)
+  {
+    if (pthread_create (&myThread, NULL, genieAnimThread, NULL) != 0)
+    {
+      pthread_mutex_unlock (&genieAnimMutex) ;
+      return -1 ;
+    }
+    pthread_detach (myThread) ;
+    genieAnimRunning = TRUE ;
+  }
+
+  for (id = 0 ; id < GENIE_MAX_ANIMATIONS ; ++id)
+  {
+    a = &genieAnims [id] ;
+    if (a->inUse && (a->object == object) && (a->index == index))
+      break ;
+    if (!a->inUse && (spare == -1))
+      spare = id ;
+  }
+
+  if (id == GENIE_MAX_ANIMATIONS)
+  {
+    if ((id = spare) == -1)
+    {
+      pthread_mutex_unlock (&genieAnimMutex) ;
+      return -1 ;
+    }
+    genieAnims [id].sent = -1 ;
+  }
+
+  a = &genieAnims [id] ;
+  a->object   = object ;
+  a->index    = index ;
+  a->from     = from ;
+  a->to       = to ;
+  a->easing   = easing ;
+  a->start    = genieMicros () ;
+  a->duration = (unsigned long long)duration * 1000 ;
+  a->inUse    = TRUE ;
+
+  pthread_cond_broadcast (&genieAnimCond) ;
+  pthread_mutex_unlock (&genieAnimMutex) ;
+
+  return id ;
+}
+
+
+/*
+ * genieAnimate, genieAnimateContrast:
+ *	Move an object's value, or the backlight, from one value to
+ *	another over duration mS, following an easing curve (GENIE_EASE_*)
+ *********************************************************************************
+ */
+int genieAnimate (int object, int index, int from, int to, int duration, int easing)
+{
+  if ((object < 0) || (object > 255) || (index < 0) || (index > 255))
+    return -1 ;
+
+  return genieAnimStart (object, index, from & 0xFFFF, to & 0xFFFF, duration, easing) ;
+}
+
+int genieAnimateContrast (int from, int to, int duration, int easing)
+{
+  return genieAnimStart (GENIE_ANIM_CONTRAST, 0, from & 0xFF, to & 0xFF, duration, easing) ;
+}
+
+
+/*
+ * genieAnimateStop:
+ *	Stop an animation where it is
+ *********************************************************************************
+ */
+int genieAnimateStop (int id)
+{
+  if ((id < 0) || (id >= GENIE_MAX_ANIMATIONS))
+    return -1 ;
+
+  pthread_mutex_lock (&genieAnimMutex) ;
+    genieAnims [id].inUse = FALSE ;
+  pthread_mutex_unlock (&genieAnimMutex) ;
+
+  return 0 ;
+}
+
+
+/*
+ * genieGetAnimStats:
+ *	How the animations are getting on
+ *********************************************************************************
+ */
+void genieGetAnimStats (struct genieAnimStats *stats)
+{
+  pthread_mutex_lock (&genieAnimMutex) ;
+    *stats = genieAnimStats ;
+  pthread_mutex_unlock (&genieAnimMutex) ;
+}
+
+
+/*
+ * Number formatting:
+ *	Turn numbers into text for the string and label writers, straight
+ *	into the frame that's going out. No allocation, nothing from the
+ *	locale, and never more than the room it's given.
+ *********************************************************************************
+ */
+
+static const char genieDigitPairs [] =
+  "00010203040506070809"
+  "10111213141516171819"
+  "20212223242526272829"
+  "30313233343536373839"
+  "40414243444546474849"
+  "50515253545556575859"
+  "60616263646566676869"
+  "70717273747576777879"
+  "80818283848586878889"
+  "90919293949596979899" ;
+
+static const char genieDigits [] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ" ;
+
+static const double genieTens [] =
+{
+  1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,
+  1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18
+} ;
+
+static const unsigned long long genieTensInt [] =
+{
+  1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL,
+  10000000ULL, 100000000ULL, 1000000000ULL, 10000000000ULL,
+  100000000000ULL, 1000000000000ULL, 10000000000000ULL,
+  100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL,
+  100000000000000000ULL, 1000000000000000000ULL
+} ;
+
+
+/*
+ * genieRound:
+ *	Round a scaled up value to the nearest integer. Returns FALSE when
+ *	it's too close to a half to tell from the double alone; printf
+ *	works from the exact binary value, so let it decide those.
+ *********************************************************************************
+ */
+static int genieRound (double t, unsigned long long *result)
+{
+  unsigned long long whole = (unsigned long long)t ;
+  double frac = t - (double)whole ;
+
+  if ((frac > 0.5 - 1e-6) && (frac < 0.5 + 1e-6))
+    return FALSE ;
+
+  *result = whole + (frac > 0.5) ;
+  return TRUE ;
+}
+
+
+/*
+ * genieFormatUnsigned:
+ *	Put the digits of n, in the given base (2 to 36), into out. Base
+ *	10 goes two digits at a time, powers of two by shifting.
+ *	Returns the number of digits; out needs room for 64 of them.
+ *********************************************************************************
+ */
+static int genieFormatUnsigned (char *out, unsigned long long n, int base)
+{
+  char buf [64] ;
+  char *p = &buf [sizeof (buf)] ;
+  int shift, mask, len ;
+
+  if (base == 10)
+  {
+    while (n >= 100)
+    {
+      unsigned int pair = (unsigned int)(n % 100) * 2 ;
+      n /= 100 ;
+      *--p = genieDigitPairs [pair + 1] ;
+      *--p = genieDigitPairs [pair] ;
+    }
+    if (n >= 10)
+    {
+      *--p = genieDigitPairs [n * 2 + 1] ;
+      *--p = genieDigitPairs [n * 2] ;
+    }
+    else
+      *--p = '0' + (char)n ;
+  }
+  else if ((base & (base - 1)) == 0)
+  {
+    for (shift = 0 ; (1 << shift) < base ; ++shift)
+      ;
+    mask = base - 1 ;
+    do
+    {
+      *--p = genieDigits [n & mask] ;
+      n >>= shift ;
+    } while (n) ;
+  }
+  else
+  {
+    do
+    {
+      *--p = genieDigits [n % base] ;
+      n /= base ;
+    } while (n) ;
+  }
+
+  len = &buf [sizeof (buf)] - p ;
+  memcpy (out, p, len) ;
+
+  return len ;
+}
+
+
+/*
+ * genieFormatLong:
+ *	Signed version of the above. Copes with LONG_MIN.
+ *********************************************************************************
+ */
+static int genieFormatLong (char *out, long n, int base)
+{
+  if (n < 0)
+  {
+    *out = '-' ;
+    return 1 + genieFormatUnsigned (out + 1, 0ULL - (unsigned long long)n, base) ;
+  }
+
+  return genieFormatUnsigned (out, (unsigned long long)n, base) ;
+}
+
+
+/*
+ * genieFormatFixed:
+ *	A float with a fixed number (0-9) of decimal places, as %.*f
+ *	would, but done in integers. Huge numbers (and NaN) go to
+ *	snprintf. Returns the length, never more than room.
+ *********************************************************************************
+ */
+static int genieFormatFixed (char *out, int room, double x, int decimals)
+{
+  char buf [GENIE_MAX_TEXT + 64] ;
+  unsigned long long scaled, whole, frac ;
+  double ax = (x < 0) ? -x : x ;
+  int len = 0, i ;
+
+  if ((decimals < 0) || (decimals > 9) || !(ax * genieTens [decimals] < 1.8e19)	// NaN fails too
+	|| !genieRound (ax * genieTens [decimals], &scaled))
+  {
+    len = snprintf (buf, sizeof (buf), "%.*f", decimals, x) ;
+    if (len > room)
+      len = room ;
+    memcpy (out, buf, len) ;
+    return len ;
+  }
+
+  if (room < 22 + decimals)		// Worst case
+    return 0 ;
+
+  whole  = scaled / genieTensInt [decimals] ;
+  frac   = scaled % genieTensInt [decimals] ;
+
+  if (x < 0)
+    out [len++] = '-' ;
+  len += genieFormatUnsigned (out + len, whole, 10) ;
+
+  if (decimals > 0)
+  {
+    out [len++] = '.' ;
+    for (i = decimals - 1 ; i >= 0 ; --i)
+    {
+      out [len + i] = '0' + (char)(frac % 10) ;
+      frac /= 10 ;
+    }
+    len += decimals ;
+  }
+
+  return len ;
+}
+
+
+/*
+ * genieFormatSignificant:
+ *	A float to the given number of significant digits, trailing zeros
+ *	dropped: what gcvt() (and %g) give. The usual range is done in
+ *	integers; very big or small numbers go to snprintf for exponent
+ *	form. Returns the length, never more than room.
+ *********************************************************************************
+ */
+static int genieFormatSignificant (char *out, int room, double x, int precision)
+{
+  char buf [64] ;
+  unsigned long long scaled, whole, frac ;
+  double ax = (x < 0) ? -x : x ;
+  int exp, decimals, len = 0, i ;
+
+  if (precision <= 0)
+    precision = 1 ;
+
+  if (ax == 0.0)
+  {
+    out [0] = '0' ;
+    return 1 ;
+  }
+
+  if ((precision <= 15) && (ax >= 1e-4) && (ax < 1e15))
+  {
+    for (exp = -4 ; (exp < 14) && (ax >= ((exp >= 0) ? genieTens [exp + 1] : 1.0 / genieTens [-exp - 1])) ; ++exp)
+      ;
+
+    if (exp < precision)
+    {
+      decimals = precision - 1 - exp ;
+
+// Rounding can carry into another digit (9.9996 -> 10.00), which %g
+//	would show in exponent form if there's no room for it.
+
+      if (genieRound (ax * genieTens [decimals], &scaled) && ((decimals > 0) || (scaled < genieTensInt [precision])))
+      {
+	whole = scaled / genieTensInt [decimals] ;
+	frac  = scaled % genieTensInt [decimals] ;
+
+	while ((decimals > 0) && (frac % 10 == 0))
+	{
+	  frac /= 10 ;
+	  --decimals ;
+	}
+
+	if (x < 0)
+	  buf [len++] = '-' ;
+	len += genieFormatUnsigned (buf + len, whole, 10) ;
+	if (decimals > 0)
+	{
+	  buf [len++] = '.' ;
+	  for (i = decimals - 1 ; i >= 0 ; --i)
+	  {
+	    buf [len + i] = '0' + (char)(frac % 10) ;
+	    frac /= 10 ;
+	  }
+	  len += decimals ;
+	}
+	if (len > room)
+	  len = room ;
+	memcpy (out, buf, len) ;
+	return len ;
+      }
+    }
+  }
+
+  len = snprintf (buf, sizeof (buf), "%.*g", precision, x) ;
+  if (len > room)
+    len = room ;
+  memcpy (out, buf, len) ;
+
+  return len ;
+}
+
+
+/*
+ * genieFormatCompile:
+ *	Parse a printf style template once, for use with genieFormat()
+ *	for every value written to that field after. The template is
+ *	text, one conversion, and more text:
+ *		%[-|0][width][.precision](d|x|o|b|f|g)
+ *	x, o and b are hex, octal and binary; f is a fixed number of
+ *	decimal places and g significant digits (as genieWriteStrFloat).
+ *	%% is a literal %. Returns 0, or -1 if the template is no good.
+ *********************************************************************************
+ */
+int genieFormatCompile (struct genieFormat *fmt, const char *spec)
+{
+  const char *p = spec ;
+  char *text ;
+  int  *textLen, max, conversions = 0 ;
+
+  memset (fmt, 0, sizeof (struct genieFormat)) ;
+  fmt->pad = ' ' ;
+
+  text    = fmt->prefix ;
+  textLen = &fmt->prefixLen ;
+  max     = sizeof (fmt->prefix) ;
+
+  while (*p)
+  {
+    if ((p [0] == '%') && (p [1] == '%'))
+      p += 1 ;
+    else if (*p == '%')
+    {
+      if (++conversions > 1)
+	return -1 ;
+      ++p ;
+
+      if (*p == '-')
+	{ fmt->leftAlign = TRUE ; ++p ; }
+      else if (*p == '0')
+	{ fmt->pad = '0' ; ++p ; }
+
+      for ( ; (*p >= '0') && (*p <= '9') ; ++p)
+	fmt->width = fmt->width * 10 + (*p - '0') ;
+
+      fmt->precision = -1 ;
+      if (*p == '.')
+	for (fmt->precision = 0, ++p ; (*p >= '0') && (*p <= '9') ; ++p)
+	  fmt->precision = fmt->precision * 10 + (*p - '0') ;
+
+      switch (*p)
+      {
+	case 'd':	fmt->base = 10 ; break ;
+	case 'x':
+	case 'X':	fmt->base = 16 ; break ;
+	case 'o':	fmt->base =  8 ; break ;
+	case 'b':	fmt->base =  2 ; break ;
+	case 'f':	fmt->base =  0 ; if (fmt->precision < 0) fmt->precision = 2 ; break ;
+	case 'g':	fmt->base =  0 ; if (fmt->precision < 0) fmt->precision = 6 ; break ;
+	default:	return -1 ;
+      }
+      if ((fmt->width > GENIE_MAX_TEXT) || (fmt->precision > ((*p == 'f') ? 9 : 15)))
+	return -1 ;
+
+      fmt->conversion = *p++ ;
+      text    = fmt->suffix ;
+      textLen = &fmt->suffixLen ;
+      max     = sizeof (fmt->suffix) ;
+      continue ;
+    }
+
+    if (*textLen >= max)
+      return -1 ;
+    text [(*textLen)++] = *p++ ;
+  }
+
+  return (conversions == 1) ? 0 : -1 ;
+}
+
+
+/*
+ * genieFormat:
+ *	Format a value with a compiled template into out, which has room
+ *	for GENIE_MAX_TEXT characters. Returns the length (not terminated).
+ *********************************************************************************
+ */
+int genieFormat (char *out, const struct genieFormat *fmt, double value)
+{
+  char num [GENIE_MAX_TEXT] ;
+  int len = 0, numLen, padLen, sign ;
+
+  if (fmt->base != 0)
+    numLen = genieFormatLong (num, (value >= (double)LONG_MAX) ? LONG_MAX : (value <= (double)LONG_MIN) ? LONG_MIN : (long)value, fmt->base) ;
+  else if (fmt->conversion == 'f')
+    numLen = genieFormatFixed (num, GENIE_MAX_TEXT - fmt->prefixLen, value, fmt->precision) ;
+  else
+    numLen = genieFormatSignificant (num, GENIE_MAX_TEXT - fmt->prefixLen, value, fmt->precision) ;
+
+  padLen = (fmt->width > numLen) ? fmt->width - numLen : 0 ;
+  if (fmt->prefixLen + padLen + numLen + fmt->suffixLen > GENIE_MAX_TEXT)
+    padLen = 0 ;
+
+  memcpy (out, fmt->prefix, fmt->prefixLen) ;
+  len = fmt->prefixLen ;
+
+  if (fmt->leftAlign)
+  {
+    memcpy (out + len, num, numLen) ;
+    memset (out + len + numLen, ' ', padLen) ;
+  }
+  else if (fmt->pad == '0')
+  {
+    sign = (num [0] == '-') ? 1 : 0 ;
+    memcpy (out + len, num, sign) ;
+    memset (out + len + sign, '0', padLen) ;
+    memcpy (out + len + sign + padLen, num + sign, numLen - sign) ;
+  }
+  else
+  {
+    memset (out + len, ' ', padLen) ;
+    memcpy (out + len + padLen, num, numLen) ;
+  }
+  len += padLen + numLen ;
+
+  if (len + fmt->suffixLen > GENIE_MAX_TEXT)
+    return len ;
+  memcpy (out + len, fmt->suffix, fmt->suffixLen) ;
+
+  return len + fmt->suffixLen ;
+}
+
+
+/*
+ * String cache:
+ *	Remember what was last written (and ACKed) to each string, Unicode
+ *	string and inherent label, and don't send it again if it hasn't
+ *	changed. A hash and length is kept for each, and optionally the
+ *	text itself so that a hash collision can't hide a change.
+ *	Only touched with the link held, apart from genieStringCacheGen.
+ *********************************************************************************
+ */
+
+#define	GENIE_CACHE_TYPES	3		// WRITE_STR, WRITE_STRU, WRITE_INH_LABEL
+
+struct genieCacheEntry
+{
+  unsigned int   gen ;				// Valid if this is genieStringCacheGen
+  unsigned int   hash ;
+  int            bytes ;
+} ;
+
+static int genieStringCacheMode = GENIE_CACHE_OFF ;
+static struct genieCacheEntry genieStringCache [GENIE_CACHE_TYPES][256] ;
+static unsigned char *genieStringCacheText = NULL ;	// [type][index][GENIE_MAX_FRAME]
+static struct genieStringCacheStats genieStringCacheStats ;
+static __thread int genieStringCacheForced = FALSE ;
+
+static int genieCacheType (int cmd)
+{
+  switch (cmd)
+  {
+    case GENIE_WRITE_STR:	return 0 ;
+    case GENIE_WRITE_STRU:	return 1 ;
+    case GENIE_WRITE_INH_LABEL:	return 2 ;
+  }
+  return -1 ;
+}
+
+static unsigned int genieHash (const unsigned char *p, int len)
+{
+  unsigned int hash = 2166136261u ;		// FNV-1a
+
+  while (len--)
+    hash = (hash ^ *p++) * 16777619u ;
+
+  return hash ;
+}
+
+
+/*
+ * genieStringCacheHit:
+ *	TRUE if this exact payload is already on the display. The hash
+ *	is handed back for genieStringCacheStore.
+ *********************************************************************************
+ */
+static int genieStringCacheHit (int cmd, int index, const unsigned char *payload, int bytes, unsigned int *hash)
+{
+  struct genieCacheEntry *e ;
+  int type ;
+
+  if ((genieStringCacheMode == GENIE_CACHE_OFF) || ((type = genieCacheType (cmd)) < 0))
+    return FALSE ;
+
+  *hash = genieHash (payload, bytes) ;
+  ++genieStringCacheStats.writes ;
+
+  if (genieStringCacheForced)
+    return FALSE ;
+
+  e = &genieStringCache [type][index & 0xFF] ;
+  if ((e->gen != genieStringCacheGen) || (e->hash != *hash) || (e->bytes != bytes))
+    return FALSE ;
+  if ((genieStringCacheText != NULL) &&
+	(memcmp (genieStringCacheText + ((type * 256) + (index & 0xFF)) * GENIE_MAX_FRAME, payload, bytes) != 0))
+    return FALSE ;
+
+  ++genieStringCacheStats.suppressed ;
+  genieStringCacheStats.bytesSaved += bytes + 4 ;	// Payload, header and checksum
+
+  return TRUE ;
+}
+
+
+/*
+ * genieStringCacheStore:
+ *	Note what's now on the display after a write, or forget it if
+ *	the display didn't take it.
+ *********************************************************************************
+ */
+static void genieStringCacheStore (int cmd, int index, const unsigned char *payload, int bytes, unsigned int hash, int acked)
+{
+  struct genieCacheEntry *e ;
+  int type ;
+
+  if ((genieStringCacheMode == GENIE_CACHE_OFF) || ((type = genieCacheType (cmd)) < 0))
+    return ;
+
+  e = &genieStringCache [type][index & 0xFF] ;
+
+  if (!acked)
+  {
+    e->gen = 0 ;
+    return ;
+  }
+
+  e->gen   = genieStringCacheGen ;
+  e->hash  = hash ;
+  e->bytes = bytes ;
+  if (genieStringCacheText != NULL)
+    memcpy (genieStringCacheText + ((type * 256) + (index & 0xFF)) * GENIE_MAX_FRAME, payload, bytes) ;
+}
+
+
+/*
+ * genieStringCacheSetup:
+ *	Turn the cache off (GENIE_CACHE_OFF) or on, comparing hashes
+ *	(GENIE_CACHE_HASH) or the full text (GENIE_CACHE_FULL).
+ *********************************************************************************
+ */
+int genieStringCacheSetup (int mode)
+{
+  unsigned char *text = NULL ;
+
+  if ((mode != GENIE_CACHE_OFF) && (mode != GENIE_CACHE_HASH) && (mode != GENIE_CACHE_FULL))
+    return -1 ;
+
+  if ((mode == GENIE_CACHE_FULL) && ((text = malloc (GENIE_CACHE_TYPES * 256 * GENIE_MAX_FRAME)) == NULL))
+    return -1 ;
+
+  genieLock () ;
+    free (genieStringCacheText) ;
+    genieStringCacheText = text ;
+    genieStringCacheMode = mode ;
+    ++genieStringCacheGen ;
+  genieUnlock () ;
+
+  return 0 ;
+}
+
+
+/*
+ * genieStringCacheInvalidate:
+ *	Forget what we know about a string (GENIE_ALL for every index),
+ *	so the next write to it goes out regardless. cmd is one of
+ *	GENIE_WRITE_STR, GENIE_WRITE_STRU or GENIE_WRITE_INH_LABEL, or
+ *	GENIE_ALL for all of them.
+ *********************************************************************************
+ */
+void genieStringCacheInvalidate (int cmd, int index)
+{
+  int type, i ;
+
+  if ((cmd == GENIE_ALL) && (index == GENIE_ALL))
+  {
+    ++genieStringCacheGen ;
+    return ;
+  }
+
+  genieLock () ;
+    for (type = 0 ; type < GENIE_CACHE_TYPES ; ++type)
+    {
+      if ((cmd != GENIE_ALL) && (type != genieCacheType (cmd)))
+	continue ;
+      for (i = 0 ; i < 256 ; ++i)
+	if ((index == GENIE_ALL) || (i == index))
+	  genieStringCache [type][i].gen = 0 ;
+    }
+  genieUnlock () ;
+}
+
+
+/*
+ * genieStringCacheForce:
+ *	While on, string writes from the calling thread always go to the
+ *	display (and still update the cache).
+ *********************************************************************************
+ */
+void genieStringCacheForce (int on)
+{
+  genieStringCacheForced = on ;
+}
+
+
+/*
+ * genieGetStringCacheStats:
+ *	How many writes were looked at, how many didn't need sending, and
+ *	how many bytes that saved.
+ *********************************************************************************
+ */
+void genieGetStringCacheStats (struct genieStringCacheStats *stats)
+{
+  genieLock () ;
+    *stats = genieStringCacheStats ;
+  genieUnlock () ;
+}
+
+
+/*
+ * _genieWriteText:
+ *	Send a text frame (string or inherent label) whose len characters
+ *	are already in place at frame [3], and wait for the ACK. bytes is
+ *	how much payload that is: len, or twice that for Unicode.
+ *********************************************************************************
+ */
+static int _genieWriteTextBytes (int cmd, int index, unsigned char *frame, int len, int bytes, int payloadSum)
+{
+  unsigned int hash = 0 ;
+  int result ;
+
+  if (len > GENIE_MAX_TEXT)
+    return -1 ;
+
+  if (genieStringCacheHit (cmd, index, &frame [3], bytes, &hash))
+    return 0 ;
+
+  genieExpectAck () ;
+
+  frame [0] = cmd ;
+  frame [1] = index ;
+  frame [2] = (unsigned char)len ;
+  if (payloadSum < 0)
+    genieSendFrame (frame, 3 + bytes) ;
+  else
+    genieSendFrameSum (frame, 3 + bytes, payloadSum) ;
+  result = genieWaitAck (GENIE_LINK_STRING, 4 + bytes) ;
+
+  genieStringCacheStore (cmd, index, &frame [3], bytes, hash, result == 0) ;
+
+  return result ;
+}
+
+static int _genieWriteText (int cmd, int index, unsigned char *frame, int len)
+{
+  return _genieWriteTextBytes (cmd, index, frame, len, len, -1) ;
+}
+
+
+/*
+ * _genieWriteNumber, _genieWriteFloat, _genieWriteFormat:
+ *	Numbers as text to a string or inherent label
+ *********************************************************************************
+ */
+static int _genieWriteNumber (int cmd, int index, long n, int base)
+{
+  unsigned char frame [GENIE_MAX_FRAME] ;
+
+  if ((base < 2) || (base > 36))
+    return -1 ;
+
+  return _genieWriteText (cmd, index, frame, genieFormatLong ((char *)&frame [3], n, base)) ;
+}
+
+static int _genieWriteFloat (int cmd, int index, float n, int precision)
+{
+  unsigned char frame [GENIE_MAX_FRAME] ;
+
+  return _genieWriteText (cmd, index, frame,
+	genieFormatSignificant ((char *)&frame [3], GENIE_MAX_TEXT, n, precision)) ;
+}
+
+static int _genieWriteFormat (int cmd, int index, const struct genieFormat *fmt, double value)
+{
+  unsigned char frame [GENIE_MAX_FRAME] ;
+
+  return _genieWriteText (cmd, index, frame, genieFormat ((char *)&frame [3], fmt, value)) ;
+}
+
+
+/*
+ * genieWriteStr:
+ *	Write a string to the display (ASCII, or Unicode)
+ *	There is only one string type object.
+ *********************************************************************************
+ */
+static int _genieWriteStr (int index, char *string)
+{
+  unsigned char frame [GENIE_MAX_FRAME] ;
+  int len = strlen (string) ;
+
+  if (len > GENIE_MAX_TEXT)
+    return -1 ;
+
+  memcpy (&frame [3], string, len) ;
+  return _genieWriteText (GENIE_WRITE_STR, index, frame, len) ;
+}
+
+int genieWriteStr (int index, char *string)
+{
+  int result ;
+
+  genieLock () ;
+    result = _genieWriteStr (index, string) ;
+  genieUnlock () ;
+
+  return result ;
+}
+
+/*
+ * genieWriteStrU:
+ *	Write a string to the display (ASCII, or Unicode)
+ *	There is only one string type object.
+ *********************************************************************************
+ */
+static int _genieWriteStrU (int index, char *string)
+{
+  unsigned char frame [GENIE_MAX_FRAME] ;
+  char *p ;
+  int len = strlen (string) ;
+  int i = 3 ;
+
+  if (len > 255)
+    return -1 ;
+
+  for (p = string ; *p ; ++p)
+  {
+    frame [i++] = ((*p) >> 8) & 0xFF ;
+    frame [i++] = (*p) & 0xFF ;
+  }
+
+  return _genieWriteTextBytes (GENIE_WRITE_STRU, index, frame, len, i - 3, -1) ;
+}
+int genieWriteStrU (int index, char *string)
+{
+  int result ;
+
+  genieLock () ;
+    result = _genieWriteStrU (index, string) ;
+  genieUnlock () ;
+
+  return result ;
+}
+
+/*
+ * genieUtf8ToUcs2:
+ *	Check and convert UTF-8 to the display's 16-bit, big-endian
+ *	characters in one pass, XORing up the checksum of the output as
+ *	we go. Runs of ASCII are done 16 at a time with NEON or SSE2 where
+ *	we have it. Returns the number of characters, or -1 if the text
+ *	isn't valid UTF-8, has characters outside the BMP (the display
+ *	only does 16 bits), or is more than maxChars long.
+ *********************************************************************************
+ */
+static int genieUtf8ToUcs2 (unsigned char *out, int maxChars, const unsigned char *in, int inLen, unsigned int *sum)
+{
+  const unsigned char *end = in + inLen ;
+  unsigned int c, checksum = 0 ;
+  int chars = 0 ;
+
+  while (in < end)
+  {
+#if	defined (GENIE_NEON)
+    if ((end - in >= 16) && (maxChars - chars >= 16))
+    {
+      uint8x16_t  acc = vdupq_n_u8 (0) ;
+      uint8x16x2_t wide ;
+      uint8x8_t   fold ;
+
+      wide.val [0] = vdupq_n_u8 (0) ;
+      while ((end - in >= 16) && (maxChars - chars >= 16))
+      {
+	wide.val [1] = vld1q_u8 (in) ;
+	fold = vorr_u8 (vget_low_u8 (wide.val [1]), vget_high_u8 (wide.val [1])) ;
+	if (vget_lane_u64 (vreinterpret_u64_u8 (fold), 0) & 0x8080808080808080ULL)
+	  break ;
+	vst2q_u8 (out, wide) ;			// 0, c0, 0, c1, ...
+	acc    = veorq_u8 (acc, wide.val [1]) ;
+	in    += 16 ;
+	out   += 32 ;
+	chars += 16 ;
+      }
+      fold = veor_u8 (vget_low_u8 (acc), vget_high_u8 (acc)) ;
+      fold = veor_u8 (fold, vext_u8 (fold, fold, 4)) ;
+      fold = veor_u8 (fold, vext_u8 (fold, fold, 2)) ;
+      fold = veor_u8 (fold, vext_u8 (fold, fold, 1)) ;
+      checksum ^= vget_lane_u8 (fold, 0) ;
+      if (in >= end)
+	break ;
+    }
+#elif	defined (GENIE_SSE2)
+    if ((end - in >= 16) && (maxChars - chars >= 16))
+    {
+      __m128i zero = _mm_setzero_si128 () ;
+      __m128i acc  = zero ;
+      __m128i v ;
+      unsigned char bytes [16] ;
+      int i ;
+
+      while ((end - in >= 16) && (maxChars - chars >= 16))
+      {
+	v = _mm_loadu_si128 ((const __m128i *)in) ;
+	if (_mm_movemask_epi8 (v) != 0)
+	  break ;
+	_mm_storeu_si128 ((__m128i *)out,        _mm_unpacklo_epi8 (zero, v)) ;	// 0, c0, 0, c1, ...
+	_mm_storeu_si128 ((__m128i *)(out + 16), _mm_unpackhi_epi8 (zero, v)) ;
+	acc    = _mm_xor_si128 (acc, v) ;
+	in    += 16 ;
+	out   += 32 ;
+	chars += 16 ;
+      }
+      acc = _mm_xor_si128 (acc, _mm_srli_si128 (acc, 8)) ;
+      _mm_storeu_si128 ((__m128i *)bytes, acc) ;
+      for (i = 0 ; i < 8 ; ++i)
+	checksum ^= bytes [i] ;
+      if (in >= end)
+	break ;
+    }
+#endif
+
+    c = *in++ ;
+
+    if (c >= 0x80)
+    {
+      if ((c >= 0xC2) && (c <= 0xDF))			// 2 bytes
+      {
+	if ((in >= end) || ((in [0] & 0xC0) != 0x80))
+	  return -1 ;
+	c = ((c & 0x1F) << 6) | (in [0] & 0x3F) ;
+	in += 1 ;
+      }
+      else if ((c >= 0xE0) && (c <= 0xEF))		// 3 bytes
+      {
+	if ((end - in < 2) || ((in [0] & 0xC0) != 0x80) || ((in [1] & 0xC0) != 0x80))
+	  return -1 ;
+	c = ((c & 0x0F) << 12) | ((in [0] & 0x3F) << 6) | (in [1] & 0x3F) ;
+	in += 2 ;
+	if ((c < 0x800) || ((c >= 0xD800) && (c <= 0xDFFF)))	// Overlong, or a surrogate
+	  return -1 ;
+      }
+      else					// 4 bytes (beyond 16 bits) or junk
+	return -1 ;
+    }
+
+    if (chars++ >= maxChars)
+      return -1 ;
+
+    *out++ = c >> 8 ;
+    *out++ = c & 0xFF ;
+    checksum ^= (c >> 8) ^ (c & 0xFF) ;
+  }
+
+  *sum = checksum ;
+  return chars ;
+}
+
+
+/*
+ * genieWriteStrUtf8:
+ *	Write UTF-8 text to a Unicode string on the display
+ *********************************************************************************
+ */
+static int _genieWriteStrUtf8 (int index, const char *string)
+{
+  unsigned char frame [GENIE_MAX_FRAME] ;
+  unsigned int checksum ;
+  int chars ;
+
+  if ((chars = genieUtf8ToUcs2 (&frame [3], GENIE_MAX_TEXT, (const unsigned char *)string, strlen (string), &checksum)) < 0)
+    return -1 ;
+
+  return _genieWriteTextBytes (GENIE_WRITE_STRU, index, frame, chars, chars * 2, checksum) ;
+}
+int genieWriteStrUtf8 (int index, const char *string)
+{
+  int result ;
+
+  genieLock () ;
+    result = _genieWriteStrUtf8 (index, string) ;
+  genieUnlock () ;
+
+  return result ;
+}
+
+/*
+ * genieWriteStrDec:
+ *	Write a number to the display (ASCII)
+ *	There is only one string type object.
+ *********************************************************************************
+ */
+int genieWriteStrHex (int index, long n)
+{
+  int result ;
+  genieLock () ;
+    result = _genieWriteNumber (GENIE_WRITE_STR, index, n, 16);
+  genieUnlock () ;
+  return result ;
+}
+int genieWriteStrOct (int index, long n)
+{
+  int result ;
+  genieLock () ;
+    result = _genieWriteNumber (GENIE_WRITE_STR, index, n, 8);
+  genieUnlock () ;
+  return result ;
+}
+int genieWriteStrBin (int index, long n)
+{
+  int result ;
+  genieLock () ;
+    result = _genieWriteNumber (GENIE_WRITE_STR, index, n, 2);
+  genieUnlock () ;
+  return result ;
+}
+int genieWriteStrBase (int index, long n, int base)
+{
+  int result ;
+  genieLock () ;
+    result = _genieWriteNumber (GENIE_WRITE_STR, index, n, base);
+  genieUnlock () ;
+  return result ;
+}
+int genieWriteStrDec (int index, long n)
+{
+
+  int result ;
+  genieLock () ;
+    result = _genieWriteNumber (GENIE_WRITE_STR, index, n, 10);
+  genieUnlock () ;
+  return result ;
+}
+
+/*
+ * genieWriteStrFloat:
+ *	Write a float string to the display, to precision significant
+ *	digits.
+ *********************************************************************************
+ */
+int genieWriteStrFloat (int index, float n, int precision)
+{  
+  int result ;
+  genieLock () ;
+     result = _genieWriteFloat (GENIE_WRITE_STR, index, n, precision);
+  genieUnlock () ;
+  return result ;
+}
+
+/*
+ * genieWriteStrFormat:
+ *	Write a value to the display using a template compiled by
+ *	genieFormatCompile.
+ *********************************************************************************
+ */
+int genieWriteStrFormat (int index, const struct genieFormat *fmt, double value)
+{
+  int result ;
+  genieLock () ;
+     result = _genieWriteFormat (GENIE_WRITE_STR, index, fmt, value);
+  genieUnlock () ;
+  return result ;
+}
+
+int genieWriteInhLabelDefault (int index) {
+  return genieWriteObj(GENIE_OBJ_ILABELB, index, -1);
+}
+
+/*
+ * genieWriteInhLabel:
+ *	Write a string to a inherent label on the display
+ *********************************************************************************
+ */
+static int _genieWriteInhLabel (int index, char *string)
 {
-  unsigned int checksum ;
+  unsigned char frame [GENIE_MAX_FRAME] ;
+  int len = strlen (string) ;
 
-  genieAck = genieNak = FALSE ;
+  if (len > GENIE_MAX_TEXT)
+    return -1 ;
 
-  geniePutchar (GENIE_WRITE_CONTRAST) ; checksum  = GENIE_WRITE_CONTRAST ;
-  geniePutchar (value) ;                checksum ^= value ;
-  geniePutchar (checksum) ;
+  memcpy (&frame [3], string, len) ;
+  return _genieWriteText (GENIE_WRITE_INH_LABEL, index, frame, len) ;
+}
 
-// TODO: Really ought to timeout here, but if the display doesn't
-//	respond, then it's probably game over anyway.
+int genieWriteInhLabel (int index, char *string)
+{
+  int result ;
 
-  while ((genieAck == FALSE) && (genieNak == FALSE))
-    delay (1) ;
+  genieLock () ;
+    result = _genieWriteInhLabel (index, string) ;
+  genieUnlock () ;
 
-  return 0 ;
+  return result ;
 }
-int genieWriteContrast (int value)
+
+/*
+ * genieWriteInhLabelDec:
+ *	Write a number to a inherent label on the display (ASCII)
+ *********************************************************************************
+ */
+int genieWriteInhLabelHex (int index, long n)
+{
+  int result ;
+  genieLock () ;
+    result = _genieWriteNumber (GENIE_WRITE_INH_LABEL, index, n, 16);
+  genieUnlock () ;
+  return result ;
+}
+int genieWriteInhLabelOct (int index, long n)
+{
+  int result ;
+  genieLock () ;
+    result = _genieWriteNumber (GENIE_WRITE_INH_LABEL, index, n, 8);
+  genieUnlock () ;
+  return result ;
+}
+int genieWriteInhLabelBin (int index, long n)
+{
+  int result ;
+  genieLock () ;
+    result = _genieWriteNumber (GENIE_WRITE_INH_LABEL, index, n, 2);
+  genieUnlock () ;
+  return result ;
+}
+int genieWriteInhLabelBase (int index, long n, int base)
 {
   int result ;
+  genieLock () ;
+    result = _genieWriteNumber (GENIE_WRITE_INH_LABEL, index, n, base);
+  genieUnlock () ;
+  return result ;
+}
+int genieWriteInhLabelDec (int index, long n)
+{
 
-  pthread_mutex_lock   (&genieMutex) ;
-    result = _genieWriteContrast (value) ;
-  pthread_mutex_unlock (&genieMutex) ;
+  int result ;
+  genieLock () ;
+    result = _genieWriteNumber (GENIE_WRITE_INH_LABEL, index, n, 10);
+  genieUnlock () ;
+  return result ;
+}
 
+/*
+ * genieWriteInhLabelFloat:
+ *	Write a float string to a inherent label, to precision
+ *	significant digits.
+ *********************************************************************************
+ */
+int genieWriteInhLabelFloat (int index, float n, int precision)
+{  
+  int result ;
+  genieLock () ;
+     result = _genieWriteFloat (GENIE_WRITE_INH_LABEL, index, n, precision);
+  genieUnlock () ;
   return result ;
 }
 
 /*
- * genieWriteStr:
- *	Write a string to the display (ASCII, or Unicode)
- *	There is only one string type object.
+ * genieWriteInhLabelFormat:
+ *	Write a value to a inherent label using a template compiled by
+ *	genieFormatCompile.
  *********************************************************************************
  */
-static int _genieWriteStr (int index, char *string)
+int genieWriteInhLabelFormat (int index, const struct genieFormat *fmt, double value)
 {
-  char *p ;
-  unsigned int checksum ;
-  int len = strlen (string) ;
+  int result ;
+  genieLock () ;
+     result = _genieWriteFormat (GENIE_WRITE_INH_LABEL, index, fmt, value);
+  genieUnlock () ;
+  return result ;
+}
 
-  if (len > 255)
+/*
+ * genieWriteMagicBytes:
+ *	Write a byte array to the display.
+ *	There is only one byte per index in array.
+ *********************************************************************************
+ */
+static int  _genieWriteMagicBytes	(int magic_index, unsigned int *byteArray)
+{
+	unsigned char frame [GENIE_MAX_FRAME] ;
+	unsigned int *p ;
+	int len = 0 ;
+
+	// The array is zero terminated, and that's what we send
+
+	for (p = byteArray ; *p ; ++p)
+		if (++len > 255)
+			return -1 ;
+
+	genieExpectAck () ;
+
+	frame [0] = GENIE_MAGIC_BYTES ;
+	frame [1] = magic_index ;
+	frame [2] = (unsigned char)len ;
+	for (p = byteArray ; *p ; ++p)
+		frame [3 + (p - byteArray)] = (*p) & 0xFF ;
+	genieSendFrame (frame, 3 + len) ;
+
+	return genieWaitAck (GENIE_LINK_STRING, 4 + len) ;
+}
+int  genieWriteMagicBytes	(int magic_index,unsigned int *byteArray)
+{
+  int result ;
+
+  genieLock () ;
+    result = _genieWriteMagicBytes (magic_index, byteArray) ;
+  genieUnlock () ;
+
+  return result ;
+}
+
+/*
+ * genieWriteDoubleBytes:
+ *	Write a double byte array to the display.
+ *	There are two bytes per index in array.
+ *********************************************************************************
+ */
+static int  _genieWriteDoubleBytes	(int magic_index,unsigned int *doubleByteArray)
+{
+	unsigned char frame [GENIE_MAX_FRAME] ;
+	unsigned int *p ;
+	int len = 0, i = 3 ;
+
+	// The array is zero terminated, and that's what we send
+
+	for (p = doubleByteArray ; *p ; ++p)
+		if (++len > 255)
+			return -1 ;
+
+	genieExpectAck () ;
+
+	frame [0] = GENIE_DOUBLE_BYTES ;
+	frame [1] = magic_index ;
+	frame [2] = (unsigned char)len ;
+	for (p = doubleByteArray ; *p ; ++p)
+	{
+		frame [i++] = ((*p) >> 8) & 0xFF ;
+		frame [i++] = (*p) & 0xFF ;
+	}
+	genieSendFrame (frame, i) ;
+
+	return genieWaitAck (GENIE_LINK_STRING, i + 1) ;
+}
+int  genieWriteDoubleBytes	(int magic_index,unsigned int *doubleByteArray)
+{
+  int result ;
+
+  genieLock () ;
+    result = _genieWriteDoubleBytes (magic_index, doubleByteArray) ;
+  genieUnlock () ;
+
+  return result ;
+}
+
+
+/*
+ * genieWriteFrame:
+ *	Send a complete, ready made frame (checksum included) to the
+ *	display and wait for it to be acknowledged. Returns 0 on an ACK
+ *	and -1 on a NAK or if the frame is no good. An object write is
+ *	treated just as genieWriteObj would treat it.
+ *	Used by genied to pass frames from its clients through, and by
+ *	geniePi.hpp.
+ *********************************************************************************
+ */
+static int _genieWriteFrame (const unsigned char *frame, int len)
+{
+  unsigned int checksum = 0 ;
+  int i, write, result ;
+
+  if ((len < 2) || (len > GENIE_MAX_FRAME))
     return -1 ;
 
-  genieAck = genieNak = FALSE ;
+  for (i = 0 ; i < len ; ++i)
+    checksum ^= frame [i] ;
+  if (checksum != 0)
+    return -1 ;
 
-  geniePutchar (GENIE_WRITE_STR) ;    checksum  = GENIE_WRITE_STR ;
-  geniePutchar (index) ;              checksum ^= index ;
-  geniePutchar ((unsigned char)len) ; checksum ^= len ;
-  for (p = string ; *p ; ++p)
+  write = (frame [0] == GENIE_WRITE_OBJ) && (len == 6) ;
+  if (write && genieFormHold (frame [1], frame [2], frame [3] << 8 | frame [4]))
+    return 0 ;
+
+  genieExpectAck () ;
+
+  genieSend (frame, len) ;
+  result = genieWaitAck (GENIE_LINK_WRITE, len) ;
+
+  if (write)
   {
-    geniePutchar (*p) ;
-    checksum ^= *p ;
+    genieObjWritten (frame [1], frame [2], frame [3] << 8 | frame [4], result == 0) ;
+    _genieFormFlush () ;
   }
-  geniePutchar (checksum) ;
 
-// TODO: Really ought to timeout here, but if the display doesn't
-//	respond, then it's probably game over anyway.
+  return result ;
+}
+int genieWriteFrame (const unsigned char *frame, int len)
+{
+  int result ;
 
-  while ((genieAck == FALSE) && (genieNak == FALSE))
-    delay (1) ;
+  genieLock () ;
+    result = _genieWriteFrame (frame, len) ;
+  genieUnlock () ;
 
-  return 0 ;
+  return result ;
 }
 
-int genieWriteStr (int index, char *string)
+
+/*
+ * genieEventSubscribe:
+ *	When connected to genied, choose which events we get sent. New
+ *	connections get everything; GENIE_ALL is a wildcard for either
+ *	the object or the index. The display itself will just NAK these.
+ *********************************************************************************
+ */
+static int _genieEventFilter (int cmd, int object, int index)
+{
+  unsigned char frame [5] ;
+
+  genieExpectAck () ;
+
+  frame [0] = cmd ;
+  frame [1] = (object == GENIE_ALL) ? 0 : object ;
+  frame [2] = (index  == GENIE_ALL) ? 0 : index ;
+  frame [3] = ((object == GENIE_ALL) ? GENIED_ANY_OBJECT : 0) | ((index == GENIE_ALL) ? GENIED_ANY_INDEX : 0) ;
+  genieSendFrame (frame, 4) ;
+
+  return genieWaitAck (GENIE_LINK_WRITE, 5) ;
+}
+int genieEventSubscribe (int object, int index)
 {
   int result ;
 
-  pthread_mutex_lock   (&genieMutex) ;
-    result = _genieWriteStr (index, string) ;
-  pthread_mutex_unlock (&genieMutex) ;
+  if (((object != GENIE_ALL) && ((object < 0) || (object > 255))) || ((index != GENIE_ALL) && ((index < 0) || (index > 255))))
+    return -1 ;
+
+  genieLock () ;
+    result = _genieEventFilter (GENIED_SUBSCRIBE, object, index) ;
+  genieUnlock () ;
+
+  return result ;
+}
+int genieEventUnsubscribe (int object, int index)
+{
+  int result ;
+
+  if (((object != GENIE_ALL) && ((object < 0) || (object > 255))) || ((index != GENIE_ALL) && ((index < 0) || (index > 255))))
+    return -1 ;
+
+  genieLock () ;
+    result = _genieEventFilter (GENIED_UNSUBSCRIBE, object, index) ;
+  genieUnlock () ;
 
   return result ;
 }
 
+
 /*
- * genieWriteStrU:
- *	Write a string to the display (ASCII, or Unicode)
- *	There is only one string type object.
+ * Display groups:
+ *	Several displays showing the same thing, each on its own link
+ *	(a serial port, or a genied socket) separate from the one
+ *	genieSetup opened. A write to a group is encoded once, goes out to
+ *	every member back to back, and then we wait on all of their ACKs
+ *	together, so it takes about as long as a write to the slowest one
+ *	rather than the sum of them all.
+ *
+ *	The group remembers the last frame written to every object and
+ *	string, and each member the generation of each it has ACKed. A
+ *	member that misses a write (NAK, or no reply in time) is marked as
+ *	lagging, and is sent just the frames it's behind on as part of the
+ *	following writes, up to GENIE_GROUP_CATCHUP at a time.
  *********************************************************************************
  */
-static int _genieWriteStrU (int index, char *string)
+
+#define	GENIE_MAX_GROUPS	8
+#define	GENIE_GROUP_MEMBERS	16		// A bit each in the results
+#define	GENIE_GROUP_CATCHUP	16		// Frames in flight per member
+#define	GENIE_GROUP_STRINGS	256		// Row of keys for WRITE_STR
+
+struct genieGroupKey
 {
-  char *p ;
-  unsigned int checksum ;
-  int len = strlen (string) ;
-  
+  unsigned int   gen ;
+  int            len ;
+  unsigned char *frame ;
+} ;
 
-  if (len > 255)
+struct genieGroupMember
+{
+  int           fd ;
+  int           baud ;
+  int           lagging ;
+  unsigned int *acked ;			// Generation ACKed, per key
+  int           sent [GENIE_GROUP_CATCHUP] ;	// Keys waiting on an ACK
+  unsigned int  sentGen [GENIE_GROUP_CATCHUP] ;
+  int           inFlight, replied, failed ;
+  int           skip ;			// Bytes left of a frame we don't want
+  int           sizeBy ;		// Payload bytes per unit, once skip gets to the length
+  int           bytes ;			// Sent this time round
+} ;
+
+struct genieGroup
+{
+  pthread_mutex_t         lock ;
+  int                     keyOf [GENIE_GROUP_STRINGS + 1][256] ;	// -1 if none
+  struct genieGroupKey   *keys ;
+  int                     nKeys, maxKeys ;
+  struct genieGroupMember members [GENIE_GROUP_MEMBERS] ;
+  int                     nMembers ;
+} ;
+
+static struct genieGroup *genieGroups [GENIE_MAX_GROUPS] ;
+static pthread_mutex_t genieGroupsLock = PTHREAD_MUTEX_INITIALIZER ;
+
+
+/*
+ * genieGroupCreate:
+ *	Make a new, empty, group. Returns its number, or -1
+ *********************************************************************************
+ */
+int genieGroupCreate (void)
+{
+  struct genieGroup *g ;
+  int id ;
+
+  pthread_mutex_lock (&genieGroupsLock) ;
+
+  for (id = 0 ; id < GENIE_MAX_GROUPS ; ++id)
+    if (genieGroups [id] == NULL)
+      break ;
+
+  if ((id == GENIE_MAX_GROUPS) || ((g = calloc (1, sizeof (struct genieGroup))) == NULL))
+  {
+    pthread_mutex_unlock (&genieGroupsLock) ;
     return -1 ;
+  }
+
+  memset (g->keyOf, 0xFF, sizeof (g->keyOf)) ;
+  pthread_mutex_init (&g->lock, NULL) ;
+  genieGroups [id] = g ;
+
+  pthread_mutex_unlock (&genieGroupsLock) ;
+
+  return id ;
+}
+
+
+/*
+ * genieGroupGet:
+ *	Find a group by number and lock it
+ *********************************************************************************
+ */
+static struct genieGroup *genieGroupGet (int group)
+{
+  struct genieGroup *g ;
+
+  if ((group < 0) || (group >= GENIE_MAX_GROUPS))
+    return NULL ;
+
+  pthread_mutex_lock (&genieGroupsLock) ;
+  if ((g = genieGroups [group]) != NULL)
+    pthread_mutex_lock (&g->lock) ;
+  pthread_mutex_unlock (&genieGroupsLock) ;
+
+  return g ;
+}
+
+
+/*
+ * genieGroupAdd:
+ *	Open another display and add it to the group. It's brought up to
+ *	date with everything written to the group so far over the next
+ *	few writes. Returns its member number, or -1
+ *********************************************************************************
+ */
+int genieGroupAdd (int group, char *device, int baud)
+{
+  struct genieGroup *g ;
+  struct genieGroupMember *m ;
+  int fd, n ;
+
+  if ((g = genieGroupGet (group)) == NULL)
+    return -1 ;
+
+  if ((n = g->nMembers) == GENIE_GROUP_MEMBERS)
+  {
+    pthread_mutex_unlock (&g->lock) ;
+    return -1 ;
+  }
+
+  if ((fd = genieOpen (device, baud)) < 0)
+  {
+    pthread_mutex_unlock (&g->lock) ;
+    return -1 ;
+  }
+  genieFlush (fd) ;
+
+  m = &g->members [n] ;
+  memset (m, 0, sizeof (struct genieGroupMember)) ;
+  m->fd      = fd ;
+  m->baud    = baud ;
+  m->lagging = (g->nKeys != 0) ;
+  if ((m->acked = calloc (g->maxKeys + 1, sizeof (unsigned int))) == NULL)
+  {
+    close (fd) ;
+    pthread_mutex_unlock (&g->lock) ;
+    return -1 ;
+  }
+  ++g->nMembers ;
+
+  pthread_mutex_unlock (&g->lock) ;
+
+  return n ;
+}
+
+
+/*
+ * genieGroupDestroy:
+ *	Close all the members' links and forget the group
+ *********************************************************************************
+ */
+void genieGroupDestroy (int group)
+{
+  struct genieGroup *g ;
+  int i ;
+
+  if ((group < 0) || (group >= GENIE_MAX_GROUPS))
+    return ;
+
+  pthread_mutex_lock (&genieGroupsLock) ;
+  g = genieGroups [group] ;
+  genieGroups [group] = NULL ;
+  pthread_mutex_unlock (&genieGroupsLock) ;
+
+  if (g == NULL)
+    return ;
+
+  pthread_mutex_lock   (&g->lock) ;		// Let any write finish
+  pthread_mutex_unlock (&g->lock) ;
+
+  for (i = 0 ; i < g->nMembers ; ++i)
+  {
+    close (g->members [i].fd) ;
+    free (g->members [i].acked) ;
+  }
+  for (i = 0 ; i < g->nKeys ; ++i)
+    free (g->keys [i].frame) ;
+  free (g->keys) ;
+  pthread_mutex_destroy (&g->lock) ;
+  free (g) ;
+}
+
+
+/*
+ * genieGroupLagging:
+ *	Return a bitmap of the members that are behind the rest
+ *********************************************************************************
+ */
+unsigned int genieGroupLagging (int group)
+{
+  struct genieGroup *g ;
+  unsigned int lagging = 0 ;
+  int i ;
+
+  if ((g = genieGroupGet (group)) == NULL)
+    return 0 ;
+
+  for (i = 0 ; i < g->nMembers ; ++i)
+    if (g->members [i].lagging)
+      lagging |= 1U << i ;
+
+  pthread_mutex_unlock (&g->lock) ;
+
+  return lagging ;
+}
 
-  genieAck = genieNak = FALSE ;
 
-  geniePutchar (GENIE_WRITE_STRU) ;   checksum  = GENIE_WRITE_STRU ;
-  geniePutchar (index) ;              checksum ^= index ;
-  geniePutchar ((unsigned char)len) ; checksum ^= len ;
-  for (p = string ; *p ; ++p)
+/*
+ * genieGroupStore:
+ *	Remember frame as the latest for its key, making it one newer
+ *	than any member has. Returns the key, or -1
+ *********************************************************************************
+ */
+static int genieGroupStore (struct genieGroup *g, int row, int index, const unsigned char *frame, int len)
+{
+  struct genieGroupKey *k ;
+  unsigned int *acked ;
+  unsigned char *copy ;
+  int key, i, max ;
+
+  if ((key = g->keyOf [row][index]) < 0)
   {
-    geniePutchar ((*p)>> 8);		  checksum ^= ((*p) >> 8) ;
-	geniePutchar ((*p)&0xFF);	      checksum ^= ((*p)&0xFF) ;
+    if (g->nKeys == g->maxKeys)
+    {
+      max = g->maxKeys ? g->maxKeys * 2 : 64 ;
+      if ((k = realloc (g->keys, max * sizeof (struct genieGroupKey))) == NULL)
+	return -1 ;
+      g->keys = k ;
+      for (i = 0 ; i < g->nMembers ; ++i)
+      {
+	if ((acked = realloc (g->members [i].acked, (max + 1) * sizeof (unsigned int))) == NULL)
+	  return -1 ;
+	memset (acked + g->maxKeys, 0, (max + 1 - g->maxKeys) * sizeof (unsigned int)) ;
+	g->members [i].acked = acked ;
+      }
+      g->maxKeys = max ;
+    }
+    key = g->nKeys ;
+    memset (&g->keys [key], 0, sizeof (struct genieGroupKey)) ;
   }
-  
-  geniePutchar (checksum) ;
 
-// TODO: Really ought to timeout here, but if the display doesn't
-//	respond, then it's probably game over anyway.
+  k = &g->keys [key] ;
+  if ((copy = realloc (k->frame, len)) == NULL)
+    return -1 ;
+  memcpy (copy, frame, len) ;
+  k->frame = copy ;
+  k->len   = len ;
+  ++k->gen ;
 
-  while ((genieAck == FALSE) && (genieNak == FALSE))
-    delay (1) ;
+  if (key == g->nKeys)
+  {
+    g->keyOf [row][index] = key ;
+    ++g->nKeys ;
+  }
 
-  return 0 ;
+  return key ;
 }
-int genieWriteStrU (int index, char *string)
-{
-  int result ;
-
-  pthread_mutex_lock   (&genieMutex) ;
-    result = _genieWriteStrU (index, string) ;
-  pthread_mutex_unlock (&genieMutex) ;
 
-  return result ;
-}
 
 /*
- * genieWriteStrD:
- *	Write a decimal value to the display (ASCII)
- *	There is only one string type object.
+ * genieGroupQueue:
+ *	Send a member the frame for key
  *********************************************************************************
  */
-static int _genieMakeStr (int index, long n, int base)
+static void genieGroupQueue (struct genieGroup *g, struct genieGroupMember *m, int key)
 {
-	char buf[8 * sizeof(long) + 1]; // Assumes 8-bit chars plus zero byte.
-	char *str = &buf[sizeof(buf) - 1];			
-	int  neg = 0;
-	if(n < 0) neg = 1;
-	n = abs(n);
+  struct genieGroupKey *k = &g->keys [key] ;
+  int sent = 0, n ;
 
-	*str = '\0';			
-	do {
-		unsigned long m = n;
-		n /= base;
-		char c = m - base * n;
-		*--str = c < 10 ? c + '0' : c + 'A' - 10;				
-	} while(n);
-	if(neg) *--str = '-';		
-	_genieWriteStr (index,str);	
-  return 0 ;
-}
-int genieWriteStrHex (int index, long n)
-{
-  int result ;
-  pthread_mutex_lock   (&genieMutex) ;
-    result = _genieMakeStr (index, n, 16);
-  pthread_mutex_unlock (&genieMutex) ;
-  return result ;
-}
-int genieWriteStrOct (int index, long n)
-{
-  int result ;
-  pthread_mutex_lock   (&genieMutex) ;
-    result = _genieMakeStr (index, n, 8);
-  pthread_mutex_unlock (&genieMutex) ;
-  return result ;
-}
-int genieWriteStrBin (int index, long n)
-{
-  int result ;
-  pthread_mutex_lock   (&genieMutex) ;
-    result = _genieMakeStr (index, n, 2);
-  pthread_mutex_unlock (&genieMutex) ;
-  return result ;
-}
-int genieWriteStrBase (int index, long n, int base)
-{
-  int result ;
-  pthread_mutex_lock   (&genieMutex) ;
-    result = _genieMakeStr (index, n, base);
-  pthread_mutex_unlock (&genieMutex) ;
-  return result ;
-}
-int genieWriteStrDec (int index, long n)
-{
+  while (sent < k->len)
+  {
+    if ((n = write (m->fd, k->frame + sent, k->len - sent)) < 0)
+    {
+      if (errno == EINTR)
+	continue ;
+      return ;				// It'll time out and catch up later
+    }
+    sent += n ;
+  }
 
-  int result ;
-  pthread_mutex_lock   (&genieMutex) ;
-    result = _genieMakeStr (index, n, 10);
-  pthread_mutex_unlock (&genieMutex) ;
-  return result ;
+  m->sent    [m->inFlight] = key ;
+  m->sentGen [m->inFlight] = k->gen ;
+  ++m->inFlight ;
+  m->bytes += k->len ;
 }
 
+
 /*
- * genieWriteStrFloat:
- *	Write a float string to the display.
- *	There is only one byte per index in array.
+ * genieGroupReceive:
+ *	Deal with what a member has sent back: ACKs and NAKs are matched
+ *	to what we sent it, anything else (events and so on) is skipped.
  *********************************************************************************
  */
-static int _genieWriteStrFloat (int index, float n, int precision)
-{  
-  char str[sizeof(long)];
-  gcvt(n, precision, str);  
-  _genieWriteStr(index, str);
-  return 0;
-}
-int genieWriteStrFloat (int index, float n, int precision)
-{  
-  int result ;
-  pthread_mutex_lock   (&genieMutex) ;
-     result = _genieWriteStrFloat (index,n,precision);
-  pthread_mutex_unlock (&genieMutex) ;
-  return result ;
-}
+static void genieGroupReceive (struct genieGroup *g, struct genieGroupMember *m)
+{
+  unsigned char buf [64] ;
+  int i, n, c ;
 
-int genieWriteInhLabelDefault (int index) {
-  return genieWriteObj(GENIE_OBJ_ILABELB, index, -1);
+  if ((n = read (m->fd, buf, sizeof (buf))) <= 0)
+    return ;
+
+  for (i = 0 ; i < n ; ++i)
+  {
+    c = buf [i] ;
+
+    if (m->skip > 0)
+    {
+      if ((--m->skip == 0) && (m->sizeBy != 0))	// That was the length
+      {
+	m->skip   = m->sizeBy * c + 1 ;		// Payload and checksum
+	m->sizeBy = 0 ;
+      }
+      continue ;
+    }
+
+    if ((c == GENIE_ACK) || (c == GENIE_NAK))
+    {
+      if (m->replied < m->inFlight)
+      {
+	if (c == GENIE_ACK)
+	  m->acked [m->sent [m->replied]] = m->sentGen [m->replied] ;
+	else
+	{
+	  m->acked [m->sent [m->replied]] = m->sentGen [m->replied] ;	// No use sending it again
+	  m->failed = TRUE ;
+	}
+	++m->replied ;
+      }
+    }
+    else if ((c == GENIE_REPORT_EVENT) || (c == GENIE_REPORT_OBJ))
+      m->skip = 5 ;
+    else if ((c == GENIE_REPORT_MAGIC_BYTES) || (c == GENIE_REPORT_DOUBLE_BYTES))
+    {
+      m->skip   = 2 ;				// Index and length
+      m->sizeBy = (c == GENIE_REPORT_MAGIC_BYTES) ? 1 : 2 ;
+    }
+  }
 }
 
+
 /*
- * genieWriteInhLabel:
- *	Write a string to a inherent label on the display
+ * genieGroupWrite:
+ *	Send a frame to every member of the group, along with anything a
+ *	lagging member is behind on, and wait for them all to answer.
+ *	Returns a bitmap of the members that didn't ACK it.
  *********************************************************************************
  */
-static int _genieWriteInhLabel (int index, char *string)
+static int genieGroupWrite (int group, int row, int index, unsigned char *frame, int len)
 {
-  char *p ;
-  unsigned int checksum ;
-  int len = strlen (string) ;
+  struct genieGroup *g ;
+  struct genieGroupMember *m ;
+  struct pollfd pfd [GENIE_GROUP_MEMBERS] ;
+  int who [GENIE_GROUP_MEMBERS] ;
+  unsigned char junk ;
+  unsigned int checksum = 0, failed = 0, timeUp, longest = 0, wait ;
+  int key, i, j, n ;
+
+  for (i = 0 ; i < len ; ++i)
+    checksum ^= frame [i] ;
+  frame [len++] = (unsigned char)checksum ;
+
+  if ((g = genieGroupGet (group)) == NULL)
+    return -1 ;
 
-  if (len > 255)
+  if ((key = genieGroupStore (g, row, index, frame, len)) < 0)
+  {
+    pthread_mutex_unlock (&g->lock) ;
     return -1 ;
+  }
 
-  genieAck = genieNak = FALSE ;
+// Out to everyone: the new frame last, after any catching up
 
-  geniePutchar (GENIE_WRITE_INH_LABEL) ;    checksum  = GENIE_WRITE_INH_LABEL ;
-  geniePutchar (index) ;              checksum ^= index ;
-  geniePutchar ((unsigned char)len) ; checksum ^= len ;
-  for (p = string ; *p ; ++p)
+  for (i = 0 ; i < g->nMembers ; ++i)
   {
-    geniePutchar (*p) ;
-    checksum ^= *p ;
+    m = &g->members [i] ;
+    m->inFlight = m->replied = m->failed = m->bytes = 0 ;
+
+    pfd [0].fd     = m->fd ;			// Anything left from last time
+    pfd [0].events = POLLIN ;
+    while ((poll (pfd, 1, 0) > 0) && (read (m->fd, &junk, 1) > 0))
+      ;
+    m->skip = m->sizeBy = 0 ;
+
+    if (m->lagging)
+    {
+      for (j = 0 ; (j < g->nKeys) && (m->inFlight < GENIE_GROUP_CATCHUP - 1) ; ++j)
+	if ((j != key) && (m->acked [j] != g->keys [j].gen))
+	  genieGroupQueue (g, m, j) ;
+      m->lagging = (j < g->nKeys) ;		// Ran out of room
+    }
+    genieGroupQueue (g, m, key) ;
+
+// As long as a read gets, a bit more for each extra frame, and how
+//	long they all take to go out at 10 bits a byte
+
+    wait = 50 + (m->inFlight - 1) * 6 + (unsigned int)((m->bytes * 10000LL) / (m->baud ? m->baud : 115200)) ;
+    if (wait > longest)
+      longest = wait ;
   }
-  geniePutchar (checksum) ;
 
-// TODO: Really ought to timeout here, but if the display doesn't
-//	respond, then it's probably game over anyway.
+// ... and then wait for all of their replies at once
 
-  while ((genieAck == FALSE) && (genieNak == FALSE))
-    delay (1) ;
+  for (timeUp = millis () + longest ; ; )
+  {
+    for (i = n = 0 ; i < g->nMembers ; ++i)
+      if (g->members [i].replied < g->members [i].inFlight)
+      {
+	pfd [n].fd     = g->members [i].fd ;
+	pfd [n].events = POLLIN ;
+	who [n++] = i ;
+      }
+
+    if ((n == 0) || ((int)(timeUp - millis ()) <= 0))
+      break ;
 
-  return 0 ;
-}
+    if (poll (pfd, n, (int)(timeUp - millis ())) <= 0)
+      continue ;
 
-int genieWriteInhLabel (int index, char *string)
-{
-  int result ;
+    for (i = 0 ; i < n ; ++i)
+      if (pfd [i].revents & POLLIN)
+	genieGroupReceive (g, &g->members [who [i]]) ;
+  }
 
-  pthread_mutex_lock   (&genieMutex) ;
-    result = _genieWriteInhLabel (index, string) ;
-  pthread_mutex_unlock (&genieMutex) ;
+  for (i = 0 ; i < g->nMembers ; ++i)
+  {
+    m = &g->members [i] ;
+    if (m->acked [key] != g->keys [key].gen)
+      failed |= 1U << i ;
+    if ((m->replied < m->inFlight) || m->failed)
+      m->lagging = TRUE ;
+  }
 
-  return result ;
+  pthread_mutex_unlock (&g->lock) ;
+
+  return (int)failed ;
 }
 
+
 /*
- * genieWriteInhLabelDec:
- *	Write a decimal value to the display (ASCII)
- *	There is only one string type object.
+ * genieGroupWriteObj, genieGroupWriteStr:
+ *	Write to an object, or a string, on every display in a group.
+ *	Returns 0 if they all took it, else a bit set for each member that
+ *	didn't (it'll be sent again later), or -1 on error.
  *********************************************************************************
  */
-static int _genieMakeInhLabel (int index, long n, int base)
+int genieGroupWriteObj (int group, int object, int index, unsigned int data)
 {
-	char buf[8 * sizeof(long) + 1]; // Assumes 8-bit chars plus zero byte.
-	char *str = &buf[sizeof(buf) - 1];			
-	int  neg = 0;
-	if(n < 0) neg = 1;
-	n = abs(n);
+  unsigned char frame [6] ;
 
-	*str = '\0';			
-	do {
-		unsigned long m = n;
-		n /= base;
-		char c = m - base * n;
-		*--str = c < 10 ? c + '0' : c + 'A' - 10;				
-	} while(n);
-	if(neg) *--str = '-';		
-	_genieWriteInhLabel (index,str);	
-  return 0 ;
-}
-int genieWriteInhLabelHex (int index, long n)
-{
-  int result ;
-  pthread_mutex_lock   (&genieMutex) ;
-    result = _genieMakeInhLabel (index, n, 16);
-  pthread_mutex_unlock (&genieMutex) ;
-  return result ;
-}
-int genieWriteInhLabelOct (int index, long n)
-{
-  int result ;
-  pthread_mutex_lock   (&genieMutex) ;
-    result = _genieMakeInhLabel (index, n, 8);
-  pthread_mutex_unlock (&genieMutex) ;
-  return result ;
-}
-int genieWriteInhLabelBin (int index, long n)
-{
-  int result ;
-  pthread_mutex_lock   (&genieMutex) ;
-    result = _genieMakeInhLabel (index, n, 2);
-  pthread_mutex_unlock (&genieMutex) ;
-  return result ;
-}
-int genieWriteInhLabelBase (int index, long n, int base)
-{
-  int result ;
-  pthread_mutex_lock   (&genieMutex) ;
-    result = _genieMakeInhLabel (index, n, base);
-  pthread_mutex_unlock (&genieMutex) ;
-  return result ;
+  frame [0] = GENIE_WRITE_OBJ ;
+  frame [1] = object ;
+  frame [2] = index ;
+  frame [3] = (data >> 8) & 0xFF ;
+  frame [4] = (data >> 0) & 0xFF ;
+
+  return genieGroupWrite (group, object & 0xFF, index & 0xFF, frame, 5) ;
 }
-int genieWriteInhLabelDec (int index, long n)
+
+int genieGroupWriteStr (int group, int index, char *string)
 {
+  unsigned char frame [GENIE_MAX_FRAME] ;
+  int len = strlen (string) ;
 
-  int result ;
-  pthread_mutex_lock   (&genieMutex) ;
-    result = _genieMakeInhLabel (index, n, 10);
-  pthread_mutex_unlock (&genieMutex) ;
-  return result ;
+  if (len > GENIE_MAX_TEXT)
+    return -1 ;
+
+  frame [0] = GENIE_WRITE_STR ;
+  frame [1] = index ;
+  frame [2] = (unsigned char)len ;
+  memcpy (&frame [3], string, len) ;
+
+  return genieGroupWrite (group, GENIE_GROUP_STRINGS, index & 0xFF, frame, 3 + len) ;
 }
 
+
 /*
- * genieWriteInhLabelFloat:
- *	Write a float string to the display.
- *	There is only one byte per index in array.
+ * genieDefaultOptions:
+ *	Fill in the options genieSetup uses: the listener thread at
+ *	SCHED_RR priority 20, on any CPU, and memory not locked.
  *********************************************************************************
  */
-static int _genieWriteInhLabelFloat (int index, float n, int precision)
-{  
-  char str[sizeof(long)];
-  gcvt(n, precision, str);  
-  _genieWriteInhLabel(index, str);
-  return 0;
-}
-int genieWriteInhLabelFloat (int index, float n, int precision)
-{  
-  int result ;
-  pthread_mutex_lock   (&genieMutex) ;
-     result = _genieWriteInhLabelFloat (index,n,precision);
-  pthread_mutex_unlock (&genieMutex) ;
-  return result ;
+void genieDefaultOptions (struct genieSetupOptions *opts)
+{
+  memset (opts, 0, sizeof (struct genieSetupOptions)) ;
+
+  opts->policy     = SCHED_RR ;
+  opts->priority   = 20 ;
+  opts->cpuMask    = 0 ;
+  opts->lockMemory = FALSE ;
+  opts->threadName = "genieListener" ;
 }
 
+
 /*
- * genieWriteMagicBytes:
- *	Write a byte array to the display.
- *	There is only one byte per index in array.
+ * genieStartListener:
+ *	Create the listener thread with the scheduling policy, priority
+ *	and CPU affinity asked for.
  *********************************************************************************
  */
-static int  _genieWriteMagicBytes	(int magic_index, unsigned int *byteArray)
+static int genieStartListener (struct genieSetupOptions *opts)
 {
-	unsigned int *p ;
-	unsigned int checksum ;
-	int len = sizeof(byteArray) / sizeof(int);
-//	int len = sizeof(byteArray) / sizeof(byteArray[0]);
-
-	if (len > 255)
-		return -1 ;
+  pthread_t myThread ;
+  pthread_attr_t attr ;
+  struct sched_param sched ;
+  cpu_set_t cpus ;
+  int cpu, max, result ;
 
-	genieAck = genieNak = FALSE ;
+  pthread_once (&genieAckOnce, genieAckInit) ;	// Before anything can signal it
 
-	geniePutchar (GENIE_MAGIC_BYTES) ; 		checksum  = GENIE_MAGIC_BYTES ;
-	geniePutchar (magic_index) ;          	checksum ^= magic_index ;
-	geniePutchar ((unsigned char)len) ; 	checksum ^= len ;
-	for (p = byteArray ; *p ; ++p)
-	{
-		geniePutchar (*p) ;
-		checksum ^= *p ;
-	}
-	geniePutchar (checksum) ;
+  pthread_attr_init (&attr) ;
+  pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_DETACHED) ;
 
-	// TODO: Really ought to timeout here, but if the display doesn't
-	//	respond, then it's probably game over anyway.
+  if (opts->policy >= 0)
+  {
+    memset (&sched, 0, sizeof (sched)) ;
+    sched.sched_priority = opts->priority ;
+    if ((opts->policy == SCHED_FIFO) || (opts->policy == SCHED_RR))
+    {
+      if (sched.sched_priority > (max = sched_get_priority_max (opts->policy)))
+	sched.sched_priority = max ;
+    }
+    else
+      sched.sched_priority = 0 ;
 
-	while ((genieAck == FALSE) && (genieNak == FALSE))
-		delay (1) ;
+    pthread_attr_setinheritsched (&attr, PTHREAD_EXPLICIT_SCHED) ;
+    pthread_attr_setschedpolicy  (&attr, opts->policy) ;
+    pthread_attr_setschedparam   (&attr, &sched) ;
+  }
 
-	return 0 ;
-}
-int  genieWriteMagicBytes	(int magic_index,unsigned int *byteArray)
-{
-  int result ;
+  if (opts->cpuMask != 0)
+  {
+    CPU_ZERO (&cpus) ;
+    for (cpu = 0 ; cpu < (int)(sizeof (opts->cpuMask) * 8) ; ++cpu)
+      if (opts->cpuMask & (1UL << cpu))
+	CPU_SET (cpu, &cpus) ;
+    pthread_attr_setaffinity_np (&attr, sizeof (cpus), &cpus) ;
+  }
 
-  pthread_mutex_lock   (&genieMutex) ;
-    result = _genieWriteMagicBytes (magic_index, byteArray) ;
-  pthread_mutex_unlock (&genieMutex) ;
+  result = pthread_create (&myThread, &attr, genieReplyListener, NULL) ;
+  pthread_attr_destroy (&attr) ;
 
   return result ;
 }
 
+
 /*
- * genieWriteDoubleBytes:
- *	Write a double byte array to the display.
- *	There are two bytes per index in array.
+ * genieSetup:
+ *	Initialise the Genie Display system
  *********************************************************************************
  */
-static int  _genieWriteDoubleBytes	(int magic_index,unsigned int *doubleByteArray)
+int genieSetup (char *device, int baud)
 {
-	unsigned int *p ;
-	unsigned int checksum ;
-	int len = sizeof (doubleByteArray) / sizeof(int);
-	// int len = sizeof (doubleByteArray) / sizeof(doubleByteArray[0]);
-
-	if (len > 255)
-		return -1 ;
-
-	genieAck = genieNak = FALSE ;
-
-	geniePutchar (GENIE_DOUBLE_BYTES) ;		checksum  = GENIE_MAGIC_BYTES ;
-	geniePutchar (magic_index) ;          	checksum ^= magic_index ;
-	geniePutchar ((unsigned char)len) ; 	checksum ^= len ;
-	for (p = doubleByteArray ; *p ; ++p)
-	{
-		geniePutchar ((*p) >> 8) ;
-		checksum ^= (*p) >>  8 ;
-		geniePutchar ((*p) &0xFF) ;
-		checksum ^= (*p) &0xFF ;
-	}
-	geniePutchar (checksum) ;
-
-	// TODO: Really ought to timeout here, but if the display doesn't
-	//	respond, then it's probably game over anyway.
+  struct genieSetupOptions opts ;
 
-	while ((genieAck == FALSE) && (genieNak == FALSE))
-		delay (1) ;
+  genieDefaultOptions (&opts) ;
 
-	return 0 ;
-}
-int  genieWriteDoubleBytes	(int magic_index,unsigned int *doubleByteArray)
-{
-  int result ;
+// We've always just carried on without real-time priority if we're not
+//	allowed it, so keep doing so.
 
-  pthread_mutex_lock   (&genieMutex) ;
-    result = _genieWriteDoubleBytes (magic_index, doubleByteArray) ;
-  pthread_mutex_unlock (&genieMutex) ;
+  if (genieSetupEx (device, baud, &opts) == 0)
+    return 0 ;
+  if ((errno != EPERM) || (genieFd < 0))
+    return -1 ;
 
-  return result ;
+  opts.policy = -1 ;
+  return genieStartListener (&opts) == 0 ? 0 : -1 ;
 }
 
 
 /*
- * genieSetup:
- *	Initialise the Genie Display system
+ * genieSetupEx:
+ *	Initialise the Genie Display system with the options given.
+ *	Unlike genieSetup, anything we can't do is an error (-1, errno set)
  *********************************************************************************
  */
-int genieSetup (char *device, int baud)
+int genieSetupEx (char *device, int baud, struct genieSetupOptions *opts)
 {
-  int i ;
+  int i, result ;
 
-  pthread_t myThread ;
   struct timeval tv ;
 
+  genieOptions = *opts ;
+
+  if (opts->lockMemory && (mlockall (MCL_CURRENT | MCL_FUTURE) != 0))
+    return -1 ;
+
   if ((genieFd = genieOpen (device, baud)) < 0)
     return -1 ;
 
+  genieBaud = baud ;
   genieFlush (genieFd) ;
 
+#ifdef	GENIE_URING
+  if (genieUringTransport.start (genieFd) == 0)
+    genieTransport = &genieUringTransport ;
+  else
+#endif
+  {
+    genieTransport = &geniePollTransport ;
+    genieTransport->start (genieFd) ;
+  }
+
   gettimeofday (&tv, NULL) ;
   epoch = (tv.tv_sec * 1000000 + tv.tv_usec) / 1000 ;
 
@@ -1033,5 +6083,74 @@ int genieSetup (char *device, int baud)
       break ;
   }
 
-  return pthread_create (&myThread, NULL, genieReplyListener, NULL) ;
+  if ((result = genieStartListener (opts)) != 0)
+  {
+    errno = result ;
+    return -1 ;
+  }
+
+  return 0 ;
+}
+
+
+/*
+ * genieSetupReplay:
+ *	Set up as genieSetup does, but play back a capture file made with
+ *	genieCaptureStart instead of talking to a display. speed is how
+ *	many times faster than real time to go; 0 is as fast as we can.
+ *********************************************************************************
+ */
+int genieSetupReplay (const char *path, double speed)
+{
+  struct genieSetupOptions opts ;
+  struct genieCaptureHeader *cap ;
+  struct stat st ;
+  struct timeval tv ;
+  int fd, result ;
+
+  if ((fd = open (path, O_RDONLY)) == -1)
+    return -1 ;
+
+  if ((fstat (fd, &st) == -1) || (st.st_size < (off_t)sizeof (struct genieCaptureHeader)) ||
+      ((cap = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED))
+  {
+    close (fd) ;
+    errno = EINVAL ;
+    return -1 ;
+  }
+
+  if ((cap->magic != GENIE_CAPTURE_MAGIC) || (cap->version != GENIE_CAPTURE_VERSION) ||
+      (cap->size + sizeof (struct genieCaptureHeader) > (unsigned long long)st.st_size))
+  {
+    munmap (cap, st.st_size) ;
+    close (fd) ;
+    errno = EINVAL ;
+    return -1 ;
+  }
+
+  genieReplayCap    = cap ;
+  genieReplayRing   = (const unsigned char *)(cap + 1) ;
+  genieReplayMapped = st.st_size ;
+  genieReplaySpeed  = speed ;
+
+  genieDefaultOptions (&opts) ;
+  opts.policy = -1 ;
+  genieOptions = opts ;
+
+  genieFd = fd ;
+  genieTransport = &genieReplayTransport ;
+  genieTransport->start (genieFd) ;
+
+  gettimeofday (&tv, NULL) ;
+  epoch = (tv.tv_sec * 1000000 + tv.tv_usec) / 1000 ;
+
+// No sync: if the capture has genieSetup's, the listener gets the NAK
+
+  if ((result = genieStartListener (&opts)) != 0)
+  {
+    errno = result ;
+    return -1 ;
+  }
+
+  return 0 ;
 }
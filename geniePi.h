@@ -47,6 +47,20 @@
 #define GENIE_REPORT_DOUBLE_BYTES	  11
 #define	GENIE_WRITE_INH_LABEL       12
 
+// genied (display server) commands. Not understood by the display itself.
+//	Both are cmd, object, index, which of those are wildcards, checksum.
+
+#define	GENIED_SUBSCRIBE		0xE0
+#define	GENIED_UNSUBSCRIBE		0xE1
+
+#define	GENIED_ANY_OBJECT		0x01
+#define	GENIED_ANY_INDEX		0x02
+
+// Wildcard object/index for subscriptions, string cache invalidation
+//	and deadline stats. Out of range, as 255 is a real index.
+
+#define	GENIE_ALL			(-1)
+
 // Objects
 //	the manual says:
 //		Note: Object IDs may change with future releases; it is not
@@ -138,6 +152,21 @@ struct genieReplyStruct
   unsigned int data ;
 } ;
 
+// As above, plus when it arrived (CLOCK_MONOTONIC, nS, taken when the
+//	first byte was read) and a sequence number. Gaps in the sequence
+//	are messages dropped because the queue was full.
+
+struct genieReplyExStruct
+{
+  int cmd ;
+  int object ;
+  int index ;
+  unsigned int data ;
+  unsigned int seq ;
+  unsigned long long timestamp ;
+  unsigned int count ;			// Events merged into this one
+} ;
+
 // Structure to store replys returned from a display
 
 struct genieMagicReplyStruct
@@ -148,6 +177,208 @@ struct genieMagicReplyStruct
   unsigned int data[100] ;
 } ;
 
+// The longest frame either way: WRITE_STRU with 255 characters, and
+//	the most text a string or label can take
+
+#define	GENIE_MAX_FRAME		520
+#define	GENIE_MAX_TEXT		255
+
+// A frame from the display, as genieDecodeFrame sees it. For magic and
+//	double byte reports, object is the magic index, index the length
+//	and payload the bytes (or big-endian words) that follow.
+
+struct genieFrame
+{
+  int                  cmd ;
+  int                  object ;
+  int                  index ;
+  unsigned int         data ;
+  const unsigned char *payload ;	// Into the buffer decoded, or NULL
+} ;
+
+// Priority classes for traffic to the display
+
+#define	GENIE_PRI_INTERACTIVE	0
+#define	GENIE_PRI_NORMAL	1
+#define	GENIE_PRI_BULK		2
+#define	GENIE_PRI_CLASSES	3
+
+// Per priority class link scheduling figures
+
+struct genieSchedStats
+{
+  unsigned long      transactions ;	// Times the link was granted
+  unsigned int       depth ;		// Waiting right now
+  unsigned int       maxDepth ;
+  unsigned long long waitTotalUs ;
+  unsigned long long waitMaxUs ;
+} ;
+
+// Options for genieSetupEx: how the listener thread is run.
+//	policy is SCHED_OTHER, SCHED_FIFO, SCHED_RR or -1 to inherit ours,
+//	cpuMask has a bit per CPU it may run on (0 for any of them).
+
+struct genieSetupOptions
+{
+  int           policy ;
+  int           priority ;
+  unsigned long cpuMask ;
+  int           lockMemory ;		// mlockall() the process
+  const char   *threadName ;		// Up to 15 characters, or NULL
+} ;
+
+// Time from an event being sent (as told by genieSetLatencyClock, else
+//	when its first byte was read) to it being queued. buckets [n]
+//	counts events taking 2^n to 2^(n+1)-1 uS (bucket 0 takes 0 and
+//	1), the last bucket has everything longer.
+
+#define	GENIE_LATENCY_BUCKETS	16
+
+struct genieLatencyStats
+{
+  unsigned long      count ;
+  unsigned long long minUs ;
+  unsigned long long maxUs ;
+  unsigned long long totalUs ;
+  unsigned long      buckets [GENIE_LATENCY_BUCKETS] ;
+} ;
+
+// A number format template, compiled once by genieFormatCompile
+//	from something like "Temp: %6.1f C" and used for every value
+//	written to that field.
+
+struct genieFormat
+{
+  char prefix [32] ;
+  char suffix [32] ;
+  int  prefixLen ;
+  int  suffixLen ;
+  int  base ;			// 2-36 for integers, 0 for floats
+  int  conversion ;		// d, x, o, b, f or g
+  int  width ;
+  int  precision ;		// Decimal places (f), significant digits (g)
+  char pad ;			// ' ' or '0'
+  char leftAlign ;
+} ;
+
+// String cache modes, and what it's saved
+
+#define	GENIE_CACHE_OFF		0
+#define	GENIE_CACHE_HASH	1
+#define	GENIE_CACHE_FULL	2
+
+struct genieStringCacheStats
+{
+  unsigned long      writes ;		// Writes looked at
+  unsigned long      suppressed ;	// ... that were already on the display
+  unsigned long long bytesSaved ;
+} ;
+
+// Capture files: a header, then a ring of records, each a
+//	genieCaptureRecord followed by len bytes. head and tail are byte
+//	counts since the capture started; the ring offset is that modulo
+//	size, and a record may wrap round the end of the ring.
+
+#define	GENIE_CAPTURE_MAGIC	0x50414347	// "GCAP"
+#define	GENIE_CAPTURE_VERSION	1
+
+#define	GENIE_CAPTURE_TX	0
+#define	GENIE_CAPTURE_RX	1
+
+struct genieCaptureHeader
+{
+  unsigned int       magic ;
+  unsigned int       version ;
+  unsigned long long size ;		// Bytes in the ring
+  unsigned long long head ;		// Where the next record goes
+  unsigned long long tail ;		// The oldest record still there
+  unsigned long long records ;		// Ever written
+} ;
+
+struct genieCaptureRecord
+{
+  unsigned long long stamp ;		// CLOCK_MONOTONIC, nS
+  unsigned short     len ;
+  unsigned char      dir ;		// GENIE_CAPTURE_TX or _RX
+  unsigned char      pad ;
+  unsigned int       pad2 ;
+} ;
+
+// Event log: a header, then a ring of fixed size records, one per frame
+//	sent or received, that any number of readers can follow while it's
+//	written. A record's seq is odd while it's being filled in, and
+//	2 * (its position + 1) once it has been; a reader copies it and
+//	checks seq is still that. Long frames are cut short.
+
+#define	GENIE_EVLOG_MAGIC	0x474C5645	// "EVLG"
+#define	GENIE_EVLOG_VERSION	1
+#define	GENIE_EVLOG_DATA	24
+
+struct genieEventLogHeader
+{
+  unsigned int                magic ;
+  unsigned int                version ;
+  unsigned int                records ;		// In the ring, a power of 2
+  unsigned int                recordSize ;
+  volatile unsigned long long head ;		// Records ever written
+} ;
+
+struct genieEventLogRecord
+{
+  volatile unsigned long long seq ;
+  unsigned long long          stamp ;		// CLOCK_MONOTONIC, nS
+  unsigned short              len ;		// Of the whole frame
+  unsigned char               dir ;		// GENIE_CAPTURE_TX or _RX
+  unsigned char               pad ;
+  unsigned char               data [GENIE_EVLOG_DATA] ;
+} ;
+
+// Writes with deadlines: how they went, per object type. A completion
+//	gets GENIE_ASYNC_DROPPED for one that was never sent.
+
+#define	GENIE_ASYNC_DROPPED	-2
+
+struct genieDeadlineStats
+{
+  unsigned long hits ;			// Answered in time
+  unsigned long late ;			// Sent, but answered late or not at all
+  unsigned long dropped ;		// Couldn't have made it, so not sent
+  unsigned long superseded ;		// Overtaken by a newer write
+} ;
+
+// The link model: request classes, and what's been learnt
+
+#define	GENIE_LINK_WRITE	0		// Object writes and the like
+#define	GENIE_LINK_READ		1
+#define	GENIE_LINK_STRING	2		// Strings and magic bytes
+
+struct genieLinkStats
+{
+  unsigned int  rttUs    [3] ;		// Display's turnaround, less time on the wire
+  unsigned int  rttVarUs [3] ;		// How much that varies
+  unsigned long samples  [3] ;
+  unsigned int  bytesPerSec ;		// Carried, in runs of frames
+  unsigned int  readTimeout ;		// mS, waiting for one read
+  unsigned int  byteTimeout ;		// mS, between bytes of a frame
+  unsigned int  window ;		// Async frames sent together
+} ;
+
+// Easing curves for genieAnimate
+
+#define	GENIE_EASE_LINEAR	0
+#define	GENIE_EASE_IN		1		// Quadratic
+#define	GENIE_EASE_OUT		2
+#define	GENIE_EASE_IN_OUT	3
+#define	GENIE_EASE_SMOOTH	4		// Smoothstep
+
+struct genieAnimStats
+{
+  unsigned int  running ;
+  unsigned long stepsSent ;
+  unsigned long stepsDropped ;		// Skipped for want of bandwidth
+  unsigned int  bytesPerSec ;		// What the link's been managing
+} ;
+
 // Globals (for debugging, mostly)
 
 #ifdef	GENIE_DEBUG
@@ -165,25 +396,54 @@ extern int genieNak ;
 extern "C" {
 #endif
 
+typedef void (*genieValueCallback) (int object, int index, unsigned int value) ;
+typedef void (*genieCompletion)    (void *arg, int result, unsigned int value) ;
+typedef unsigned long long (*genieLatencyClock) (const struct genieReplyExStruct *event) ;
+
 extern int  genieReplyAvail    		(void) ;
 
 extern void genieGetReply      		(struct genieReplyStruct *reply) ;
+extern void genieGetReplyEx    		(struct genieReplyExStruct *reply) ;
+extern int  genieGetReplyFrame 		(struct genieReplyExStruct *reply, unsigned char *frame) ;
+extern int  genieSetCoalesce   		(int object, int on) ;
 
 extern int  genieReadObj       		(int object, int index) ;
+extern int  genieReadObjCached 		(int object, int index, int maxAge) ;
+extern int  genieSubscribe     		(int object, int index, int period, genieValueCallback callback) ;
+extern int  genieUnsubscribe   		(int id) ;
 extern int  genieWriteObj      		(int object, int index, unsigned int data) ;
+extern int  genieReadObjAsync  		(int object, int index, genieCompletion done, void *arg) ;
+extern int  genieWriteObjAsync 		(int object, int index, unsigned int data, genieCompletion done, void *arg) ;
+extern int  genieWriteObjQueued		(int object, int index, unsigned int data) ;
+extern int  genieWriteObjDeadline		(int object, int index, unsigned int data, int deadline, genieCompletion done, void *arg) ;
+extern int  genieGetDeadlineStats		(int object, struct genieDeadlineStats *stats) ;
+extern int  genieFormAdd       		(int form, int object, int index) ;
+extern int  genieFormRemove    		(int object, int index) ;
+extern int  genieGetActiveForm 		(void) ;
+extern int  genieGetLinkStats  		(struct genieLinkStats *stats) ;
+extern int  genieDecodeFrame   		(const unsigned char *buf, int len, struct genieFrame *frame) ;
 extern int  genieWriteShortToIntLedDigits   (int index, int16_t data);
 extern int  genieWriteLongToIntLedDigits    (int index, int32_t data);
 extern int  genieWriteFloatToIntLedDigits   (int index, float data);
+extern int  genieWriteIntLedDigitsLongs     (int index, const int32_t *values, int count) ;
+extern int  genieWriteIntLedDigitsFloats    (int index, const float *values, int count) ;
+extern int  genieWriteObjBatch             (const unsigned char *frames, int count) ;
 extern int  genieWriteContrast 		(int value) ;
+extern int  genieAnimate       		(int object, int index, int from, int to, int duration, int easing) ;
+extern int  genieAnimateContrast		(int from, int to, int duration, int easing) ;
+extern int  genieAnimateStop   		(int id) ;
+extern void genieGetAnimStats  		(struct genieAnimStats *stats) ;
 
 extern int  genieWriteStr      		(int index, char *string) ;
 extern int  genieWriteStrU     		(int index, char *string) ;
+extern int  genieWriteStrUtf8  		(int index, const char *string) ;
 extern int  genieWriteStrHex 		  (int index, long n);
 extern int  genieWriteStrDec 		  (int index, long n);
 extern int  genieWriteStrOct 		  (int index, long n);
 extern int  genieWriteStrBin 		  (int index, long n);
 extern int  genieWriteStrBase 		(int index, long n, int base);
 extern int  genieWriteStrFloat 		(int index, float n, int precision);
+extern int  genieWriteStrFormat		(int index, const struct genieFormat *fmt, double value) ;
 
 extern int  genieWriteInhLabelDefault   (int index) ;
 extern int  genieWriteInhLabel          (int index, char *string) ;
@@ -193,10 +453,48 @@ extern int  genieWriteInhLabelOct       (int index, long n);
 extern int  genieWriteInhLabelBin       (int index, long n);
 extern int  genieWriteInhLabelBase      (int index, long n, int base);
 extern int  genieWriteInhLabelFloat     (int index, float n, int precision);
+extern int  genieWriteInhLabelFormat    (int index, const struct genieFormat *fmt, double value) ;
+
+extern int  genieStringCacheSetup	(int mode) ;
+extern void genieStringCacheInvalidate	(int cmd, int index) ;
+extern void genieStringCacheForce	(int on) ;
+extern void genieGetStringCacheStats	(struct genieStringCacheStats *stats) ;
+
+extern int  genieFormatCompile		(struct genieFormat *fmt, const char *spec) ;
+extern int  genieFormat			(char *out, const struct genieFormat *fmt, double value) ;
 
 extern int  genieWriteMagicBytes	(int magic_index, unsigned int *byteArray) ;
 extern int  genieWriteDoubleBytes	(int magic_index, unsigned int *doubleByteArray) ;
 
+extern int  genieWriteFrame		(const unsigned char *frame, int len) ;
+extern int  genieWriteObjFrame		(const unsigned char *frame) ;
+
+extern int  genieGroupCreate		(void) ;
+extern int  genieGroupAdd		(int group, char *device, int baud) ;
+extern int  genieGroupWriteObj		(int group, int object, int index, unsigned int data) ;
+extern int  genieGroupWriteStr		(int group, int index, char *string) ;
+extern unsigned int genieGroupLagging	(int group) ;
+extern void genieGroupDestroy		(int group) ;
+
+extern int  genieEventSubscribe		(int object, int index) ;
+extern int  genieEventUnsubscribe	(int object, int index) ;
+
+extern int  genieSetPriority		(int pri) ;
+extern int  genieGetPriority		(void) ;
+extern int  genieGetSchedStats		(int pri, struct genieSchedStats *stats) ;
+
+extern void genieSetLatencyClock	(genieLatencyClock clock) ;
+extern void genieGetLatencyStats	(struct genieLatencyStats *stats, int reset) ;
+
+extern int  genieCaptureStart		(const char *path, unsigned long size) ;
+extern void genieCaptureStop		(void) ;
+extern int  genieEventLogStart		(const char *path, unsigned int records) ;
+extern void genieEventLogStop		(void) ;
+extern int  genieSetupReplay		(const char *path, double speed) ;
+extern int  genieReplayDone		(void) ;
+
+extern void genieDefaultOptions		(struct genieSetupOptions *opts) ;
+extern int  genieSetupEx		(char *device, int baud, struct genieSetupOptions *opts) ;
 extern int  genieSetup         (char *device, int baud) ;
 extern void genieClose         (void) ;
 
@@ -0,0 +1,492 @@
+/*
+ * geniePi.hpp:
+ *	C++17 interface to the geniePi library. Header only: it's all
+ *	inline over the C functions in geniePi.h.
+ *
+ *	Widgets are types - Widget<GENIE_OBJ_GAUGE, 3> - so the object and
+ *	index are checked when compiling, and the frame header and its
+ *	part of the checksum are worked out then too. Given a constant
+ *	value, so is the whole frame.
+ *
+ *	Copyright (c) 2020 4D Systems PTY Ltd, Sydney, Australia
+ ***********************************************************************
+ * This file is part of geniePi:
+ *    geniePi is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as
+ *    published by the Free Software Foundation, either version 3 of the
+ *    License, or (at your option) any later version.
+ *
+ *    geniePi is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with geniePi.
+ *    If not, see <http://www.gnu.org/licenses/>.
+ ***********************************************************************
+ */
+
+#ifndef	GENIEPI_HPP
+#define	GENIEPI_HPP
+
+#include <array>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <future>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+#if	__has_include (<version>)
+#include <version>
+#endif
+#ifdef	__cpp_lib_span
+#include <span>
+#endif
+#if	defined (__cpp_impl_coroutine) && __has_include (<coroutine>)
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <exception>
+#include <mutex>
+#define	GENIEPI_COROUTINES
+#endif
+
+#include "geniePi.h"
+
+namespace genie
+{
+
+using Frame = std::array<unsigned char, 6> ;
+
+// A WRITE_OBJ frame, checksum and all. constexpr, so with constant
+//	arguments there's nothing left of it to do at run time.
+
+constexpr Frame writeObjFrame (int object, int index, unsigned int value) noexcept
+{
+  Frame f {} ;
+
+  f [0] = GENIE_WRITE_OBJ ;
+  f [1] = static_cast<unsigned char> (object) ;
+  f [2] = static_cast<unsigned char> (index) ;
+  f [3] = static_cast<unsigned char> (value >> 8) ;
+  f [4] = static_cast<unsigned char> (value) ;
+  f [5] = static_cast<unsigned char> (f [0] ^ f [1] ^ f [2] ^ f [3] ^ f [4]) ;
+
+  return f ;
+}
+
+
+/*
+ * Widget:
+ *	An object on the display
+ *********************************************************************************
+ */
+
+template <int Object, int Index>
+class Widget
+{
+  static_assert ((Object >= 0) && (Object <= 255), "Genie object types are 0 to 255") ;
+  static_assert ((Index  >= 0) && (Index  <= 255), "Genie object indexes are 0 to 255") ;
+
+// The constant part of every frame we send it
+
+  static constexpr unsigned char headerSum = GENIE_WRITE_OBJ ^ Object ^ Index ;
+
+public:
+  static constexpr int object = Object ;
+  static constexpr int index  = Index ;
+
+  static constexpr Frame frame (unsigned int value) noexcept
+  {
+    return { GENIE_WRITE_OBJ, Object, Index,
+	static_cast<unsigned char> (value >> 8), static_cast<unsigned char> (value),
+	static_cast<unsigned char> (headerSum ^ (value >> 8) ^ value) } ;
+  }
+
+  template <unsigned int Value>
+  static constexpr Frame constFrame = frame (Value) ;
+
+  int write (unsigned int value) const noexcept
+  {
+    if (value > 0xFFFF)
+    {
+      errno = EINVAL ;
+      return -1 ;
+    }
+    return genieWriteObjFrame (frame (value).data ()) ;
+  }
+
+  template <unsigned int Value>
+  int write () const noexcept
+  {
+    static_assert (Value <= 0xFFFF, "Genie object values are 16 bits") ;
+    return genieWriteObjFrame (constFrame<Value>.data ()) ;
+  }
+
+  int read () const noexcept
+    { return genieReadObj (Object, Index) ; }
+
+  int readCached (int maxAge) const noexcept
+    { return genieReadObjCached (Object, Index, maxAge) ; }
+
+  int subscribe (int period, genieValueCallback callback) const noexcept
+    { return genieSubscribe (Object, Index, period, callback) ; }
+} ;
+
+template <int I> using AngularMeter = Widget<GENIE_OBJ_ANGULAR_METER, I> ;
+template <int I> using CoolGauge    = Widget<GENIE_OBJ_COOL_GAUGE,    I> ;
+template <int I> using Form         = Widget<GENIE_OBJ_FORM,          I> ;
+template <int I> using Gauge        = Widget<GENIE_OBJ_GAUGE,         I> ;
+template <int I> using Knob         = Widget<GENIE_OBJ_KNOB,          I> ;
+template <int I> using Led          = Widget<GENIE_OBJ_LED,           I> ;
+template <int I> using LedDigits    = Widget<GENIE_OBJ_LED_DIGITS,    I> ;
+template <int I> using Meter        = Widget<GENIE_OBJ_METER,         I> ;
+template <int I> using Slider       = Widget<GENIE_OBJ_SLIDER,        I> ;
+template <int I> using Thermometer  = Widget<GENIE_OBJ_THERMOMETER,   I> ;
+template <int I> using Trackbar     = Widget<GENIE_OBJ_TRACKBAR,      I> ;
+template <int I> using UserLed      = Widget<GENIE_OBJ_USER_LED,      I> ;
+template <int I> using WinButton    = Widget<GENIE_OBJ_WINBUTTON,     I> ;
+
+
+/*
+ * String:
+ *	A strings object. These go through the C string writers so the
+ *	string cache still sees them.
+ *********************************************************************************
+ */
+
+template <int Index>
+class String
+{
+  static_assert ((Index >= 0) && (Index <= 255), "Genie object indexes are 0 to 255") ;
+
+  static constexpr std::size_t maxText = 255 ;
+
+  template <typename F>
+  static int withText (const char *text, std::size_t len, F writer) noexcept
+  {
+    char buf [maxText + 1] ;
+
+    if (len > maxText)
+      return -1 ;
+    std::memcpy (buf, text, len) ;
+    buf [len] = '\0' ;
+
+    return writer (buf) ;
+  }
+
+public:
+  static constexpr int index = Index ;
+
+  int write (std::string_view text) const noexcept
+    { return withText (text.data (), text.size (), [] (char *s) { return genieWriteStr (Index, s) ; }) ; }
+
+  int writeUtf8 (std::string_view text) const noexcept
+    { return withText (text.data (), text.size (), [] (char *s) { return genieWriteStrUtf8 (Index, s) ; }) ; }
+
+  int write (long n, int base = 10) const noexcept
+    { return genieWriteStrBase (Index, n, base) ; }
+
+  int write (const struct genieFormat &fmt, double value) const noexcept
+    { return genieWriteStrFormat (Index, &fmt, value) ; }
+
+#ifdef	__cpp_lib_span
+  template <std::size_t N>
+  int write (std::span<const char, N> text) const noexcept
+    { return write (std::string_view (text.data (), text.size ())) ; }
+#endif
+} ;
+
+
+/*
+ * Session:
+ *	The link to the display, open for as long as this is in scope.
+ *	There's only the one, so it can be neither copied nor moved.
+ *********************************************************************************
+ */
+
+class Session
+{
+public:
+  explicit Session (const char *device, int baud = 115200)
+  {
+    if (genieSetup (const_cast<char *> (device), baud) != 0)
+      throw std::system_error (errno, std::generic_category (), "genieSetup") ;
+  }
+
+  Session (const char *device, int baud, genieSetupOptions opts)
+  {
+    if (genieSetupEx (const_cast<char *> (device), baud, &opts) != 0)
+      throw std::system_error (errno, std::generic_category (), "genieSetupEx") ;
+  }
+
+  ~Session ()
+    { genieClose () ; }
+
+  Session (const Session &) = delete ;
+  Session &operator= (const Session &) = delete ;
+} ;
+
+
+/*
+ * Batch:
+ *	Object writes collected up and sent by commit() in as few
+ *	transactions as we can. Whatever isn't committed is dropped.
+ *	Move only: it owns its frames.
+ *********************************************************************************
+ */
+
+class Batch
+{
+  std::vector<unsigned char> frames ;
+
+  void append (const Frame &f)
+    { frames.insert (frames.end (), f.begin (), f.end ()) ; }
+
+public:
+  Batch () = default ;
+  Batch (Batch &&) noexcept = default ;
+  Batch &operator= (Batch &&) noexcept = default ;
+  Batch (const Batch &) = delete ;
+  Batch &operator= (const Batch &) = delete ;
+
+  template <int Object, int Index>
+  Batch &add (const Widget<Object, Index> &, unsigned int value)
+    { append (Widget<Object, Index>::frame (value)) ; return *this ; }
+
+  template <unsigned int Value, int Object, int Index>
+  Batch &add (const Widget<Object, Index> &)
+    { append (Widget<Object, Index>::template constFrame<Value>) ; return *this ; }
+
+  Batch &add (int object, int index, unsigned int value)
+    { append (writeObjFrame (object, index, value)) ; return *this ; }
+
+#ifdef	__cpp_lib_span
+  Batch &add (std::span<const Frame> more)
+    { for (const Frame &f : more) append (f) ; return *this ; }
+#endif
+
+  std::size_t size  () const noexcept { return frames.size () / 6 ; }
+  bool        empty () const noexcept { return frames.empty () ; }
+  void        clear () noexcept       { frames.clear () ; }
+
+  int commit () noexcept
+  {
+    int result = frames.empty () ? 0 : genieWriteObjBatch (frames.data (), static_cast<int> (size ())) ;
+
+    frames.clear () ;
+    return result ;
+  }
+} ;
+
+
+
+/*
+ * readFuture, writeFuture:
+ *	Start a read or write without waiting for it; the future is ready
+ *	when the display has answered. The value read, or 0 for a write,
+ *	or -1 if it was NAKed or not answered.
+ *********************************************************************************
+ */
+
+namespace detail
+{
+  inline void setPromise (void *arg, int result, unsigned int value)
+  {
+    std::promise<int> *p = static_cast<std::promise<int> *> (arg) ;
+
+    p->set_value ((result == 0) ? static_cast<int> (value) : -1) ;
+    delete p ;
+  }
+
+  template <typename Start>
+  std::future<int> startFuture (Start start)
+  {
+    std::promise<int> *p = new std::promise<int> ;
+    std::future<int> f = p->get_future () ;
+
+    if (start (p) != 0)
+      setPromise (p, -1, 0) ;
+
+    return f ;
+  }
+}
+
+inline std::future<int> readFuture (int object, int index)
+{
+  return detail::startFuture ([=] (void *p)
+    { return genieReadObjAsync (object, index, detail::setPromise, p) ; }) ;
+}
+
+inline std::future<int> writeFuture (int object, int index, unsigned int value)
+{
+  return detail::startFuture ([=] (void *p)
+    { return genieWriteObjAsync (object, index, value, detail::setPromise, p) ; }) ;
+}
+
+template <int Object, int Index>
+std::future<int> readFuture (const Widget<Object, Index> &)
+  { return readFuture (Object, Index) ; }
+
+template <int Object, int Index>
+std::future<int> writeFuture (const Widget<Object, Index> &, unsigned int value)
+  { return writeFuture (Object, Index, value) ; }
+
+
+#ifdef	GENIEPI_COROUTINES
+
+/*
+ * Loop:
+ *	Where coroutines waiting on the display are resumed. Completions
+ *	arrive on the library's listener thread, and just queue the
+ *	coroutine here; whichever thread calls poll() or runFor() then
+ *	carries on with it. One thread can look after any number of them.
+ *********************************************************************************
+ */
+
+class Loop
+{
+  std::mutex                           lock ;
+  std::condition_variable              cond ;
+  std::vector<std::coroutine_handle<>> ready ;
+
+public:
+  void post (std::coroutine_handle<> h)
+  {
+    {
+      std::lock_guard<std::mutex> l (lock) ;
+      ready.push_back (h) ;
+    }
+    cond.notify_one () ;
+  }
+
+  std::size_t poll ()
+  {
+    std::vector<std::coroutine_handle<>> now ;
+
+    {
+      std::lock_guard<std::mutex> l (lock) ;
+      now.swap (ready) ;
+    }
+    for (std::coroutine_handle<> h : now)
+      h.resume () ;
+
+    return now.size () ;
+  }
+
+  std::size_t runFor (std::chrono::milliseconds howLong)
+  {
+    {
+      std::unique_lock<std::mutex> l (lock) ;
+      cond.wait_for (l, howLong, [this] { return !ready.empty () ; }) ;
+    }
+    return poll () ;
+  }
+} ;
+
+
+/*
+ * Operation:
+ *	What co_await display.read (...) and display.write (...) wait on.
+ *	The result is as for the futures.
+ *********************************************************************************
+ */
+
+class Operation
+{
+  Loop                   &loop ;
+  bool                    reading ;
+  int                     object, index ;
+  unsigned int            value ;
+  int                     result = -1 ;
+  std::coroutine_handle<> handle ;
+
+  static void done (void *arg, int result, unsigned int value)
+  {
+    Operation *op = static_cast<Operation *> (arg) ;
+
+    op->result = (result != 0) ? -1 : op->reading ? static_cast<int> (value) : 0 ;
+    op->loop.post (op->handle) ;
+  }
+
+public:
+  Operation (Loop &loop, bool reading, int object, int index, unsigned int value = 0) noexcept
+    : loop (loop), reading (reading), object (object), index (index), value (value) {}
+
+  bool await_ready () const noexcept { return false ; }
+
+  bool await_suspend (std::coroutine_handle<> h) noexcept
+  {
+    handle = h ;
+    if ((reading ? genieReadObjAsync  (object, index, done, this)
+		 : genieWriteObjAsync (object, index, value, done, this)) != 0)
+      return false ;			// Carry straight on with -1
+
+    return true ;
+  }
+
+  int await_resume () const noexcept { return result ; }
+} ;
+
+
+/*
+ * Task:
+ *	A coroutine that's started and forgotten about, for the likes of
+ *	  genie::Task onPress (genie::Display &d) { co_await d.write (...) ; }
+ *********************************************************************************
+ */
+
+struct Task
+{
+  struct promise_type
+  {
+    Task get_return_object () noexcept      { return {} ; }
+    std::suspend_never initial_suspend () noexcept { return {} ; }
+    std::suspend_never final_suspend () noexcept   { return {} ; }
+    void return_void () noexcept {}
+    void unhandled_exception () noexcept    { std::terminate () ; }
+  } ;
+} ;
+
+
+/*
+ * Display:
+ *	Asynchronous access to the display opened by a Session, with the
+ *	Loop its coroutines are resumed on.
+ *********************************************************************************
+ */
+
+class Display
+{
+  Loop events ;
+
+public:
+  Operation read (int object, int index) noexcept
+    { return Operation (events, true, object, index) ; }
+
+  Operation write (int object, int index, unsigned int value) noexcept
+    { return Operation (events, false, object, index, value) ; }
+
+  template <int Object, int Index>
+  Operation read (const Widget<Object, Index> &) noexcept
+    { return read (Object, Index) ; }
+
+  template <int Object, int Index>
+  Operation write (const Widget<Object, Index> &, unsigned int value) noexcept
+    { return write (Object, Index, value) ; }
+
+  Loop &loop () noexcept { return events ; }
+
+  std::size_t poll () { return events.poll () ; }
+  std::size_t runFor (std::chrono::milliseconds howLong) { return events.runFor (howLong) ; }
+} ;
+
+#endif	// GENIEPI_COROUTINES
+
+}	// namespace genie
+
+#endif
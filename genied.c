@@ -0,0 +1,693 @@
+/*
+ * genied.c:
+ *	Display server for geniePi. Owns the serial link to a 4D Systems
+ *	Genie display and lets any number of local processes share it
+ *	over a Unix domain socket.
+ *
+ *	Clients talk the Genie protocol itself: passing the socket path to
+ *	genieSetup() instead of a serial device is all it takes. Object
+ *	writes and reads from every client go into the library's async
+ *	queue, so they're pipelined to the display together rather than
+ *	taking turns, and each is answered to the client that sent it as
+ *	the display answers. Anything else waits for that client's queued
+ *	requests first, so every client gets its answers in order. Events
+ *	are fanned out, as the display sent them, to every client that has
+ *	subscribed to that object and index.
+ *
+ *	Copyright (c) 2020 4D Systems PTY Ltd, Sydney, Australia
+ ***********************************************************************
+ * This file is part of geniePi:
+ *    geniePi is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as
+ *    published by the Free Software Foundation, either version 3 of the
+ *    License, or (at your option) any later version.
+ *
+ *    geniePi is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with geniePi.
+ *    If not, see <http://www.gnu.org/licenses/>.
+ ***********************************************************************
+ */
+
+#define	_GNU_SOURCE
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <pthread.h>
+
+#include "geniePi.h"
+
+#ifndef	TRUE
+#  define	TRUE (1==1)
+#  define	FALSE (1==0)
+#endif
+
+#define	GENIED_SOCKET	"/run/genied.sock"
+
+// A client: its socket, a bitmap of the (object, index) pairs it
+//	wants to hear events for, how many of its requests are queued,
+//	and the answers to them waiting for the client's thread to send.
+
+#define	GENIED_MAX_IN_FLIGHT	256
+#define	GENIED_REPLIES		2048		// An answer of 6 to each, and one more
+
+struct geniedClient
+{
+  int fd ;
+  int wake [2] ;			// Written to when there are replies
+  pthread_mutex_t sendLock ;		// Serialises writes to fd
+  pthread_mutex_t lock ;		// Guards inFlight and replies
+  pthread_cond_t  idle ;		// inFlight has gone down
+  int inFlight ;
+  int replyLen ;
+  unsigned char replies [GENIED_REPLIES] ;
+  uint8_t events [256][256 / 8] ;
+  struct geniedClient *next ;
+} ;
+
+// A queued request, and who to answer
+
+struct geniedRequest
+{
+  struct geniedClient *client ;
+  int cmd ;
+  int object ;
+  int index ;
+} ;
+
+static struct geniedClient *clients = NULL ;
+static pthread_mutex_t clientsLock = PTHREAD_MUTEX_INITIALIZER ;
+
+static int verbose = FALSE ;
+
+
+/*
+ * clientSend:
+ *	Send an event to a client. It's dropped for a client that isn't
+ *	keeping up rather than hold up everyone else.
+ *********************************************************************************
+ */
+static void clientSend (struct geniedClient *c, const unsigned char *buf, int len)
+{
+  struct pollfd pfd ;
+  int sent = 0, n ;
+
+  pthread_mutex_lock (&c->sendLock) ;
+
+  while (sent < len)
+  {
+    n = send (c->fd, buf + sent, len - sent, MSG_NOSIGNAL | MSG_DONTWAIT) ;
+    if (n > 0)
+    {
+      sent += n ;
+      continue ;
+    }
+    if ((n < 0) && (errno != EAGAIN) && (errno != EINTR))
+      break ;
+    if (sent == 0)				// Nothing gone yet: just drop it
+      break ;
+
+    pfd.fd     = c->fd ;
+    pfd.events = POLLOUT ;
+    if (poll (&pfd, 1, 100) == 0)
+      break ;
+  }
+
+  pthread_mutex_unlock (&c->sendLock) ;
+}
+
+
+/*
+ * clientReply:
+ *	Queue an answer for the client's thread to send. This is called
+ *	from requestDone on the library's listener thread, so it mustn't
+ *	wait on the client.
+ *********************************************************************************
+ */
+static void clientReply (struct geniedClient *c, const unsigned char *buf, int len)
+{
+  unsigned char wake = 0 ;
+
+  pthread_mutex_lock (&c->lock) ;
+    if (c->replyLen + len <= GENIED_REPLIES)
+    {
+      memcpy (c->replies + c->replyLen, buf, len) ;
+      c->replyLen += len ;
+    }
+    else
+      c->replyLen = GENIED_REPLIES + 1 ;	// Can't happen: sendReplies drops it
+  pthread_mutex_unlock (&c->lock) ;
+
+  while ((write (c->wake [1], &wake, 1) < 0) && (errno == EINTR))	// Full is fine: it's awake
+    ;
+}
+
+
+/*
+ * sendReplies:
+ *	Send the queued answers. A client that can't take them straight
+ *	away has stopped reading; -1 says to drop it.
+ *********************************************************************************
+ */
+static int sendReplies (struct geniedClient *c)
+{
+  unsigned char buf [GENIED_REPLIES] ;
+  int len, sent = 0, n ;
+
+  pthread_mutex_lock (&c->lock) ;
+    if ((len = c->replyLen) <= GENIED_REPLIES)
+      memcpy (buf, c->replies, len) ;
+    c->replyLen = 0 ;
+  pthread_mutex_unlock (&c->lock) ;
+
+  if (len > GENIED_REPLIES)
+    return -1 ;
+
+  pthread_mutex_lock (&c->sendLock) ;
+    while (sent < len)
+    {
+      n = send (c->fd, buf + sent, len - sent, MSG_NOSIGNAL | MSG_DONTWAIT) ;
+      if (n > 0)
+	sent += n ;
+      else if ((n < 0) && (errno == EINTR))
+	continue ;
+      else
+	break ;
+    }
+  pthread_mutex_unlock (&c->sendLock) ;
+
+  return (sent == len) ? 0 : -1 ;
+}
+
+
+/*
+ * setEvents:
+ *	(Un)subscribe a client to events. which says whether the object,
+ *	the index or both are wildcards.
+ *********************************************************************************
+ */
+static void setEvents (struct geniedClient *c, int object, int index, int which, int on)
+{
+  int o, i ;
+
+  for (o = 0 ; o < 256 ; ++o)
+  {
+    if (!(which & GENIED_ANY_OBJECT) && (o != object))
+      continue ;
+    for (i = 0 ; i < 256 ; ++i)
+    {
+      if (!(which & GENIED_ANY_INDEX) && (i != index))
+	continue ;
+      if (on)
+	c->events [o][i >> 3] |=  (1 << (i & 7)) ;
+      else
+	c->events [o][i >> 3] &= ~(1 << (i & 7)) ;
+    }
+  }
+}
+
+
+/*
+ * frameLength:
+ *	Work out how long the frame starting in buf is, or 0 if we don't
+ *	have enough of it yet to know. -1 for a command we don't know.
+ *********************************************************************************
+ */
+static int frameLength (const unsigned char *buf, int have)
+{
+  switch (buf [0])
+  {
+    case GENIE_READ_OBJ:		return 4 ;
+    case GENIE_WRITE_OBJ:		return 6 ;
+    case GENIE_WRITE_CONTRAST:		return 3 ;
+    case GENIED_SUBSCRIBE:		return 5 ;
+    case GENIED_UNSUBSCRIBE:		return 5 ;
+
+    case GENIE_WRITE_STR:
+    case GENIE_WRITE_INH_LABEL:
+    case GENIE_MAGIC_BYTES:
+      return (have < 3) ? 0 : 4 + buf [2] ;
+
+    case GENIE_WRITE_STRU:
+    case GENIE_DOUBLE_BYTES:
+      return (have < 3) ? 0 : 4 + 2 * buf [2] ;
+  }
+
+  return -1 ;
+}
+
+
+/*
+ * requestDone:
+ *	The display has answered a queued request (on the library's
+ *	listener thread): queue the answer for the client that made it.
+ *********************************************************************************
+ */
+static void requestDone (void *arg, int result, unsigned int value)
+{
+  struct geniedRequest *r = (struct geniedRequest *)arg ;
+  struct geniedClient  *c = r->client ;
+  unsigned char reply [6] ;
+
+  if (result != 0)
+  {
+    reply [0] = GENIE_NAK ;
+    clientReply (c, reply, 1) ;
+  }
+  else if (r->cmd == GENIE_READ_OBJ)
+  {
+    reply [0] = GENIE_REPORT_OBJ ;
+    reply [1] = r->object ;
+    reply [2] = r->index ;
+    reply [3] = (value >> 8) & 0xFF ;
+    reply [4] = value & 0xFF ;
+    reply [5] = reply [0] ^ reply [1] ^ reply [2] ^ reply [3] ^ reply [4] ;
+    clientReply (c, reply, 6) ;
+  }
+  else
+  {
+    reply [0] = GENIE_ACK ;
+    clientReply (c, reply, 1) ;
+  }
+
+  free (r) ;
+
+  pthread_mutex_lock (&c->lock) ;
+    --c->inFlight ;
+    pthread_cond_broadcast (&c->idle) ;
+  pthread_mutex_unlock (&c->lock) ;
+}
+
+
+/*
+ * waitIdle:
+ *	Wait for all of a client's queued requests to be answered
+ *********************************************************************************
+ */
+static void waitIdle (struct geniedClient *c)
+{
+  pthread_mutex_lock (&c->lock) ;
+    while (c->inFlight != 0)
+      pthread_cond_wait (&c->idle, &c->lock) ;
+  pthread_mutex_unlock (&c->lock) ;
+}
+
+
+/*
+ * waitRoom:
+ *	Wait until a client may queue another request, so there's always
+ *	room for the answers
+ *********************************************************************************
+ */
+static void waitRoom (struct geniedClient *c)
+{
+  pthread_mutex_lock (&c->lock) ;
+    while (c->inFlight >= GENIED_MAX_IN_FLIGHT)
+      pthread_cond_wait (&c->idle, &c->lock) ;
+  pthread_mutex_unlock (&c->lock) ;
+}
+
+
+/*
+ * queueRequest:
+ *	Put an object read or write in the library's async queue, to be
+ *	answered from requestDone. If the queue's full, wait for room.
+ *********************************************************************************
+ */
+static int queueRequest (struct geniedClient *c, const unsigned char *frame)
+{
+  struct geniedRequest *r ;
+  int result ;
+
+  if ((r = malloc (sizeof (struct geniedRequest))) == NULL)
+    return -1 ;
+
+  r->client = c ;
+  r->cmd    = frame [0] ;
+  r->object = frame [1] ;
+  r->index  = frame [2] ;
+
+  pthread_mutex_lock (&c->lock) ;
+    ++c->inFlight ;
+  pthread_mutex_unlock (&c->lock) ;
+
+  for (;;)
+  {
+    if (r->cmd == GENIE_READ_OBJ)
+      result = genieReadObjAsync (r->object, r->index, requestDone, r) ;
+    else
+      result = genieWriteObjAsync (r->object, r->index, (frame [3] << 8) | frame [4], requestDone, r) ;
+
+    if ((result == 0) || (errno != EAGAIN))
+      break ;
+    usleep (100) ;
+  }
+
+  if (result != 0)
+  {
+    free (r) ;
+    pthread_mutex_lock (&c->lock) ;
+      --c->inFlight ;
+    pthread_mutex_unlock (&c->lock) ;
+  }
+
+  return result ;
+}
+
+
+/*
+ * handleFrame:
+ *	Act on one complete frame from a client
+ *********************************************************************************
+ */
+static void handleFrame (struct geniedClient *c, unsigned char *frame, int len)
+{
+  unsigned char reply [1] ;
+  unsigned int checksum = 0 ;
+  int i ;
+
+  for (i = 0 ; i < len ; ++i)
+    checksum ^= frame [i] ;
+
+  if (checksum != 0)
+  {
+    waitIdle (c) ;
+    reply [0] = GENIE_NAK ;
+    clientReply (c, reply, 1) ;
+    return ;
+  }
+
+  switch (frame [0])
+  {
+    case GENIE_READ_OBJ:
+    case GENIE_WRITE_OBJ:
+      if (queueRequest (c, frame) == 0)
+	return ;
+      waitIdle (c) ;
+      reply [0] = GENIE_NAK ;
+      clientReply (c, reply, 1) ;
+      return ;
+
+    case GENIED_SUBSCRIBE:
+    case GENIED_UNSUBSCRIBE:
+      waitIdle (c) ;
+      setEvents (c, frame [1], frame [2], frame [3], frame [0] == GENIED_SUBSCRIBE) ;
+      reply [0] = GENIE_ACK ;
+      clientReply (c, reply, 1) ;
+      return ;
+
+    default:
+      waitIdle (c) ;
+      reply [0] = (genieWriteFrame (frame, len) == 0) ? GENIE_ACK : GENIE_NAK ;
+      clientReply (c, reply, 1) ;
+      return ;
+  }
+}
+
+
+/*
+ * clientThread:
+ *	Read frames from one client, and send it its answers, until it
+ *	goes away or stops reading them
+ *********************************************************************************
+ */
+static void *clientThread (void *data)
+{
+  struct geniedClient *c = (struct geniedClient *)data ;
+  struct geniedClient **p ;
+  struct pollfd pfd [2] ;
+  unsigned char buf [GENIE_MAX_FRAME * 2] ;
+  unsigned char junk [64] ;
+  unsigned char nak = GENIE_NAK ;
+  int have = 0, n, len, ok = TRUE ;
+
+  pfd [0].fd     = c->fd ;
+  pfd [0].events = POLLIN ;
+  pfd [1].fd     = c->wake [0] ;
+  pfd [1].events = POLLIN ;
+
+  while (ok)
+  {
+    if (poll (pfd, 2, -1) < 0)
+    {
+      if (errno == EINTR)
+	continue ;
+      break ;
+    }
+
+    if (pfd [1].revents & POLLIN)
+      while (read (c->wake [0], junk, sizeof (junk)) > 0)
+	;
+
+    if (pfd [0].revents & (POLLIN | POLLHUP | POLLERR))
+    {
+      if ((n = read (c->fd, buf + have, sizeof (buf) - have)) <= 0)
+      {
+	if ((n < 0) && ((errno == EINTR) || (errno == EAGAIN)))
+	  continue ;
+	break ;
+      }
+      have += n ;
+
+      while (ok && (have > 0))
+      {
+	if ((len = frameLength (buf, have)) < 0)	// Junk: NAK it, as the display would
+	{
+	  waitIdle (c) ;
+	  clientReply (c, &nak, 1) ;
+	  memmove (buf, buf + 1, --have) ;
+	}
+	else if ((len == 0) || (len > have))
+	  break ;
+	else
+	{
+	  waitRoom (c) ;
+	  handleFrame (c, buf, len) ;
+	  memmove (buf, buf + len, have - len) ;
+	  have -= len ;
+	}
+	ok = (sendReplies (c) == 0) ;
+      }
+    }
+
+    if (ok)
+      ok = (sendReplies (c) == 0) ;
+  }
+
+  pthread_mutex_lock (&clientsLock) ;
+    for (p = &clients ; *p != NULL ; p = &(*p)->next)
+      if (*p == c)
+      {
+	*p = c->next ;
+	break ;
+      }
+  pthread_mutex_unlock (&clientsLock) ;
+
+  if (verbose)
+    fprintf (stderr, "genied: client %d %s\n", c->fd, ok ? "gone" : "not reading: dropped") ;
+
+  waitIdle (c) ;				// Nothing may still answer to it
+  close (c->fd) ;
+  close (c->wake [0]) ;
+  close (c->wake [1]) ;
+  pthread_cond_destroy  (&c->idle) ;
+  pthread_mutex_destroy (&c->lock) ;
+  pthread_mutex_destroy (&c->sendLock) ;
+  free (c) ;
+
+  return NULL ;
+}
+
+
+/*
+ * acceptThread:
+ *	Take new clients. They hear all events until they say otherwise.
+ *********************************************************************************
+ */
+static void *acceptThread (void *data)
+{
+  int listenFd = *(int *)data ;
+  struct geniedClient *c ;
+  pthread_t thread ;
+  int fd ;
+
+  for (;;)
+  {
+    if ((fd = accept (listenFd, NULL, NULL)) < 0)
+    {
+      if (errno != EINTR)
+	usleep (100000) ;
+      continue ;
+    }
+
+    if ((c = calloc (1, sizeof (struct geniedClient))) == NULL)
+    {
+      close (fd) ;
+      continue ;
+    }
+    if (pipe2 (c->wake, O_NONBLOCK | O_CLOEXEC) != 0)
+    {
+      close (fd) ;
+      free (c) ;
+      continue ;
+    }
+
+    c->fd = fd ;
+    pthread_mutex_init (&c->sendLock, NULL) ;
+    pthread_mutex_init (&c->lock, NULL) ;
+    pthread_cond_init  (&c->idle, NULL) ;
+    memset (c->events, 0xFF, sizeof (c->events)) ;
+
+    pthread_mutex_lock (&clientsLock) ;
+      c->next = clients ;
+      clients = c ;
+      if (pthread_create (&thread, NULL, clientThread, c) != 0)
+      {
+	clients = c->next ;
+	pthread_mutex_unlock (&clientsLock) ;
+	close (fd) ;
+	close (c->wake [0]) ;
+	close (c->wake [1]) ;
+	free (c) ;
+	continue ;
+      }
+    pthread_mutex_unlock (&clientsLock) ;
+
+    pthread_detach (thread) ;
+
+    if (verbose)
+      fprintf (stderr, "genied: client %d connected\n", fd) ;
+  }
+
+  return NULL ;
+}
+
+
+/*
+ * listenOn:
+ *	Create the server socket
+ *********************************************************************************
+ */
+static int listenOn (const char *path)
+{
+  struct sockaddr_un addr ;
+  int fd ;
+
+  if (strlen (path) >= sizeof (addr.sun_path))
+    return -1 ;
+
+  if ((fd = socket (AF_UNIX, SOCK_STREAM, 0)) == -1)
+    return -1 ;
+
+  memset (&addr, 0, sizeof (addr)) ;
+  addr.sun_family = AF_UNIX ;
+  strcpy (addr.sun_path, path) ;
+
+  unlink (path) ;
+
+  if ((bind (fd, (struct sockaddr *)&addr, sizeof (addr)) == -1) || (listen (fd, 8) == -1))
+  {
+    close (fd) ;
+    return -1 ;
+  }
+
+  chmod (path, 0660) ;
+
+  return fd ;
+}
+
+
+static void usage (const char *name)
+{
+  fprintf (stderr, "Usage: %s [-v] [-d device] [-b baud] [-s socket] [-c capture] [-e eventlog]\n", name) ;
+  exit (EXIT_FAILURE) ;
+}
+
+
+int main (int argc, char *argv [])
+{
+  struct genieReplyExStruct reply ;
+  struct geniedClient *c ;
+  unsigned char frame [GENIE_MAX_FRAME] ;
+  char *device = "/dev/serial0" ;
+  char *path   = GENIED_SOCKET ;
+  char *capture = NULL ;
+  char *eventLog = NULL ;
+  int   baud   = 115200 ;
+  int   listenFd, opt, len ;
+  pthread_t thread ;
+
+  while ((opt = getopt (argc, argv, "vd:b:s:c:e:")) != -1)
+    switch (opt)
+    {
+      case 'v':	verbose = TRUE ;		break ;
+      case 'd':	device  = optarg ;		break ;
+      case 'b':	baud    = atoi (optarg) ;	break ;
+      case 's':	path    = optarg ;		break ;
+      case 'c':	capture = optarg ;		break ;
+      case 'e':	eventLog = optarg ;		break ;
+      default:	usage (argv [0]) ;
+    }
+
+  signal (SIGPIPE, SIG_IGN) ;
+
+  if ((capture != NULL) && (genieCaptureStart (capture, 0) != 0))
+  {
+    fprintf (stderr, "%s: Unable to capture to %s: %s\n", argv [0], capture, strerror (errno)) ;
+    return EXIT_FAILURE ;
+  }
+
+  if ((eventLog != NULL) && (genieEventLogStart (eventLog, 0) != 0))
+  {
+    fprintf (stderr, "%s: Unable to publish events to %s: %s\n", argv [0], eventLog, strerror (errno)) ;
+    return EXIT_FAILURE ;
+  }
+
+  if (genieSetup (device, baud) != 0)
+  {
+    fprintf (stderr, "%s: Unable to open the display on %s: %s\n", argv [0], device, strerror (errno)) ;
+    return EXIT_FAILURE ;
+  }
+
+  if ((listenFd = listenOn (path)) < 0)
+  {
+    fprintf (stderr, "%s: Unable to listen on %s: %s\n", argv [0], path, strerror (errno)) ;
+    return EXIT_FAILURE ;
+  }
+
+  if (pthread_create (&thread, NULL, acceptThread, &listenFd) != 0)
+    return EXIT_FAILURE ;
+
+// Fan events from the display out, just as they came, to everyone who
+//	wants them. Magic and double byte reports have the length where
+//	the index would be, so go to those who'll take any index.
+
+  for (;;)
+  {
+    len = genieGetReplyFrame (&reply, frame) ;
+
+    pthread_mutex_lock (&clientsLock) ;
+      for (c = clients ; c != NULL ; c = c->next)
+	if (c->events [frame [1]][frame [2] >> 3] & (1 << (frame [2] & 7)))
+	  clientSend (c, frame, len) ;
+    pthread_mutex_unlock (&clientsLock) ;
+  }
+
+  return EXIT_SUCCESS ;
+}
@@ -0,0 +1,350 @@
+/*
+ * geniemon.c:
+ *	Watch the frames going to and from a Genie display, as published
+ *	by genieEventLogStart() (or genied -e) in a shared memory ring,
+ *	without getting in the way of the program driving it.
+ *
+ *	Frames are decoded and printed with the GENIE_OBJ_* names as they
+ *	appear. With -a whatever's still in the ring is shown first. If we
+ *	fall far enough behind to be written over, we say how many frames
+ *	were missed and carry on from the oldest one left.
+ *
+ *	Copyright (c) 2020 4D Systems PTY Ltd, Sydney, Australia
+ ***********************************************************************
+ * This file is part of geniePi:
+ *    geniePi is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as
+ *    published by the Free Software Foundation, either version 3 of the
+ *    License, or (at your option) any later version.
+ *
+ *    geniePi is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with geniePi.
+ *    If not, see <http://www.gnu.org/licenses/>.
+ ***********************************************************************
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "geniePi.h"
+
+#ifndef	TRUE
+#  define	TRUE (1==1)
+#  define	FALSE (1==0)
+#endif
+
+
+// What things are called
+
+static const char *objectNames [] =
+{
+  [GENIE_OBJ_DIPSW]		= "DIPSW",
+  [GENIE_OBJ_KNOB]		= "KNOB",
+  [GENIE_OBJ_ROCKERSW]		= "ROCKERSW",
+  [GENIE_OBJ_ROTARYSW]		= "ROTARYSW",
+  [GENIE_OBJ_SLIDER]		= "SLIDER",
+  [GENIE_OBJ_TRACKBAR]		= "TRACKBAR",
+  [GENIE_OBJ_WINBUTTON]		= "WINBUTTON",
+  [GENIE_OBJ_ANGULAR_METER]	= "ANGULAR_METER",
+  [GENIE_OBJ_COOL_GAUGE]	= "COOL_GAUGE",
+  [GENIE_OBJ_CUSTOM_DIGITS]	= "CUSTOM_DIGITS",
+  [GENIE_OBJ_FORM]		= "FORM",
+  [GENIE_OBJ_GAUGE]		= "GAUGE",
+  [GENIE_OBJ_IMAGE]		= "IMAGE",
+  [GENIE_OBJ_KEYBOARD]		= "KEYBOARD",
+  [GENIE_OBJ_LED]		= "LED",
+  [GENIE_OBJ_LED_DIGITS]	= "LED_DIGITS",
+  [GENIE_OBJ_METER]		= "METER",
+  [GENIE_OBJ_STRINGS]		= "STRINGS",
+  [GENIE_OBJ_THERMOMETER]	= "THERMOMETER",
+  [GENIE_OBJ_USER_LED]		= "USER_LED",
+  [GENIE_OBJ_VIDEO]		= "VIDEO",
+  [GENIE_OBJ_STATIC_TEXT]	= "STATIC_TEXT",
+  [GENIE_OBJ_SOUND]		= "SOUND",
+  [GENIE_OBJ_TIMER]		= "TIMER",
+  [GENIE_OBJ_SPECTRUM]		= "SPECTRUM",
+  [GENIE_OBJ_SCOPE]		= "SCOPE",
+  [GENIE_OBJ_TANK]		= "TANK",
+  [GENIE_OBJ_USERIMAGES]	= "USERIMAGES",
+  [GENIE_OBJ_PINOUTPUT]		= "PINOUTPUT",
+  [GENIE_OBJ_PININPUT]		= "PININPUT",
+  [GENIE_OBJ_4DBUTTON]		= "4DBUTTON",
+  [GENIE_OBJ_ANIBUTTON]		= "ANIBUTTON",
+  [GENIE_OBJ_COLORPICKER]	= "COLORPICKER",
+  [GENIE_OBJ_USERBUTTON]	= "USERBUTTON",
+  [GENIE_OBJ_SMARTGAUGE]	= "SMARTGAUGE",
+  [GENIE_OBJ_SMARTSLIDER]	= "SMARTSLIDER",
+  [GENIE_OBJ_SMARTKNOB]		= "SMARTKNOB",
+  [GENIE_OBJ_ILED_DIGITS_H]	= "ILED_DIGITS_H",
+  [GENIE_OBJ_IANGULAR_METER]	= "IANGULAR_METER",
+  [GENIE_OBJ_IGAUGE]		= "IGAUGE",
+  [GENIE_OBJ_ILABEL]		= "ILABEL",
+  [GENIE_OBJ_IUSER_GAUGE]	= "IUSER_GAUGE",
+  [GENIE_OBJ_IMEDIA_GAUGE]	= "IMEDIA_GAUGE",
+  [GENIE_OBJ_IMEDIA_THERMOMETER]	= "IMEDIA_THERMOMETER",
+  [GENIE_OBJ_ILED]		= "ILED",
+  [GENIE_OBJ_IMEDIA_LED]	= "IMEDIA_LED",
+  [GENIE_OBJ_ILED_DIGITS_L]	= "ILED_DIGITS_L",
+  [GENIE_OBJ_INEEDLE]		= "INEEDLE",
+  [GENIE_OBJ_IRULER]		= "IRULER",
+  [GENIE_OBJ_ILED_DIGIT]	= "ILED_DIGIT",
+  [GENIE_OBJ_IBUTTOND]		= "IBUTTOND",
+  [GENIE_OBJ_IBUTTONE]		= "IBUTTONE",
+  [GENIE_OBJ_IMEDIA_BUTTON]	= "IMEDIA_BUTTON",
+  [GENIE_OBJ_ITOGGLE_INPUT]	= "ITOGGLE_INPUT",
+  [GENIE_OBJ_IDIAL]		= "IDIAL",
+  [GENIE_OBJ_IMEDIA_ROTARY]	= "IMEDIA_ROTARY",
+  [GENIE_OBJ_IROTARY_INPUT]	= "IROTARY_INPUT",
+  [GENIE_OBJ_ISWITCH]		= "ISWITCH",
+  [GENIE_OBJ_ISWITCHB]		= "ISWITCHB",
+  [GENIE_OBJ_ISLIDERE]		= "ISLIDERE",
+  [GENIE_OBJ_IMEDIA_SLIDER]	= "IMEDIA_SLIDER",
+  [GENIE_OBJ_ISLIDERH]		= "ISLIDERH",
+  [GENIE_OBJ_ISLIDERG]		= "ISLIDERG",
+  [GENIE_OBJ_ISLIDERF]		= "ISLIDERF",
+  [GENIE_OBJ_ISLIDERD]		= "ISLIDERD",
+  [GENIE_OBJ_ISLIDERC]		= "ISLIDERC",
+  [GENIE_OBJ_ILINEAR_INPUT]	= "ILINEAR_INPUT",
+} ;
+
+static const char *objectName (int object)
+{
+  static char unknown [16] ;
+
+  if ((object < (int)(sizeof (objectNames) / sizeof (objectNames [0]))) && (objectNames [object] != NULL))
+    return objectNames [object] ;
+
+  sprintf (unknown, "OBJ_%d", object) ;
+  return unknown ;
+}
+
+
+/*
+ * printFrame:
+ *	Say what a frame is. Only the first GENIE_EVLOG_DATA bytes of it
+ *	are in the log, and len is how long it really was.
+ *********************************************************************************
+ */
+static void printFrame (const struct genieEventLogRecord *rec)
+{
+  const unsigned char *d = rec->data ;
+  int have = (rec->len < GENIE_EVLOG_DATA) ? rec->len : GENIE_EVLOG_DATA ;
+  int rx   = (rec->dir == GENIE_CAPTURE_RX) ;
+  int i ;
+
+  if (have < 1)
+    return ;
+
+  if (have < 3)				// ACK, NAK or a fragment
+  {
+    if (rx && (d [0] == GENIE_ACK))
+      printf ("ACK") ;
+    else if (rx && (d [0] == GENIE_NAK))
+      printf ("NAK") ;
+    else
+      for (i = 0 ; i < have ; ++i)
+	printf ("%02X ", d [i]) ;
+    return ;
+  }
+
+  switch (d [0] | (rx << 8))
+  {
+    case GENIE_READ_OBJ:
+      printf ("READ_OBJ       %s[%d]", objectName (d [1]), d [2]) ;
+      return ;
+
+    case GENIE_WRITE_OBJ:
+      printf ("WRITE_OBJ      %s[%d] = %d", objectName (d [1]), d [2], (have >= 5) ? (d [3] << 8 | d [4]) : -1) ;
+      return ;
+
+    case GENIE_WRITE_CONTRAST:
+      printf ("WRITE_CONTRAST %d", d [1]) ;
+      return ;
+
+    case GENIE_WRITE_STR:
+    case GENIE_WRITE_INH_LABEL:
+      printf ("%-14s %d \"", (d [0] == GENIE_WRITE_STR) ? "WRITE_STR" : "WRITE_INH_LABEL", d [1]) ;
+      for (i = 3 ; (i < have) && (i < 3 + d [2]) ; ++i)
+	putchar (((d [i] >= ' ') && (d [i] < 0x7F)) ? d [i] : '.') ;
+      printf ("%s\"", (rec->len > GENIE_EVLOG_DATA) ? "..." : "") ;
+      return ;
+
+    case GENIE_WRITE_STRU:
+      printf ("WRITE_STRU     %d, %d characters", d [1], d [2]) ;
+      return ;
+
+    case GENIE_MAGIC_BYTES:
+    case GENIE_DOUBLE_BYTES:
+      printf ("%-14s %d, %d %s", (d [0] == GENIE_MAGIC_BYTES) ? "MAGIC_BYTES" : "DOUBLE_BYTES", d [1], d [2],
+	(d [0] == GENIE_MAGIC_BYTES) ? "bytes" : "words") ;
+      return ;
+
+    case GENIED_SUBSCRIBE:
+    case GENIED_UNSUBSCRIBE:
+      printf ("%-14s ", (d [0] == GENIED_SUBSCRIBE) ? "SUBSCRIBE" : "UNSUBSCRIBE") ;
+      if ((have >= 4) && (d [3] & GENIED_ANY_OBJECT))
+	printf ("ALL") ;
+      else
+	printf ("%s", objectName (d [1])) ;
+      if ((have >= 4) && (d [3] & GENIED_ANY_INDEX))
+	printf ("[ALL]") ;
+      else
+	printf ("[%d]", d [2]) ;
+      return ;
+
+    case 0x100 | GENIE_REPORT_OBJ:
+    case 0x100 | GENIE_REPORT_EVENT:
+      printf ("%-14s %s[%d] = %d", (d [0] == GENIE_REPORT_OBJ) ? "REPORT_OBJ" : "REPORT_EVENT",
+	objectName (d [1]), d [2], (have >= 5) ? (d [3] << 8 | d [4]) : -1) ;
+      return ;
+
+    case 0x100 | GENIE_REPORT_MAGIC_BYTES:
+    case 0x100 | GENIE_REPORT_DOUBLE_BYTES:
+      printf ("%-14s %d, %d %s", (d [0] == GENIE_REPORT_MAGIC_BYTES) ? "REPORT_MAGIC" : "REPORT_DOUBLE", d [1], d [2],
+	(d [0] == GENIE_REPORT_MAGIC_BYTES) ? "bytes" : "words") ;
+      return ;
+  }
+
+  printf ("?") ;
+  for (i = 0 ; i < have ; ++i)
+    printf (" %02X", d [i]) ;
+}
+
+
+/*
+ * checksumOk:
+ *	Whether a frame we have all of adds up. Those cut short we can't
+ *	tell, so they're given the benefit of the doubt.
+ *********************************************************************************
+ */
+static int checksumOk (const struct genieEventLogRecord *rec)
+{
+  unsigned int sum = 0 ;
+  int i ;
+
+  if ((rec->len < 3) || (rec->len > GENIE_EVLOG_DATA))
+    return TRUE ;
+
+  for (i = 0 ; i < rec->len ; ++i)
+    sum ^= rec->data [i] ;
+
+  return sum == 0 ;
+}
+
+
+static void usage (const char *name)
+{
+  fprintf (stderr, "Usage: %s [-a] eventlog\n", name) ;
+  exit (EXIT_FAILURE) ;
+}
+
+
+int main (int argc, char *argv [])
+{
+  const struct genieEventLogHeader *log ;
+  const struct genieEventLogRecord *ring ;
+  struct genieEventLogRecord rec ;
+  unsigned long long pos, head, seq, first = 0 ;
+  int all = FALSE, started = FALSE ;
+  struct stat st ;
+  int fd, opt ;
+
+  while ((opt = getopt (argc, argv, "a")) != -1)
+    switch (opt)
+    {
+      case 'a':	all = TRUE ;	break ;
+      default:	usage (argv [0]) ;
+    }
+
+  if (optind != argc - 1)
+    usage (argv [0]) ;
+
+  if (((fd = open (argv [optind], O_RDONLY)) == -1) || (fstat (fd, &st) == -1))
+  {
+    fprintf (stderr, "%s: Unable to open %s: %s\n", argv [0], argv [optind], strerror (errno)) ;
+    return EXIT_FAILURE ;
+  }
+
+  log = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0) ;
+  close (fd) ;
+
+  if ((log == MAP_FAILED) || (st.st_size < (off_t)sizeof (*log)) ||
+      (log->magic != GENIE_EVLOG_MAGIC) || (log->version != GENIE_EVLOG_VERSION) ||
+      (log->recordSize != sizeof (struct genieEventLogRecord)) ||
+      (sizeof (*log) + (unsigned long long)log->records * sizeof (rec) > (unsigned long long)st.st_size))
+  {
+    fprintf (stderr, "%s: %s isn't a geniePi event log\n", argv [0], argv [optind]) ;
+    return EXIT_FAILURE ;
+  }
+
+  ring = (const struct genieEventLogRecord *)(log + 1) ;
+
+  head = log->head ;
+  pos  = (!all) ? head : (head > log->records) ? head - log->records : 0 ;
+
+  for (;;)
+  {
+    head = log->head ;
+
+    if (head < pos)				// Started again
+      pos = 0 ;
+
+    if (head - pos > log->records)		// Written over while we weren't looking
+    {
+      printf ("-- %llu frames missed --\n", head - pos - log->records) ;
+      pos = head - log->records ;
+    }
+
+    if (pos == head)
+    {
+      fflush (stdout) ;
+      usleep (2000) ;
+      continue ;
+    }
+
+// Take a copy, and make sure it didn't change under us
+
+    seq = ring [pos & (log->records - 1)].seq ;
+    if (seq != 2 * pos + 2)
+    {
+      if (seq > 2 * pos + 2)			// Already written over
+	++pos ;
+      else
+	usleep (100) ;				// Still being written
+      continue ;
+    }
+    __sync_synchronize () ;
+    rec = ring [pos & (log->records - 1)] ;
+    __sync_synchronize () ;
+    if (ring [pos & (log->records - 1)].seq != seq)
+      continue ;
+    ++pos ;
+
+    if (!started)
+    {
+      first   = rec.stamp ;
+      started = TRUE ;
+    }
+
+    printf ("%12.6f %s ", (rec.stamp - first) / 1e9, (rec.dir == GENIE_CAPTURE_TX) ? "TX" : "RX") ;
+    printFrame (&rec) ;
+    if (!checksumOk (&rec))
+      printf ("  (bad checksum)") ;
+    putchar ('\n') ;
+  }
+
+  return EXIT_SUCCESS ;
+}
@@ -0,0 +1,202 @@
+/*
+ * geniereplay.c:
+ *	Play back a capture of the traffic to and from a Genie display,
+ *	made with genieCaptureStart() (or genied -c), so problems seen in
+ *	the field can be looked at on the bench.
+ *
+ *	By default the received bytes are fed back through the library's
+ *	own listener, at the speed they arrived or faster, and the events
+ *	it comes up with are printed along with the figures it kept. With
+ *	-d the records are just dumped.
+ *
+ *	Copyright (c) 2020 4D Systems PTY Ltd, Sydney, Australia
+ ***********************************************************************
+ * This file is part of geniePi:
+ *    geniePi is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as
+ *    published by the Free Software Foundation, either version 3 of the
+ *    License, or (at your option) any later version.
+ *
+ *    geniePi is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with geniePi.
+ *    If not, see <http://www.gnu.org/licenses/>.
+ ***********************************************************************
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "geniePi.h"
+
+#ifndef	TRUE
+#  define	TRUE (1==1)
+#  define	FALSE (1==0)
+#endif
+
+
+/*
+ * copyOut:
+ *	Copy len bytes from the ring at pos, which may wrap.
+ *********************************************************************************
+ */
+static void copyOut (const struct genieCaptureHeader *cap, void *dst, unsigned long long pos, unsigned int len)
+{
+  const unsigned char *ring = (const unsigned char *)(cap + 1) ;
+  unsigned int off   = pos % cap->size ;
+  unsigned int first = cap->size - off ;
+
+  if (first >= len)
+    memcpy (dst, ring + off, len) ;
+  else
+  {
+    memcpy (dst, ring + off, first) ;
+    memcpy ((unsigned char *)dst + first, ring, len - first) ;
+  }
+}
+
+
+/*
+ * dump:
+ *	Print every record: time since the first, direction and bytes.
+ *********************************************************************************
+ */
+static int dump (const char *path)
+{
+  struct genieCaptureHeader *cap ;
+  struct genieCaptureRecord rec ;
+  unsigned char data [65536] ;
+  unsigned long long pos, first = 0, last = 0, count = 0 ;
+  struct stat st ;
+  int fd, i ;
+
+  if ((fd = open (path, O_RDONLY)) == -1)
+    return -1 ;
+  if ((fstat (fd, &st) == -1) || (st.st_size < (off_t)sizeof (*cap)) ||
+      ((cap = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED))
+    { close (fd) ; errno = EINVAL ; return -1 ; }
+  close (fd) ;
+
+  if ((cap->magic != GENIE_CAPTURE_MAGIC) || (cap->version != GENIE_CAPTURE_VERSION) ||
+      (cap->size + sizeof (*cap) > (unsigned long long)st.st_size))
+    { munmap (cap, st.st_size) ; errno = EINVAL ; return -1 ; }
+
+  for (pos = cap->tail ; pos < cap->head ; pos += sizeof (rec) + rec.len)
+  {
+    copyOut (cap, &rec, pos, sizeof (rec)) ;
+    copyOut (cap, data, pos + sizeof (rec), rec.len) ;
+
+    if (pos == cap->tail)
+      first = last = rec.stamp ;
+
+    printf ("%12.3f %+10.3f %s", (rec.stamp - first) / 1e6, (rec.stamp - last) / 1e6,
+	rec.dir == GENIE_CAPTURE_TX ? "TX" : "RX") ;
+    for (i = 0 ; i < rec.len ; ++i)
+      printf (" %02X", data [i]) ;
+    putchar ('\n') ;
+
+    last = rec.stamp ;
+    ++count ;
+  }
+
+  printf ("%llu records, of %llu captured\n", count, cap->records) ;
+
+  munmap (cap, st.st_size) ;
+  return 0 ;
+}
+
+
+static void usage (const char *name)
+{
+  fprintf (stderr, "Usage: %s [-d] [-s speed] capture\n", name) ;
+  exit (EXIT_FAILURE) ;
+}
+
+
+int main (int argc, char *argv [])
+{
+  struct genieReplyExStruct reply ;
+  struct genieLatencyStats latency ;
+  unsigned long long first = 0 ;
+  unsigned int nextSeq = 0 ;
+  unsigned long events = 0, gaps = 0 ;
+  double speed = 1.0 ;
+  int dumpOnly = FALSE ;
+  int opt, quiet ;
+
+  while ((opt = getopt (argc, argv, "ds:")) != -1)
+    switch (opt)
+    {
+      case 'd':	dumpOnly = TRUE ;		break ;
+      case 's':	speed    = atof (optarg) ;	break ;
+      default:	usage (argv [0]) ;
+    }
+
+  if (optind != argc - 1)
+    usage (argv [0]) ;
+
+  if (dumpOnly)
+  {
+    if (dump (argv [optind]) != 0)
+    {
+      fprintf (stderr, "%s: Unable to read %s: %s\n", argv [0], argv [optind], strerror (errno)) ;
+      return EXIT_FAILURE ;
+    }
+    return EXIT_SUCCESS ;
+  }
+
+  if (genieSetupReplay (argv [optind], speed) != 0)
+  {
+    fprintf (stderr, "%s: Unable to replay %s: %s\n", argv [0], argv [optind], strerror (errno)) ;
+    return EXIT_FAILURE ;
+  }
+
+// Print events until the capture has run out and the listener has
+//	had time to finish the last of it
+
+  for (quiet = 0 ; quiet < 50 ; )
+  {
+    if (!genieReplyAvail ())
+    {
+      if (genieReplayDone ())
+	++quiet ;
+      usleep (1000) ;
+      continue ;
+    }
+    quiet = 0 ;
+
+    genieGetReplyEx (&reply) ;
+    if (events++ == 0)
+      first = reply.timestamp ;
+    else if (reply.seq - (reply.count - 1) != nextSeq)
+      ++gaps ;
+    nextSeq = reply.seq + 1 ;
+
+    printf ("%12.3f seq %6u cmd %2d object %2d index %3d data %5u",
+	(reply.timestamp - first) / 1e6, reply.seq, reply.cmd, reply.object, reply.index, reply.data) ;
+    if (reply.count > 1)
+      printf (" (%u merged)", reply.count) ;
+    putchar ('\n') ;
+  }
+
+  genieGetLatencyStats (&latency, FALSE) ;
+
+  printf ("%lu events, %lu gaps in the sequence\n", events, gaps) ;
+  if (latency.count != 0)
+    printf ("queue latency: min %lluuS, avg %lluuS, max %lluuS\n",
+	latency.minUs, latency.totalUs / latency.count, latency.maxUs) ;
+
+  return EXIT_SUCCESS ;
+}